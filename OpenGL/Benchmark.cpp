@@ -0,0 +1,356 @@
+#include "Benchmark.h"
+
+typedef chrono::high_resolution_clock BenchmarkClock;
+
+static double elapsedMs(BenchmarkClock::time_point start) {
+	return chrono::duration<double, milli>(BenchmarkClock::now() - start).count();
+}
+
+int runBenchmarks(int argc, char **argv) {
+
+	string name = argc > 0 ? argv[0] : "";
+
+	if (name == "static") {
+		int roomsPerSide = argc > 1 ? atoi(argv[1]) : 16;
+		int queries = argc > 2 ? atoi(argv[2]) : 100000;
+		benchmarkStaticGeometry(roomsPerSide, queries);
+		return 0;
+	}
+
+	if (name == "water") {
+		int particles = argc > 1 ? atoi(argv[1]) : 50000;
+		int steps = argc > 2 ? atoi(argv[2]) : 300;
+		benchmarkWater(particles, steps);
+		return 0;
+	}
+
+	if (name == "particles") {
+		int particles = argc > 1 ? atoi(argv[1]) : 1000000;
+		int steps = argc > 2 ? atoi(argv[2]) : 300;
+		benchmarkParticles(particles, steps);
+		return 0;
+	}
+
+	if (name == "occlusion") {
+		int roomsPerSide = argc > 1 ? atoi(argv[1]) : 16;
+		int frames = argc > 2 ? atoi(argv[2]) : 360;
+		benchmarkOcclusion(roomsPerSide, frames);
+		return 0;
+	}
+
+	if (name == "bubbles") {
+		int samples = argc > 1 ? atoi(argv[1]) : 32;
+		return checkBubbleSpawns(samples);
+	}
+
+	cout << "Usage: --benchmark static [roomsPerSide] [queries]" << endl;
+	cout << "       --benchmark water [particles] [steps]" << endl;
+	cout << "       --benchmark particles [particles] [steps]" << endl;
+	cout << "       --benchmark occlusion [roomsPerSide] [frames]" << endl;
+	cout << "       --benchmark bubbles [samplesPerAxis]" << endl;
+	return 1;
+}
+
+static void addRoomGrid(BulletWorld *world, int roomsPerSide) {
+
+	for (int i = 0; i < roomsPerSide; i++)
+	{
+		for (int j = 0; j < roomsPerSide; j++)
+		{
+			string name = "room_" + to_string(i) + "_" + to_string(j);
+			float x = i * 20.0f;
+			float z = j * 20.0f;
+
+			switch ((i * roomsPerSide + j) % 6)
+			{
+			case 0: world->addRoom1(name, 20.0f, 20.0f, 20.0f, x, 0.0f, z); break;
+			case 1: world->addRoom2(name, 20.0f, 20.0f, 20.0f, x, 0.0f, z); break;
+			case 2: world->addRoom3(name, 20.0f, 20.0f, 20.0f, x, 0.0f, z); break;
+			case 3: world->addRoom4(name, 20.0f, 20.0f, 20.0f, x, 0.0f, z); break;
+			case 4: world->addRoom5(name, 20.0f, 20.0f, 20.0f, x, 0.0f, z); break;
+			default: world->addRoom6(name, 20.0f, 20.0f, 20.0f, x, 0.0f, z); break;
+			}
+		}
+	}
+}
+
+// 12 triangles per wall box, in world space
+static btTriangleMesh* buildWallTriangleMesh(BulletWorld *world) {
+
+	static const int faces[12][3] = {
+		{ 0, 1, 3 }, { 0, 3, 2 }, { 4, 6, 7 }, { 4, 7, 5 },
+		{ 0, 4, 5 }, { 0, 5, 1 }, { 2, 3, 7 }, { 2, 7, 6 },
+		{ 0, 2, 6 }, { 0, 6, 4 }, { 1, 5, 7 }, { 1, 7, 3 }
+	};
+
+	btTriangleMesh* mesh = new btTriangleMesh();
+	map<string, btRigidBody*> walls = world->getRooms();
+
+	for (map<string, btRigidBody*>::iterator it = walls.begin(); it != walls.end(); ++it)
+	{
+		btVector3 extent = ((btBoxShape*)(*it).second->getCollisionShape())->getHalfExtentsWithMargin();
+		const btTransform& t = (*it).second->getWorldTransform();
+
+		int corners[8];
+		for (int c = 0; c < 8; c++)
+		{
+			btVector3 local((c & 4) ? extent.x() : -extent.x(), (c & 2) ? extent.y() : -extent.y(), (c & 1) ? extent.z() : -extent.z());
+			corners[c] = mesh->findOrAddVertex(t(local), false);
+		}
+
+		for (int f = 0; f < 12; f++)
+			mesh->addTriangleIndices(corners[faces[f][0]], corners[faces[f][1]], corners[faces[f][2]]);
+	}
+
+	return mesh;
+}
+
+static int castRays(BulletWorld *world, const vector<btVector3>& from, const vector<btVector3>& to) {
+
+	int hits = 0;
+	for (unsigned int i = 0; i < from.size(); i++)
+	{
+		btCollisionWorld::ClosestRayResultCallback callback(from[i], to[i]);
+		world->getWorld()->rayTest(from[i], to[i], callback);
+		if (callback.hasHit())
+			hits++;
+	}
+	return hits;
+}
+
+void benchmarkStaticGeometry(int roomsPerSide, int queries) {
+
+	const string cachePath = "benchmark_level.bvh";
+	const uint64_t key = 0x9E3779B97F4A7C15ULL ^ (uint64_t)roomsPerSide;
+	remove(cachePath.c_str());
+
+	BenchmarkClock::time_point start = BenchmarkClock::now();
+	BulletWorld *boxWorld = new BulletWorld(glm::vec3(0.0f, -10.0f, 0.0f));
+	addRoomGrid(boxWorld, roomsPerSide);
+	double boxLoad = elapsedMs(start);
+
+	start = BenchmarkClock::now();
+	btTriangleMesh *buildMesh = buildWallTriangleMesh(boxWorld);
+	double meshLoad = elapsedMs(start);
+
+	start = BenchmarkClock::now();
+	BulletWorld *builtWorld = new BulletWorld(glm::vec3(0.0f, -10.0f, 0.0f));
+	builtWorld->addTriangleMesh("level", buildMesh, cachePath, key, 0.0f, 0.0f, 0.0f);
+	double bvhBuild = elapsedMs(start);
+
+	btTriangleMesh *mappedMesh = buildWallTriangleMesh(boxWorld);
+
+	start = BenchmarkClock::now();
+	BulletWorld *mappedWorld = new BulletWorld(glm::vec3(0.0f, -10.0f, 0.0f));
+	mappedWorld->addTriangleMesh("level", mappedMesh, cachePath, key, 0.0f, 0.0f, 0.0f);
+	double bvhMapped = elapsedMs(start);
+
+	float extent = roomsPerSide * 20.0f;
+	vector<btVector3> from(queries), to(queries);
+	srand(1);
+	for (int i = 0; i < queries; i++)
+	{
+		from[i] = btVector3(-10.0f + extent * rand() / RAND_MAX, 20.0f * rand() / RAND_MAX, -20.0f + extent * rand() / RAND_MAX);
+		to[i] = from[i] + btVector3(-15.0f + 30.0f * rand() / RAND_MAX, -15.0f + 30.0f * rand() / RAND_MAX, -15.0f + 30.0f * rand() / RAND_MAX);
+	}
+
+	start = BenchmarkClock::now();
+	int boxHits = castRays(boxWorld, from, to);
+	double boxQuery = elapsedMs(start);
+
+	start = BenchmarkClock::now();
+	int meshHits = castRays(mappedWorld, from, to);
+	double meshQuery = elapsedMs(start);
+
+	cout << "static geometry: " << roomsPerSide * roomsPerSide << " rooms, " << boxWorld->getRooms().size() << " wall boxes" << endl;
+	cout << "  load   boxes " << boxLoad << " ms | triangles " << meshLoad << " ms + bvh build " << bvhBuild << " ms | bvh mapped " << bvhMapped << " ms" << endl;
+	cout << "  query  boxes " << boxQuery << " ms (" << boxHits << " hits) | bvh " << meshQuery << " ms (" << meshHits << " hits) for " << queries << " rays" << endl;
+
+	delete mappedWorld;
+	delete builtWorld;
+	delete boxWorld;
+	remove(cachePath.c_str());
+}
+
+// Room 5 filled with water, with a box dropped in to check the coupling
+void benchmarkWater(int particles, int steps) {
+
+	BenchmarkClock::time_point start = BenchmarkClock::now();
+	FluidSystem *water = new FluidSystem(glm::vec3(-29.5f, 0.5f, 0.5f), glm::vec3(-10.5f, 19.5f, 19.5f), 15.0f, particles);
+	double setup = elapsedMs(start);
+
+	BulletWorld *world = new BulletWorld(glm::vec3(0.0f, -10.0f, 0.0f));
+	world->addFloor("floor", glm::vec3(0, 0, 0), glm::vec3(0, 1, 0), 0.0f);
+	world->addRoom5("room", 20.0f, 20.0f, 20.0f, -20.0f, 0.0f, 20.0f);
+	btRigidBody *box = world->addBox("box", 1.0f, 1.0f, 1.0f, -20.0f, 18.0f, 10.0f, 1.0f);
+
+	double simulation = 0.0, slowest = 0.0;
+	for (int i = 0; i < steps; i++)
+	{
+		start = BenchmarkClock::now();
+		water->step(world->getTimeStep());
+		double stepTime = elapsedMs(start);
+		simulation += stepTime;
+		slowest = stepTime > slowest ? stepTime : slowest;
+
+		water->applyBodyForces(box, 0.5f, 2.0f);
+		world->stepSimulate();
+	}
+
+	btVector3 aabbMin, aabbMax;
+	box->getAabb(aabbMin, aabbMax);
+	glm::vec3 flow;
+	float submerged = water->sampleVolume(glm::vec3(aabbMin.getX(), aabbMin.getY(), aabbMin.getZ()), glm::vec3(aabbMax.getX(), aabbMax.getY(), aabbMax.getZ()), flow);
+
+	cout << "water: " << water->getParticleCount() << " particles, spacing " << water->getParticleSpacing() << ", " << ThreadPool::getThreadPool().getThreadCount() << " threads" << endl;
+	cout << "  setup " << setup << " ms | step " << simulation / glm::max(steps, 1) << " ms average, " << slowest << " ms slowest over " << steps << " steps" << endl;
+	cout << "  box at y " << box->getCenterOfMassPosition().getY() << ", " << submerged * 100.0f << "% submerged" << endl;
+
+	delete world;
+	delete water;
+}
+
+// Dust blowing through room 3, colliding with the level
+void benchmarkParticles(int particles, int steps) {
+
+	BulletWorld *world = new BulletWorld(glm::vec3(0.0f, -10.0f, 0.0f));
+	world->addRoom3("room", 20.0f, 20.0f, 20.0f, 20.0f, 0.0f, 0.0f);
+	DistanceField *field = new DistanceField(world);
+
+	ParticleEmitter emitter;
+	emitter.spawnMin = glm::vec3(10.0f, 1.0f, -20.0f);
+	emitter.spawnMax = glm::vec3(30.0f, 19.0f, 0.0f);
+	emitter.boundsMin = glm::vec3(10.0f, 0.0f, -20.0f);
+	emitter.boundsMax = glm::vec3(30.0f, 19.0f, 0.0f);
+	emitter.velocity = glm::vec3(1.8f, 0.0f, -1.8f);
+	emitter.velocityJitter = glm::vec3(0.1f);
+	emitter.rotationAxis = glm::vec3(0.4f, 0.6f, 0.8f);
+	emitter.lifetimeMin = 2.0f;
+	emitter.lifetimeMax = 8.0f;
+	emitter.scaleMin = emitter.scaleMax = 0.005f;
+
+	ParticleSystem *plain = new ParticleSystem(nullptr);
+	ParticleSystem *colliding = new ParticleSystem(field);
+	plain->addEmitter(emitter, particles);
+	emitter.collisionRadius = 0.01f;
+	unsigned int dust = colliding->addEmitter(emitter, particles);
+
+	BenchmarkClock::time_point start = BenchmarkClock::now();
+	for (int i = 0; i < steps; i++)
+		plain->update(1.0f / 60.0f);
+	double plainTime = elapsedMs(start) / glm::max(steps, 1);
+
+	start = BenchmarkClock::now();
+	for (int i = 0; i < steps; i++)
+		colliding->update(1.0f / 60.0f);
+	double collidingTime = elapsedMs(start) / glm::max(steps, 1);
+
+	unsigned char *instances = new unsigned char[particles * getInstanceStride(INSTANCE_MATRIX)];
+	double instanceTimes[3];
+	for (int format = INSTANCE_POSITION_SCALE; format <= INSTANCE_MATRIX; format++)
+	{
+		start = BenchmarkClock::now();
+		colliding->writeInstances(dust, (InstanceFormat)format, instances);
+		instanceTimes[format] = elapsedMs(start);
+	}
+
+	cout << "particles: " << particles << ", " << ThreadPool::getThreadPool().getThreadCount() << " threads" << endl;
+	cout << "  update " << plainTime << " ms | with level collision " << collidingTime << " ms" << endl;
+	cout << "  instances: position+scale (" << getInstanceStride(INSTANCE_POSITION_SCALE) << " B) " << instanceTimes[INSTANCE_POSITION_SCALE]
+		<< " ms | +rotation (" << getInstanceStride(INSTANCE_POSITION_SCALE_ROTATION) << " B) " << instanceTimes[INSTANCE_POSITION_SCALE_ROTATION]
+		<< " ms | matrix (" << getInstanceStride(INSTANCE_MATRIX) << " B) " << instanceTimes[INSTANCE_MATRIX] << " ms" << endl;
+
+	delete[] instances;
+	delete colliding;
+	delete plain;
+	delete field;
+	delete world;
+}
+
+// Camera turning around in the corner room of the grid, rooms are tested against the walls drawn on the CPU
+void benchmarkOcclusion(int roomsPerSide, int frames) {
+
+	BulletWorld *world = new BulletWorld(glm::vec3(0.0f, -10.0f, 0.0f));
+	addRoomGrid(world, roomsPerSide);
+
+	OcclusionBuffer *occlusion = new OcclusionBuffer();
+	occlusion->addOccluders(world);
+
+	vector<glm::vec3> roomsMin, roomsMax;
+	for (int i = 0; i < roomsPerSide; i++)
+	{
+		for (int j = 0; j < roomsPerSide; j++)
+		{
+			roomsMin.push_back(glm::vec3(i * 20.0f - 10.0f, 0.0f, j * 20.0f - 20.0f));
+			roomsMax.push_back(glm::vec3(i * 20.0f + 10.0f, 20.0f, j * 20.0f));
+		}
+	}
+
+	glm::vec3 eye(0.0f, 5.0f, -10.0f);
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1280.0f / 720.0f, 0.1f, 100.0f);
+	Frustum frustum;
+
+	double renderTime = 0.0, testTime = 0.0;
+	size_t inFrustum = 0, unoccluded = 0;
+	for (int f = 0; f < frames; f++)
+	{
+		float yaw = glm::radians(360.0f * f / glm::max(frames, 1));
+		glm::mat4 viewProjection = projection * glm::lookAt(eye, eye + glm::vec3(cos(yaw), -0.1f, sin(yaw)), glm::vec3(0.0f, 1.0f, 0.0f));
+
+		BenchmarkClock::time_point start = BenchmarkClock::now();
+		occlusion->render(viewProjection);
+		occlusion->wait();
+		renderTime += elapsedMs(start);
+
+		frustum.update(viewProjection);
+		start = BenchmarkClock::now();
+		for (size_t r = 0; r < roomsMin.size(); r++)
+		{
+			if (!frustum.isVisible(roomsMin[r], roomsMax[r]))
+				continue;
+			inFrustum++;
+			if (occlusion->isVisible(roomsMin[r], roomsMax[r]))
+				unoccluded++;
+		}
+		testTime += elapsedMs(start);
+	}
+
+	frames = glm::max(frames, 1);
+	cout << "occlusion: " << roomsMin.size() << " rooms, " << occlusion->getOccluderCount() << " occluders, " << occlusion->getWidth() << "x" << occlusion->getHeight() << " depth" << endl;
+	cout << "  render " << renderTime / frames << " ms | room tests " << testTime / frames << " ms" << endl;
+	cout << "  rooms per frame: " << (double)inFrustum / frames << " in the frustum, " << (double)unoccluded / frames << " not occluded" << endl;
+
+	delete occlusion;
+	delete world;
+}
+
+// Every point of the bubbles' spawn box, corners included, must be clear of room 5 by the collision radius,
+// or the particles spawned there are recycled as hits right away
+int checkBubbleSpawns(int samplesPerAxis) {
+
+	BulletWorld *world = new BulletWorld(glm::vec3(0.0f, -10.0f, 0.0f));
+	world->addRoom5("room_5", 20.0f, 20.0f, 20.0f, -20.0f, 0.0f, 20.0f);
+	DistanceField *field = new DistanceField(world);
+
+	ParticleEmitter emitter = RenderSystem::makeBubblesEmitter();
+	int n = glm::max(samplesPerAxis, 2);
+
+	vector<float> x, y, z;
+	for (int i = 0; i < n; i++)
+		for (int j = 0; j < n; j++)
+			for (int k = 0; k < n; k++)
+			{
+				glm::vec3 t = glm::vec3((float)i, (float)j, (float)k) / (float)(n - 1);
+				x.push_back(emitter.spawnMin.x + (emitter.spawnMax.x - emitter.spawnMin.x) * t.x);
+				y.push_back(emitter.spawnMin.y + (emitter.spawnMax.y - emitter.spawnMin.y) * t.y);
+				z.push_back(emitter.spawnMin.z + (emitter.spawnMax.z - emitter.spawnMin.z) * t.z);
+			}
+
+	unsigned int hits = field->collide(&x[0], &y[0], &z[0], 1, x.size(), emitter.collisionRadius);
+
+	cout << "bubbles: " << x.size() << " spawn points, " << hits << " touch the level" << endl;
+
+	delete field;
+	delete world;
+	return hits == 0 ? 0 : 1;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <btBulletDynamicsCommon.h>
+
+#include "BulletWorld.h"
+#include "FluidSystem.h"
+#include "Frustum.h"
+#include "OcclusionBuffer.h"
+#include "ParticleSystem.h"
+#include "RenderSystem.h"
+
+using namespace std;
+
+// Headless benchmarks and checks, run with "OpenGL.exe --benchmark <name> [args]". No window or GL context is
+// created. Checks return non zero when they fail.
+int runBenchmarks(int argc, char **argv);
+
+void benchmarkStaticGeometry(int roomsPerSide, int queries);
+void benchmarkWater(int particles, int steps);
+void benchmarkParticles(int particles, int steps);
+void benchmarkOcclusion(int roomsPerSide, int frames);
+int checkBubbleSpawns(int samplesPerAxis);
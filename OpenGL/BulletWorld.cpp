@@ -1,4 +1,7 @@
 #include "BulletWorld.h"
+#include "Model.h"
+#include <LinearMath/btConvexHullComputer.h>
+#include <cstring>
 
 BulletWorld* BulletWorld::bulletWorld = nullptr;
 
@@ -11,6 +14,9 @@ BulletWorld::BulletWorld(glm::vec3 gravity) {
 	world = new btDiscreteDynamicsWorld(dispatcher, broadphase, solver, collisionConfig);
 	world->setGravity(btVector3(gravity.x, gravity.y, gravity.z));
 	world->getSolverInfo().m_splitImpulse = true;
+
+	adaptiveCcd = true;
+	portals = new PortalGraph();
 }
 
 BulletWorld::~BulletWorld() {
@@ -34,11 +40,18 @@ BulletWorld::~BulletWorld() {
 		delete motionState;
 	}
 
+	for (unsigned int i = 0; i < triangleMeshes.size(); i++)
+		delete triangleMeshes[i];
+
+	for (unsigned int i = 0; i < mappedBvhs.size(); i++)
+		delete mappedBvhs[i];
+
 	delete dispatcher;
 	delete collisionConfig;
 	delete solver;
 	delete broadphase;
 	delete world;
+	delete portals;
 }
 
 BulletWorld& BulletWorld::getBulletWorld() {
@@ -50,7 +63,7 @@ BulletWorld& BulletWorld::getBulletWorld() {
 	return *bulletWorld;
 }
 
-btRigidBody* BulletWorld::addSphere(string name, float rad, float x, float y, float z, float mass) {
+btRigidBody* BulletWorld::addSphere(string name, float rad, float x, float y, float z, float mass, int group, int mask) {
 	
 	btTransform t;
 	t.setIdentity();
@@ -66,13 +79,13 @@ btRigidBody* BulletWorld::addSphere(string name, float rad, float x, float y, fl
 	btRigidBody::btRigidBodyConstructionInfo info(mass, motion, sphere, inertia);
 	btRigidBody* body = new btRigidBody(info);
 
-	world->addRigidBody(body);
+	world->addRigidBody(body, group, mask);
 	bodies[name] = body;
 
 	return body;
 }
 
-btRigidBody* BulletWorld::addFloor(string name, glm::vec3 origin_location, glm::vec3 floor_normal, float planeconstant) {
+btRigidBody* BulletWorld::addFloor(string name, glm::vec3 origin_location, glm::vec3 floor_normal, float planeconstant, int group, int mask) {
 	
 	btTransform t;
 	t.setIdentity();
@@ -84,13 +97,13 @@ btRigidBody* BulletWorld::addFloor(string name, glm::vec3 origin_location, glm::
 	btRigidBody::btRigidBodyConstructionInfo info(0.0, motion, plane, btVector3(origin_location.x, origin_location.y, origin_location.z));
 	btRigidBody* body = new btRigidBody(info);
 	
-	world->addRigidBody(body);
+	world->addRigidBody(body, group, mask);
 	bodies[name] = body;
 
 	return body;
 }
 
-btRigidBody* BulletWorld::addBox(string name, float width, float height, float depth, float x, float y, float z, float mass) {
+btRigidBody* BulletWorld::addBox(string name, float width, float height, float depth, float x, float y, float z, float mass, int group, int mask) {
 	
 	btTransform t;
 	t.setIdentity();
@@ -106,13 +119,13 @@ btRigidBody* BulletWorld::addBox(string name, float width, float height, float d
 	btRigidBody::btRigidBodyConstructionInfo info(mass, motion, box, inertia);
 	btRigidBody* body = new btRigidBody(info);
 	
-	world->addRigidBody(body);
+	world->addRigidBody(body, group, mask);
 	bodies[name] = body;
 
 	return body;
 }
 
-btRigidBody* BulletWorld::addWall(string name, float width, float height, float depth, float x, float y, float z) {
+btRigidBody* BulletWorld::addWall(string name, float width, float height, float depth, float x, float y, float z, int group, int mask) {
 	
 	float mass = 10.0f;
 	
@@ -134,72 +147,385 @@ btRigidBody* BulletWorld::addWall(string name, float width, float height, float
 	body->setLinearFactor(btVector3(0, 0, 0));
 	body->setAngularFactor(btVector3(0, 0, 0));
 
-	world->addRigidBody(body);
+	world->addRigidBody(body, group, mask);
+	walls[name] = body;
+
+	return body;
+}
+
+btRigidBody* BulletWorld::addTriangleMesh(string name, btTriangleMesh* mesh, string cachePath, uint64_t key, float x, float y, float z, int group, int mask) {
+
+	triangleMeshes.push_back(mesh);
+
+	btBvhTriangleMeshShape* shape = loadBvhCache(mesh, cachePath, key);
+	if (shape == nullptr) {
+		shape = new btBvhTriangleMeshShape(mesh, true, true);
+		saveBvhCache(shape, cachePath, key);
+	}
+
+	btTransform t;
+	t.setIdentity();
+	t.setOrigin(btVector3(x, y, z));
+
+	btMotionState* motion = new btDefaultMotionState(t);
+	btRigidBody::btRigidBodyConstructionInfo info(0.0, motion, shape);
+	btRigidBody* body = new btRigidBody(info);
+
+	world->addRigidBody(body, group, mask);
 	walls[name] = body;
 
 	return body;
 }
 
-btRigidBody* BulletWorld::addFrontWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight) {
+struct BvhCacheHeader {
+	unsigned int magic;
+	unsigned int version;
+	uint64_t key;
+	unsigned int bvhSize;
+	float aabbMin[3];
+	float aabbMax[3];
+};
+
+btBvhTriangleMeshShape* BulletWorld::loadBvhCache(btStridingMeshInterface* mesh, string path, uint64_t key) {
+
+	MappedFile* file = new MappedFile(path);
+
+	// the header keeps the tree 16-byte aligned inside the page-aligned mapping
+	const size_t headerSize = (sizeof(BvhCacheHeader) + 15) & ~size_t(15);
+
+	if (!file->isOpen() || file->getSize() < headerSize) {
+		delete file;
+		return nullptr;
+	}
+
+	BvhCacheHeader* header = (BvhCacheHeader*)file->getData();
+	if (header->magic != BVH_CACHE_MAGIC || header->version != BVH_CACHE_VERSION || header->key != key || file->getSize() < headerSize + header->bvhSize) {
+		delete file;
+		return nullptr;
+	}
+
+	// the tree is fixed up inside the copy-on-write pages, no parsing or copying of nodes
+	btOptimizedBvh* bvh = (btOptimizedBvh*)btOptimizedBvh::deSerializeInPlace(file->getData() + headerSize, header->bvhSize, false);
+	if (bvh == nullptr) {
+		delete file;
+		return nullptr;
+	}
+
+	btVector3 aabbMin(header->aabbMin[0], header->aabbMin[1], header->aabbMin[2]);
+	btVector3 aabbMax(header->aabbMax[0], header->aabbMax[1], header->aabbMax[2]);
+
+	btBvhTriangleMeshShape* shape = new btBvhTriangleMeshShape(mesh, true, aabbMin, aabbMax, false);
+	shape->setOptimizedBvh(bvh);
+
+	mappedBvhs.push_back(file);
+
+	return shape;
+}
+
+void BulletWorld::saveBvhCache(btBvhTriangleMeshShape* shape, string path, uint64_t key) {
+
+	btOptimizedBvh* bvh = shape->getOptimizedBvh();
+	if (bvh == nullptr || key == 0)
+		return;
+
+	const size_t headerSize = (sizeof(BvhCacheHeader) + 15) & ~size_t(15);
+	unsigned int bvhSize = bvh->calculateSerializeBufferSize();
+
+	unsigned char* buffer = (unsigned char*)btAlignedAlloc(headerSize + bvhSize, 16);
+	memset(buffer, 0, headerSize);
+
+	if (!bvh->serialize(buffer + headerSize, bvhSize, false)) {
+		btAlignedFree(buffer);
+		return;
+	}
+
+	BvhCacheHeader* header = (BvhCacheHeader*)buffer;
+	header->magic = BVH_CACHE_MAGIC;
+	header->version = BVH_CACHE_VERSION;
+	header->key = key;
+	header->bvhSize = bvhSize;
+	for (int i = 0; i < 3; i++)
+	{
+		header->aabbMin[i] = shape->getLocalAabbMin()[i];
+		header->aabbMax[i] = shape->getLocalAabbMax()[i];
+	}
+
+	ofstream file(path, ios::binary | ios::trunc);
+	if (file)
+		file.write((const char*)buffer, headerSize + bvhSize);
+	else
+		cout << "BVH cache not writable: " << path << endl;
+
+	btAlignedFree(buffer);
+}
+
+btRigidBody* BulletWorld::addConvexMesh(string name, Model* model, float scale, float x, float y, float z, float mass, int maxVertices, int group, int mask) {
+
+	vector<float> points = getConvexHullPoints(model, maxVertices);
+
+	// the body sits on the centroid of the hull's vertices, so it turns about the middle of the mesh. The motion
+	// state keeps the model's own origin at x, y, z for drawing, see getConvexModelMatrix.
+	btVector3 centroid(0, 0, 0);
+	size_t vertices = points.size() / 3;
+	for (size_t i = 0; i + 2 < points.size(); i += 3)
+		centroid += btVector3(points[i], points[i + 1], points[i + 2]);
+	if (vertices > 0)
+		centroid /= (btScalar)vertices;
+
+	btTransform t;
+	t.setIdentity();
+	t.setOrigin(btVector3(x, y, z));
+
+	btTransform offset;
+	offset.setIdentity();
+	offset.setOrigin(-centroid * scale);
+
+	btConvexHullShape* hull = new btConvexHullShape();
+	for (size_t i = 0; i + 2 < points.size(); i += 3)
+		hull->addPoint(btVector3(points[i], points[i + 1], points[i + 2]) - centroid, false);
+	hull->recalcLocalAabb();
+	hull->setLocalScaling(btVector3(scale, scale, scale));
+
+	btVector3 inertia(0, 0, 0);
+	if (mass != 0.0)
+		hull->calculateLocalInertia(mass, inertia);
+
+	btMotionState* motion = new btDefaultMotionState(t, offset);
+	btRigidBody::btRigidBodyConstructionInfo info(mass, motion, hull, inertia);
+	btRigidBody* body = new btRigidBody(info);
+
+	world->addRigidBody(body, group, mask);
+	bodies[name] = body;
+
+	return body;
+}
+
+vector<float> BulletWorld::getConvexHullPoints(Model* model, int maxVertices) {
+
+	string key = model->getPath() + "#" + to_string(maxVertices);
+
+	if (hulls.find(key) != hulls.end())
+		return hulls[key];
+
+	string cachePath = model->getPath() + ".hull";
+	uint64_t hash = hashFile(model->getPath());
+	vector<float> points;
+
+	if (!loadConvexHullCache(cachePath, hash, maxVertices, points)) {
+		points = computeConvexHullPoints(model, maxVertices);
+		saveConvexHullCache(cachePath, hash, maxVertices, points);
+	}
+
+	hulls[key] = points;
+
+	return points;
+}
+
+vector<float> BulletWorld::computeConvexHullPoints(Model* model, int maxVertices) {
+
+	vector<float> coords;
+	for (unsigned int i = 0; i < model->meshes.size(); i++)
+	{
+		for (unsigned int j = 0; j < model->meshes[i].vertices.size(); j++)
+		{
+			coords.push_back(model->meshes[i].vertices[j].Position.x);
+			coords.push_back(model->meshes[i].vertices[j].Position.y);
+			coords.push_back(model->meshes[i].vertices[j].Position.z);
+		}
+	}
+
+	vector<float> points;
+	if (coords.empty())
+		return points;
+
+	// exact hull first, so the reduction below only has to look at hull vertices
+	btConvexHullComputer computer;
+	computer.compute(&coords[0], 3 * sizeof(float), (int)(coords.size() / 3), 0.0f, 0.0f);
+
+	int hullCount = computer.vertices.size();
+	if (hullCount <= maxVertices) {
+		for (int i = 0; i < hullCount; i++)
+		{
+			points.push_back(computer.vertices[i].x());
+			points.push_back(computer.vertices[i].y());
+			points.push_back(computer.vertices[i].z());
+		}
+		return points;
+	}
+
+	// keep the support point along maxVertices evenly spread directions (fibonacci sphere),
+	// every kept point is a hull vertex and the count is bounded by maxVertices
+	vector<bool> kept(hullCount, false);
+	const float goldenAngle = 2.39996323f;
+
+	for (int d = 0; d < maxVertices; d++)
+	{
+		float dy = 1.0f - (2.0f * d + 1.0f) / maxVertices;
+		float r = sqrt(1.0f - dy * dy);
+		btVector3 dir(cos(goldenAngle * d) * r, dy, sin(goldenAngle * d) * r);
+
+		int best = 0;
+		btScalar bestDot = computer.vertices[0].dot(dir);
+		for (int i = 1; i < hullCount; i++)
+		{
+			btScalar dot = computer.vertices[i].dot(dir);
+			if (dot > bestDot) {
+				bestDot = dot;
+				best = i;
+			}
+		}
+
+		if (!kept[best]) {
+			kept[best] = true;
+			points.push_back(computer.vertices[best].x());
+			points.push_back(computer.vertices[best].y());
+			points.push_back(computer.vertices[best].z());
+		}
+	}
+
+	return points;
+}
+
+bool BulletWorld::loadConvexHullCache(string path, uint64_t hash, int maxVertices, vector<float>& points) {
+
+	ifstream file(path, ios::binary);
+	if (!file)
+		return false;
+
+	unsigned int magic = 0, version = 0, count = 0;
+	uint64_t fileHash = 0;
+	int fileMaxVertices = 0;
+
+	file.read((char*)&magic, sizeof(magic));
+	file.read((char*)&version, sizeof(version));
+	file.read((char*)&fileHash, sizeof(fileHash));
+	file.read((char*)&fileMaxVertices, sizeof(fileMaxVertices));
+	file.read((char*)&count, sizeof(count));
+
+	if (!file || magic != HULL_CACHE_MAGIC || version != HULL_CACHE_VERSION || fileHash != hash || fileMaxVertices != maxVertices || count == 0)
+		return false;
+
+	points.resize(count * 3);
+	file.read((char*)&points[0], points.size() * sizeof(float));
+
+	if (!file) {
+		points.clear();
+		return false;
+	}
+
+	return true;
+}
+
+void BulletWorld::saveConvexHullCache(string path, uint64_t hash, int maxVertices, const vector<float>& points) {
+
+	if (points.empty() || hash == 0)
+		return;
+
+	ofstream file(path, ios::binary | ios::trunc);
+	if (!file) {
+		cout << "Hull cache not writable: " << path << endl;
+		return;
+	}
+
+	unsigned int count = (unsigned int)(points.size() / 3);
+
+	file.write((const char*)&HULL_CACHE_MAGIC, sizeof(HULL_CACHE_MAGIC));
+	file.write((const char*)&HULL_CACHE_VERSION, sizeof(HULL_CACHE_VERSION));
+	file.write((const char*)&hash, sizeof(hash));
+	file.write((const char*)&maxVertices, sizeof(maxVertices));
+	file.write((const char*)&count, sizeof(count));
+	file.write((const char*)&points[0], points.size() * sizeof(float));
+}
+
+btRigidBody* BulletWorld::addFrontWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight, int group, int mask) {
 	
-	btRigidBody* center = addWall(name + ".1", doorWidth, height - doorHeight - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x, y + (height * 0.5f) + (doorHeight * 0.5f), z - HALF_WALL_THICKNESS);
-	btRigidBody* left = addWall(name + ".2", (width * 0.5f) - (doorWidth * 0.5f), height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x - ((width * 0.25f) + (doorWidth * 0.25f)), y + (height * 0.5f), z - HALF_WALL_THICKNESS);
-	btRigidBody* right = addWall(name + ".3", (width * 0.5f) - (doorWidth * 0.5f), height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x + ((width * 0.25f) + (doorWidth * 0.25f)), y + (height * 0.5f), z - HALF_WALL_THICKNESS);
+	btRigidBody* center = addWall(name + ".1", doorWidth, height - doorHeight - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x, y + (height * 0.5f) + (doorHeight * 0.5f), z - HALF_WALL_THICKNESS, group, mask);
+	btRigidBody* left = addWall(name + ".2", (width * 0.5f) - (doorWidth * 0.5f), height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x - ((width * 0.25f) + (doorWidth * 0.25f)), y + (height * 0.5f), z - HALF_WALL_THICKNESS, group, mask);
+	btRigidBody* right = addWall(name + ".3", (width * 0.5f) - (doorWidth * 0.5f), height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x + ((width * 0.25f) + (doorWidth * 0.25f)), y + (height * 0.5f), z - HALF_WALL_THICKNESS, group, mask);
+
+	addDoorPortal(name, glm::vec3(x, y, z), glm::vec3(1.0f, 0.0f, 0.0f), doorWidth, doorHeight);
 
 	return nullptr;
 }
 
-btRigidBody* BulletWorld::addBackWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight) {
+btRigidBody* BulletWorld::addBackWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight, int group, int mask) {
 	
-	btRigidBody* center = addWall(name + ".1", doorWidth, height - doorHeight - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x, y + (height * 0.5f) + (doorHeight * 0.5f), z - depth + HALF_WALL_THICKNESS);
-	btRigidBody* left = addWall(name + ".2", (width * 0.5f) - (doorWidth * 0.5f), height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x - ((width * 0.25f) + (doorWidth * 0.25f)), y + (height * 0.5f), z - depth + HALF_WALL_THICKNESS);
-	btRigidBody* right = addWall(name + ".3", (width * 0.5f) - (doorWidth * 0.5f), height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x + ((width * 0.25f) + (doorWidth * 0.25f)), y + (height * 0.5f), z - depth + HALF_WALL_THICKNESS);
+	btRigidBody* center = addWall(name + ".1", doorWidth, height - doorHeight - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x, y + (height * 0.5f) + (doorHeight * 0.5f), z - depth + HALF_WALL_THICKNESS, group, mask);
+	btRigidBody* left = addWall(name + ".2", (width * 0.5f) - (doorWidth * 0.5f), height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x - ((width * 0.25f) + (doorWidth * 0.25f)), y + (height * 0.5f), z - depth + HALF_WALL_THICKNESS, group, mask);
+	btRigidBody* right = addWall(name + ".3", (width * 0.5f) - (doorWidth * 0.5f), height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x + ((width * 0.25f) + (doorWidth * 0.25f)), y + (height * 0.5f), z - depth + HALF_WALL_THICKNESS, group, mask);
+
+	addDoorPortal(name, glm::vec3(x, y, z - depth), glm::vec3(1.0f, 0.0f, 0.0f), doorWidth, doorHeight);
 
 	return nullptr;
 }
 
-btRigidBody* BulletWorld::addLeftWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight) {
+btRigidBody* BulletWorld::addLeftWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight, int group, int mask) {
 	
-	btRigidBody* center = addWall(name + ".1", WALL_THICKNESS, height - doorHeight - DOUBLE_WALL_THICKNESS, doorWidth, x - (width * 0.5f) + HALF_WALL_THICKNESS, y + (height * 0.5f) + (doorHeight * 0.5f), z - (depth * 0.5f));
-	btRigidBody* left = addWall(name + ".2", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, (depth * 0.5f) - (doorWidth * 0.5f) - WALL_THICKNESS, x - (width * 0.5f) + HALF_WALL_THICKNESS, y + (height * 0.5f), z - ((depth * 0.25f) - (doorWidth * 0.25f)) - HALF_WALL_THICKNESS);
-	btRigidBody* right = addWall(name + ".3", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, (depth * 0.5f) - (doorWidth * 0.5f) - WALL_THICKNESS, x - (width * 0.5f) + HALF_WALL_THICKNESS, y + (height * 0.5f), z - ((depth * 0.75f) + (doorWidth * 0.25f)) + HALF_WALL_THICKNESS);
+	btRigidBody* center = addWall(name + ".1", WALL_THICKNESS, height - doorHeight - DOUBLE_WALL_THICKNESS, doorWidth, x - (width * 0.5f) + HALF_WALL_THICKNESS, y + (height * 0.5f) + (doorHeight * 0.5f), z - (depth * 0.5f), group, mask);
+	btRigidBody* left = addWall(name + ".2", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, (depth * 0.5f) - (doorWidth * 0.5f) - WALL_THICKNESS, x - (width * 0.5f) + HALF_WALL_THICKNESS, y + (height * 0.5f), z - ((depth * 0.25f) - (doorWidth * 0.25f)) - HALF_WALL_THICKNESS, group, mask);
+	btRigidBody* right = addWall(name + ".3", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, (depth * 0.5f) - (doorWidth * 0.5f) - WALL_THICKNESS, x - (width * 0.5f) + HALF_WALL_THICKNESS, y + (height * 0.5f), z - ((depth * 0.75f) + (doorWidth * 0.25f)) + HALF_WALL_THICKNESS, group, mask);
+
+	addDoorPortal(name, glm::vec3(x - (width * 0.5f), y, z - (depth * 0.5f)), glm::vec3(0.0f, 0.0f, 1.0f), doorWidth, doorHeight);
 
 	return nullptr;
 }
 
-btRigidBody* BulletWorld::addRightWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight) {
+btRigidBody* BulletWorld::addRightWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight, int group, int mask) {
 
-	btRigidBody* center = addWall(name + ".1", WALL_THICKNESS, height - doorHeight - DOUBLE_WALL_THICKNESS, doorWidth, x + (width * 0.5f) - HALF_WALL_THICKNESS, y + (height * 0.5f) + (doorHeight * 0.5f), z - (depth * 0.5f));
-	btRigidBody* left = addWall(name + ".2", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, (depth * 0.5f) - (doorWidth * 0.5f) - WALL_THICKNESS, x + (width * 0.5f) - HALF_WALL_THICKNESS, y + (height * 0.5f), z - ((depth * 0.25f) - (doorWidth * 0.25f)) - HALF_WALL_THICKNESS);
-	btRigidBody* right = addWall(name + ".3", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, (depth * 0.5f) - (doorWidth * 0.5f) - WALL_THICKNESS, x + (width * 0.5f) - HALF_WALL_THICKNESS, y + (height * 0.5f), z - ((depth * 0.75f) + (doorWidth * 0.25f)) + HALF_WALL_THICKNESS);
+	btRigidBody* center = addWall(name + ".1", WALL_THICKNESS, height - doorHeight - DOUBLE_WALL_THICKNESS, doorWidth, x + (width * 0.5f) - HALF_WALL_THICKNESS, y + (height * 0.5f) + (doorHeight * 0.5f), z - (depth * 0.5f), group, mask);
+	btRigidBody* left = addWall(name + ".2", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, (depth * 0.5f) - (doorWidth * 0.5f) - WALL_THICKNESS, x + (width * 0.5f) - HALF_WALL_THICKNESS, y + (height * 0.5f), z - ((depth * 0.25f) - (doorWidth * 0.25f)) - HALF_WALL_THICKNESS, group, mask);
+	btRigidBody* right = addWall(name + ".3", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, (depth * 0.5f) - (doorWidth * 0.5f) - WALL_THICKNESS, x + (width * 0.5f) - HALF_WALL_THICKNESS, y + (height * 0.5f), z - ((depth * 0.75f) + (doorWidth * 0.25f)) + HALF_WALL_THICKNESS, group, mask);
+
+	addDoorPortal(name, glm::vec3(x + (width * 0.5f), y, z - (depth * 0.5f)), glm::vec3(0.0f, 0.0f, 1.0f), doorWidth, doorHeight);
 
 	return nullptr;
 }
 
-btRigidBody* BulletWorld::addRoom1(string name, float width, float height, float depth, float x, float y, float z) {
+// A room spans x - width / 2 to x + width / 2, y to y + height and z - depth to z
+void BulletWorld::addRoomCell(string name, float width, float height, float depth, float x, float y, float z) {
+	portals->addCell(name, glm::vec3(x - (width * 0.5f), y, z - depth), glm::vec3(x + (width * 0.5f), y + height, z));
+}
+
+// The opening of a door from the floor to the lintel, bottom is the middle of its sill. The wall name starts with the room name.
+void BulletWorld::addDoorPortal(string name, glm::vec3 bottom, glm::vec3 across, float doorWidth, float doorHeight) {
+
+	string room = name.substr(0, name.find('.'));
+	glm::vec3 side = across * (doorWidth * 0.5f);
+	glm::vec3 top = bottom + glm::vec3(0.0f, doorHeight + WALL_THICKNESS, 0.0f);
+
+	glm::vec3 corners[4] = { bottom - side, bottom + side, top + side, top - side };
+
+	portals->addDoor(room, corners);
+}
+
+btRigidBody* BulletWorld::addRoom1(string name, float width, float height, float depth, float x, float y, float z, int group, int mask) {
+
+	addRoomCell(name, width, height, depth, x, y, z);
 
-	btRigidBody* floor = addWall(name + ".1", width, WALL_THICKNESS, depth, x, y + HALF_WALL_THICKNESS, z - (depth * 0.5f));
-	btRigidBody* ceiling = addWall(name + ".2", width, WALL_THICKNESS, depth, x, y + height - HALF_WALL_THICKNESS, z - (depth * 0.5f));
+	btRigidBody* floor = addWall(name + ".1", width, WALL_THICKNESS, depth, x, y + HALF_WALL_THICKNESS, z - (depth * 0.5f), group, mask);
+	btRigidBody* ceiling = addWall(name + ".2", width, WALL_THICKNESS, depth, x, y + height - HALF_WALL_THICKNESS, z - (depth * 0.5f), group, mask);
 
-	addFrontWallWithDoor(name+".3",  width,  height,  depth,  x,  y,  z, DOOR_WIDTH, DOOW_HEIGHT);
-	btRigidBody* back = addWall(name + ".4", width, height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x , y + (height * 0.5f), z - depth + HALF_WALL_THICKNESS);
+	addFrontWallWithDoor(name+".3",  width,  height,  depth,  x,  y,  z, DOOR_WIDTH, DOOW_HEIGHT, group, mask);
+	btRigidBody* back = addWall(name + ".4", width, height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x , y + (height * 0.5f), z - depth + HALF_WALL_THICKNESS, group, mask);
 
-	addLeftWallWithDoor(name + ".5", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT);
-	addRightWallWithDoor(name + ".6", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT);
+	addLeftWallWithDoor(name + ".5", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT, group, mask);
+	addRightWallWithDoor(name + ".6", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT, group, mask);
 
 	return nullptr;
 }
 
-btRigidBody* BulletWorld::addRoom2(string name, float width, float height, float depth, float x, float y, float z) {
+btRigidBody* BulletWorld::addRoom2(string name, float width, float height, float depth, float x, float y, float z, int group, int mask) {
 
-	btRigidBody* floor = addWall(name + ".1", width, WALL_THICKNESS, depth, x, y + HALF_WALL_THICKNESS, z - (depth * 0.5f));
-	btRigidBody* ceiling = addWall(name + ".2", width, WALL_THICKNESS, depth, x, y + height - HALF_WALL_THICKNESS, z - (depth * 0.5f));
+	addRoomCell(name, width, height, depth, x, y, z);
 
-	addFrontWallWithDoor(name + ".3", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT);
-	btRigidBody* back = addWall(name + ".4", width, height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x , y + (height * 0.5f), z - depth + HALF_WALL_THICKNESS);
+	btRigidBody* floor = addWall(name + ".1", width, WALL_THICKNESS, depth, x, y + HALF_WALL_THICKNESS, z - (depth * 0.5f), group, mask);
+	btRigidBody* ceiling = addWall(name + ".2", width, WALL_THICKNESS, depth, x, y + height - HALF_WALL_THICKNESS, z - (depth * 0.5f), group, mask);
 
-	btRigidBody* left = addWall(name + ".5", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, depth - DOUBLE_WALL_THICKNESS, x - (width * 0.5f) + HALF_WALL_THICKNESS, y + (height * 0.5f), z - (depth * 0.5f));
-	addRightWallWithDoor(name + ".6", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT);
+	addFrontWallWithDoor(name + ".3", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT, group, mask);
+	btRigidBody* back = addWall(name + ".4", width, height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x , y + (height * 0.5f), z - depth + HALF_WALL_THICKNESS, group, mask);
+
+	btRigidBody* left = addWall(name + ".5", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, depth - DOUBLE_WALL_THICKNESS, x - (width * 0.5f) + HALF_WALL_THICKNESS, y + (height * 0.5f), z - (depth * 0.5f), group, mask);
+	addRightWallWithDoor(name + ".6", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT, group, mask);
 
 	floor->setRestitution(1.0f);
 	ceiling->setRestitution(1.0f);
@@ -217,66 +543,145 @@ btRigidBody* BulletWorld::addRoom2(string name, float width, float height, float
 	return nullptr;
 }
 
-btRigidBody* BulletWorld::addRoom3(string name, float width, float height, float depth, float x, float y, float z) {
+btRigidBody* BulletWorld::addRoom3(string name, float width, float height, float depth, float x, float y, float z, int group, int mask) {
+
+	addRoomCell(name, width, height, depth, x, y, z);
 
-	btRigidBody* floor = addWall(name + ".1", width, WALL_THICKNESS, depth, x, y + HALF_WALL_THICKNESS, z - (depth * 0.5f));
-	btRigidBody* ceiling = addWall(name + ".2", width, WALL_THICKNESS, depth, x, y + height - HALF_WALL_THICKNESS, z - (depth * 0.5f));
+	btRigidBody* floor = addWall(name + ".1", width, WALL_THICKNESS, depth, x, y + HALF_WALL_THICKNESS, z - (depth * 0.5f), group, mask);
+	btRigidBody* ceiling = addWall(name + ".2", width, WALL_THICKNESS, depth, x, y + height - HALF_WALL_THICKNESS, z - (depth * 0.5f), group, mask);
 	
-	addFrontWallWithDoor(name + ".3", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT);
-	btRigidBody* back = addWall(name + ".4", width, height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x , y + (height * 0.5f), z - depth + HALF_WALL_THICKNESS);
+	addFrontWallWithDoor(name + ".3", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT, group, mask);
+	btRigidBody* back = addWall(name + ".4", width, height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x , y + (height * 0.5f), z - depth + HALF_WALL_THICKNESS, group, mask);
 
-	addLeftWallWithDoor(name + ".5", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT);
-	btRigidBody* right = addWall(name + ".6", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, depth - DOUBLE_WALL_THICKNESS, x + (width * 0.5f) - HALF_WALL_THICKNESS, y + (height * 0.5f), z - (depth * 0.5f));
+	addLeftWallWithDoor(name + ".5", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT, group, mask);
+	btRigidBody* right = addWall(name + ".6", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, depth - DOUBLE_WALL_THICKNESS, x + (width * 0.5f) - HALF_WALL_THICKNESS, y + (height * 0.5f), z - (depth * 0.5f), group, mask);
 
 	return nullptr;
 }
 
-btRigidBody* BulletWorld::addRoom4(string name, float width, float height, float depth, float x, float y, float z) {
+btRigidBody* BulletWorld::addRoom4(string name, float width, float height, float depth, float x, float y, float z, int group, int mask) {
 
-	btRigidBody* floor = addWall(name + ".1", width, WALL_THICKNESS, depth, x, y + HALF_WALL_THICKNESS, z - (depth * 0.5f));
-	btRigidBody* ceiling = addWall(name + ".2", width, WALL_THICKNESS, depth, x, y + height - HALF_WALL_THICKNESS, z - (depth * 0.5f));
+	addRoomCell(name, width, height, depth, x, y, z);
+
+	btRigidBody* floor = addWall(name + ".1", width, WALL_THICKNESS, depth, x, y + HALF_WALL_THICKNESS, z - (depth * 0.5f), group, mask);
+	btRigidBody* ceiling = addWall(name + ".2", width, WALL_THICKNESS, depth, x, y + height - HALF_WALL_THICKNESS, z - (depth * 0.5f), group, mask);
 	
-	btRigidBody* front = addWall(name + ".3", width, height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x, y + (height * 0.5f), z - HALF_WALL_THICKNESS);
-	addBackWallWithDoor(name + ".4", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT);
+	btRigidBody* front = addWall(name + ".3", width, height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x, y + (height * 0.5f), z - HALF_WALL_THICKNESS, group, mask);
+	addBackWallWithDoor(name + ".4", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT, group, mask);
 
-	addLeftWallWithDoor(name + ".5", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT);
-	addRightWallWithDoor(name + ".6", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT);
+	addLeftWallWithDoor(name + ".5", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT, group, mask);
+	addRightWallWithDoor(name + ".6", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT, group, mask);
 
 	return nullptr;
 }
 
-btRigidBody* BulletWorld::addRoom5(string name, float width, float height, float depth, float x, float y, float z) {
+btRigidBody* BulletWorld::addRoom5(string name, float width, float height, float depth, float x, float y, float z, int group, int mask) {
+
+	addRoomCell(name, width, height, depth, x, y, z);
 
-	btRigidBody* floor = addWall(name + ".1", width, WALL_THICKNESS, depth, x, y + HALF_WALL_THICKNESS, z - (depth * 0.5f));
-	btRigidBody* ceiling = addWall(name + ".2", width, WALL_THICKNESS, depth, x, y + height - HALF_WALL_THICKNESS, z - (depth * 0.5f));
+	btRigidBody* floor = addWall(name + ".1", width, WALL_THICKNESS, depth, x, y + HALF_WALL_THICKNESS, z - (depth * 0.5f), group, mask);
+	btRigidBody* ceiling = addWall(name + ".2", width, WALL_THICKNESS, depth, x, y + height - HALF_WALL_THICKNESS, z - (depth * 0.5f), group, mask);
 	
-	btRigidBody* front = addWall(name + ".3", width, height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x, y + (height * 0.5f), z - HALF_WALL_THICKNESS);
-	addBackWallWithDoor(name + ".4", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT);
+	btRigidBody* front = addWall(name + ".3", width, height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x, y + (height * 0.5f), z - HALF_WALL_THICKNESS, group, mask);
+	addBackWallWithDoor(name + ".4", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT, group, mask);
 
-	btRigidBody* left = addWall(name + ".5", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, depth - DOUBLE_WALL_THICKNESS, x - (width * 0.5f) + HALF_WALL_THICKNESS, y + (height * 0.5f), z - (depth * 0.5f));
-	addRightWallWithDoor(name + ".6", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT);
+	btRigidBody* left = addWall(name + ".5", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, depth - DOUBLE_WALL_THICKNESS, x - (width * 0.5f) + HALF_WALL_THICKNESS, y + (height * 0.5f), z - (depth * 0.5f), group, mask);
+	addRightWallWithDoor(name + ".6", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT, group, mask);
 
 	return nullptr;
 }
 
-btRigidBody* BulletWorld::addRoom6(string name, float width, float height, float depth, float x, float y, float z) {
+btRigidBody* BulletWorld::addRoom6(string name, float width, float height, float depth, float x, float y, float z, int group, int mask) {
+
+	addRoomCell(name, width, height, depth, x, y, z);
 
-	btRigidBody* floor = addWall(name + ".1", width, WALL_THICKNESS, depth, x, y + HALF_WALL_THICKNESS, z - (depth * 0.5f));
-	btRigidBody* ceiling = addWall(name + ".2", width, WALL_THICKNESS, depth, x, y + height - HALF_WALL_THICKNESS, z - (depth * 0.5f));
+	btRigidBody* floor = addWall(name + ".1", width, WALL_THICKNESS, depth, x, y + HALF_WALL_THICKNESS, z - (depth * 0.5f), group, mask);
+	btRigidBody* ceiling = addWall(name + ".2", width, WALL_THICKNESS, depth, x, y + height - HALF_WALL_THICKNESS, z - (depth * 0.5f), group, mask);
 	
-	btRigidBody* front = addWall(name + ".3", width, height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x, y + (height * 0.5f), z - HALF_WALL_THICKNESS);
-	addBackWallWithDoor(name + ".4", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT);
+	btRigidBody* front = addWall(name + ".3", width, height - DOUBLE_WALL_THICKNESS, WALL_THICKNESS, x, y + (height * 0.5f), z - HALF_WALL_THICKNESS, group, mask);
+	addBackWallWithDoor(name + ".4", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT, group, mask);
 
-	addLeftWallWithDoor(name + ".5", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT);
-	btRigidBody* right = addWall(name + ".6", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, depth - DOUBLE_WALL_THICKNESS, x + (width * 0.5f) - HALF_WALL_THICKNESS, y + (height * 0.5f), z - (depth * 0.5f));
+	addLeftWallWithDoor(name + ".5", width, height, depth, x, y, z, DOOR_WIDTH, DOOW_HEIGHT, group, mask);
+	btRigidBody* right = addWall(name + ".6", WALL_THICKNESS, height - DOUBLE_WALL_THICKNESS, depth - DOUBLE_WALL_THICKNESS, x + (width * 0.5f) - HALF_WALL_THICKNESS, y + (height * 0.5f), z - (depth * 0.5f), group, mask);
 
 	return nullptr;
 }
 
+void BulletWorld::setAdaptiveCcd(bool enabled) {
+
+	adaptiveCcd = enabled;
+
+	if (!enabled) {
+		for (map<string, btRigidBody*>::iterator it = bodies.begin(); it != bodies.end(); ++it)
+			(*it).second->setCcdMotionThreshold(0.0f);
+	}
+}
+
+bool BulletWorld::isAdaptiveCcd() {
+	return adaptiveCcd;
+}
+
+void BulletWorld::updateAdaptiveCcd(btScalar timeStep) {
+
+	for (map<string, btRigidBody*>::iterator it = bodies.begin(); it != bodies.end(); ++it)
+	{
+		btRigidBody* body = (*it).second;
+
+		if (body->isStaticOrKinematicObject())
+			continue;
+
+		btScalar radius = getInnerRadius(body->getCollisionShape());
+		btScalar motion = body->getLinearVelocity().length() * timeStep;
+
+		// only bodies that can cross their own radius in one step pay for the swept sphere test
+		if (radius > 0.0f && motion > radius) {
+			body->setCcdMotionThreshold(radius);
+			body->setCcdSweptSphereRadius(radius * CCD_SWEPT_SPHERE_RATIO);
+		}
+		else {
+			body->setCcdMotionThreshold(0.0f);
+		}
+	}
+}
+
+btScalar BulletWorld::getInnerRadius(const btCollisionShape* shape) {
+
+	switch (shape->getShapeType())
+	{
+	case SPHERE_SHAPE_PROXYTYPE:
+		return ((const btSphereShape*)shape)->getRadius();
+
+	case BOX_SHAPE_PROXYTYPE:
+	{
+		const btVector3& extent = ((const btBoxShape*)shape)->getHalfExtentsWithoutMargin();
+		return btMin(extent.x(), btMin(extent.y(), extent.z())) + shape->getMargin();
+	}
+
+	case STATIC_PLANE_PROXYTYPE:
+		return 0.0f;
+
+	default:
+	{
+		btVector3 center;
+		btScalar radius;
+		shape->getBoundingSphere(center, radius);
+		return radius * 0.5f;
+	}
+	}
+}
+
 btDiscreteDynamicsWorld* BulletWorld::getWorld() {
 	return world;
 }
 
+PortalGraph* BulletWorld::getPortals() {
+	return portals;
+}
+
+btDbvtBroadphase* BulletWorld::getBroadphase() {
+	return (btDbvtBroadphase*)broadphase;
+}
+
 map<string, btRigidBody*> BulletWorld::getBodies() {
 	return bodies;
 }
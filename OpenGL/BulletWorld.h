@@ -2,15 +2,36 @@
 
 #include <map>
 #include <list>
+#include <vector>
 #include <glm\glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <btBulletDynamicsCommon.h>
 
 #include "Helper.h"
+#include "MappedFile.h"
+#include "PortalGraph.h"
 
 using namespace std;
 
+class Model;
+
+enum CollisionGroup {
+	COL_NOTHING = 0,
+	COL_STATIC = 1 << 0,
+	COL_DYNAMIC = 1 << 1,
+	COL_PLAYER = 1 << 2,
+	COL_PARTICLE = 1 << 3,
+	COL_TRIGGER = 1 << 4
+};
+
+// static architecture never pairs with itself, so touching walls and floors create no broadphase pairs
+const int STATIC_COLLIDES_WITH = COL_DYNAMIC | COL_PLAYER | COL_PARTICLE;
+const int DYNAMIC_COLLIDES_WITH = COL_STATIC | COL_DYNAMIC | COL_PLAYER | COL_PARTICLE | COL_TRIGGER;
+const int PLAYER_COLLIDES_WITH = COL_STATIC | COL_DYNAMIC | COL_TRIGGER;
+const int PARTICLE_COLLIDES_WITH = COL_STATIC | COL_DYNAMIC;
+const int TRIGGER_COLLIDES_WITH = COL_DYNAMIC | COL_PLAYER;
+
 class BulletWorld
 {
 private:
@@ -20,6 +41,12 @@ private:
 	const float DOUBLE_WALL_THICKNESS = WALL_THICKNESS * 2.0f;
 	const float DOOR_WIDTH = 2.0f;
 	const float DOOW_HEIGHT = 2.5f;
+	const float FIXED_TIME_STEP = 1.0f / 60.0f;
+	const float CCD_SWEPT_SPHERE_RATIO = 0.8f;
+	const unsigned int HULL_CACHE_MAGIC = 0x4C4C5548; // "HULL"
+	const unsigned int HULL_CACHE_VERSION = 1;
+	const unsigned int BVH_CACHE_MAGIC = 0x48564842; // "BHVH"
+	const unsigned int BVH_CACHE_VERSION = 1;
 
 	static BulletWorld *bulletWorld;
 
@@ -31,6 +58,27 @@ private:
 
 	map<string, btRigidBody*> bodies;
 	map<string, btRigidBody*> walls;
+	PortalGraph *portals;
+
+	map<string, vector<float>> hulls;
+	vector<btStridingMeshInterface*> triangleMeshes;
+	vector<MappedFile*> mappedBvhs;
+
+	bool adaptiveCcd;
+
+	void updateAdaptiveCcd(btScalar timeStep);
+	static btScalar getInnerRadius(const btCollisionShape* shape);
+
+	void addRoomCell(string name, float width, float height, float depth, float x, float y, float z);
+	void addDoorPortal(string name, glm::vec3 bottom, glm::vec3 across, float doorWidth, float doorHeight);
+
+	vector<float> getConvexHullPoints(Model* model, int maxVertices);
+	vector<float> computeConvexHullPoints(Model* model, int maxVertices);
+	bool loadConvexHullCache(string path, uint64_t hash, int maxVertices, vector<float>& points);
+	void saveConvexHullCache(string path, uint64_t hash, int maxVertices, const vector<float>& points);
+
+	btBvhTriangleMeshShape* loadBvhCache(btStridingMeshInterface* mesh, string path, uint64_t key);
+	void saveBvhCache(btBvhTriangleMeshShape* shape, string path, uint64_t key);
 
 public:
 
@@ -39,32 +87,47 @@ public:
 	map<string, btRigidBody*> getBodies();
 	map<string, btRigidBody*> getRooms();
 	btDiscreteDynamicsWorld* getWorld();
+	btDbvtBroadphase* getBroadphase();
+	PortalGraph* getPortals();
 	btRigidBody* getBody(string name);
 	btRigidBody* getWall(string name);
 
 	BulletWorld(glm::vec3 gravity);
 	~BulletWorld();
 
-	btRigidBody* addFloor(string name, glm::vec3 origin_location, glm::vec3 floor_normal, float plane_constant);
-	btRigidBody* addSphere(string name, float rad, float x, float y, float z, float mass);
-	btRigidBody* addBox(string name, float width, float height, float depth, float x, float y, float z, float mass);
-	btRigidBody* addWall(string name, float width, float height, float depth, float x, float y, float z);
-
-	btRigidBody* addFrontWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight);
-	btRigidBody* addBackWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight);
-	btRigidBody* addLeftWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight);
-	btRigidBody* addRightWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight);
+	btRigidBody* addFloor(string name, glm::vec3 origin_location, glm::vec3 floor_normal, float plane_constant, int group = COL_STATIC, int mask = STATIC_COLLIDES_WITH);
+	btRigidBody* addSphere(string name, float rad, float x, float y, float z, float mass, int group = COL_DYNAMIC, int mask = DYNAMIC_COLLIDES_WITH);
+	btRigidBody* addBox(string name, float width, float height, float depth, float x, float y, float z, float mass, int group = COL_DYNAMIC, int mask = DYNAMIC_COLLIDES_WITH);
+	btRigidBody* addWall(string name, float width, float height, float depth, float x, float y, float z, int group = COL_STATIC, int mask = STATIC_COLLIDES_WITH);
+	btRigidBody* addTriangleMesh(string name, btTriangleMesh* mesh, string cachePath, uint64_t key, float x, float y, float z, int group = COL_STATIC, int mask = STATIC_COLLIDES_WITH);
+	btRigidBody* addConvexMesh(string name, Model* model, float scale, float x, float y, float z, float mass, int maxVertices = 64, int group = COL_DYNAMIC, int mask = DYNAMIC_COLLIDES_WITH);
+
+	btRigidBody* addFrontWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight, int group = COL_STATIC, int mask = STATIC_COLLIDES_WITH);
+	btRigidBody* addBackWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight, int group = COL_STATIC, int mask = STATIC_COLLIDES_WITH);
+	btRigidBody* addLeftWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight, int group = COL_STATIC, int mask = STATIC_COLLIDES_WITH);
+	btRigidBody* addRightWallWithDoor(string name, float width, float height, float depth, float x, float y, float z, float doorWidth, float doorHeight, int group = COL_STATIC, int mask = STATIC_COLLIDES_WITH);
 	
-	btRigidBody* addRoom1(string name, float width, float height, float depth, float x, float y, float z);
-	btRigidBody* addRoom2(string name, float width, float height, float depth, float x, float y, float z);
-	btRigidBody* addRoom3(string name, float width, float height, float depth, float x, float y, float z);
-	btRigidBody* addRoom4(string name, float width, float height, float depth, float x, float y, float z);
-	btRigidBody* addRoom5(string name, float width, float height, float depth, float x, float y, float z);
-	btRigidBody* addRoom6(string name, float width, float height, float depth, float x, float y, float z);
+	btRigidBody* addRoom1(string name, float width, float height, float depth, float x, float y, float z, int group = COL_STATIC, int mask = STATIC_COLLIDES_WITH);
+	btRigidBody* addRoom2(string name, float width, float height, float depth, float x, float y, float z, int group = COL_STATIC, int mask = STATIC_COLLIDES_WITH);
+	btRigidBody* addRoom3(string name, float width, float height, float depth, float x, float y, float z, int group = COL_STATIC, int mask = STATIC_COLLIDES_WITH);
+	btRigidBody* addRoom4(string name, float width, float height, float depth, float x, float y, float z, int group = COL_STATIC, int mask = STATIC_COLLIDES_WITH);
+	btRigidBody* addRoom5(string name, float width, float height, float depth, float x, float y, float z, int group = COL_STATIC, int mask = STATIC_COLLIDES_WITH);
+	btRigidBody* addRoom6(string name, float width, float height, float depth, float x, float y, float z, int group = COL_STATIC, int mask = STATIC_COLLIDES_WITH);
+
+	void setAdaptiveCcd(bool enabled);
+	bool isAdaptiveCcd();
+
+	float getTimeStep()
+	{
+		return FIXED_TIME_STEP;
+	}
 
 	void stepSimulate()
 	{
-		world->stepSimulation(btScalar(1.0 / 60.0));
+		if (adaptiveCcd)
+			updateAdaptiveCcd(btScalar(FIXED_TIME_STEP));
+
+		world->stepSimulation(btScalar(FIXED_TIME_STEP));
 	}
 
 };
@@ -5,7 +5,7 @@ Camera* Camera::camera = nullptr;
 Camera::Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, 1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
 {
 	_world = &BulletWorld::getBulletWorld();
-	_world->addBox("player", 0.5f, 1.0f, 0.5f, 0.0, 2.0, -15.0, 10);
+	_world->addBox("player", 0.5f, 1.0f, 0.5f, 0.0, 2.0, -15.0, 10, COL_PLAYER, PLAYER_COLLIDES_WITH);
 	_world->getBody("player")->setFriction(1.0);
 	_world->getBody("player")->setAngularFactor(btVector3(0, 0, 0));
 	_world->getBody("player")->setRestitution(0.9f);
@@ -0,0 +1,358 @@
+#include "DistanceField.h"
+
+#include <emmintrin.h>
+
+// offsets of the 8 corners of a cell inside a brick
+static const int CORNER_OFFSETS[8] = {
+	0, 1,
+	DistanceField::BRICK_SAMPLES, DistanceField::BRICK_SAMPLES + 1,
+	DistanceField::BRICK_SAMPLES * DistanceField::BRICK_SAMPLES, DistanceField::BRICK_SAMPLES * DistanceField::BRICK_SAMPLES + 1,
+	DistanceField::BRICK_SAMPLES * DistanceField::BRICK_SAMPLES + DistanceField::BRICK_SAMPLES, DistanceField::BRICK_SAMPLES * DistanceField::BRICK_SAMPLES + DistanceField::BRICK_SAMPLES + 1
+};
+
+DistanceField::DistanceField(BulletWorld *world, float cellSize, float band) : cellSize(cellSize), inverseCellSize(1.0f / cellSize), band(band)
+{
+	map<string, btRigidBody*> walls = world->getRooms();
+
+	glm::vec3 minBound(1e30f), maxBound(-1e30f);
+
+	for (map<string, btRigidBody*>::iterator it = walls.begin(); it != walls.end(); ++it)
+	{
+		btCollisionShape *shape = (*it).second->getCollisionShape();
+		if (shape->getShapeType() != BOX_SHAPE_PROXYTYPE)
+			continue;
+
+		const btTransform &t = (*it).second->getWorldTransform();
+		btVector3 extent = ((btBoxShape*)shape)->getHalfExtentsWithMargin();
+
+		Box box;
+		box.center = glm::vec3(t.getOrigin().x(), t.getOrigin().y(), t.getOrigin().z());
+		box.axisX = glm::vec3(t.getBasis().getColumn(0).x(), t.getBasis().getColumn(0).y(), t.getBasis().getColumn(0).z());
+		box.axisY = glm::vec3(t.getBasis().getColumn(1).x(), t.getBasis().getColumn(1).y(), t.getBasis().getColumn(1).z());
+		box.axisZ = glm::vec3(t.getBasis().getColumn(2).x(), t.getBasis().getColumn(2).y(), t.getBasis().getColumn(2).z());
+		box.extent = glm::vec3(extent.x(), extent.y(), extent.z());
+		boxes.push_back(box);
+
+		btVector3 aabbMin, aabbMax;
+		shape->getAabb(t, aabbMin, aabbMax);
+		minBound = glm::min(minBound, glm::vec3(aabbMin.x(), aabbMin.y(), aabbMin.z()));
+		maxBound = glm::max(maxBound, glm::vec3(aabbMax.x(), aabbMax.y(), aabbMax.z()));
+	}
+
+	if (boxes.empty()) {
+		origin = glm::vec3(0.0f);
+		bricksX = bricksY = bricksZ = 0;
+		return;
+	}
+
+	origin = minBound - glm::vec3(band + cellSize);
+	glm::vec3 size = (maxBound + glm::vec3(band + cellSize)) - origin;
+	float brickSize = cellSize * BRICK_CELLS;
+
+	bricksX = (int)ceil(size.x / brickSize);
+	bricksY = (int)ceil(size.y / brickSize);
+	bricksZ = (int)ceil(size.z / brickSize);
+
+	build();
+}
+
+DistanceField::~DistanceField() {}
+
+float DistanceField::boxDistance(const Box &box, const glm::vec3 &position) const {
+
+	glm::vec3 d = position - box.center;
+	glm::vec3 q = glm::abs(glm::vec3(glm::dot(d, box.axisX), glm::dot(d, box.axisY), glm::dot(d, box.axisZ))) - box.extent;
+
+	return glm::length(glm::max(q, glm::vec3(0.0f))) + glm::min(glm::max(q.x, glm::max(q.y, q.z)), 0.0f);
+}
+
+void DistanceField::build() {
+
+	const float brickSize = cellSize * BRICK_CELLS;
+	const float halfDiagonal = sqrt(3.0f) * brickSize * 0.5f;
+	const int brickVolume = BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES;
+
+	brickIndices.assign(bricksX * bricksY * bricksZ, -1);
+	brickDistances.assign(bricksX * bricksY * bricksZ, 0.0f);
+
+	vector<float> centerDistances(boxes.size());
+	vector<const Box*> candidates;
+
+	for (int bz = 0; bz < bricksZ; bz++)
+	{
+		for (int by = 0; by < bricksY; by++)
+		{
+			for (int bx = 0; bx < bricksX; bx++)
+			{
+				int brick = (bz * bricksY + by) * bricksX + bx;
+				glm::vec3 corner = origin + glm::vec3((float)bx, (float)by, (float)bz) * brickSize;
+				glm::vec3 center = corner + glm::vec3(brickSize * 0.5f);
+
+				float nearest = 1e30f;
+				for (unsigned int i = 0; i < boxes.size(); i++)
+				{
+					centerDistances[i] = boxDistance(boxes[i], center);
+					nearest = glm::min(nearest, centerDistances[i]);
+				}
+
+				brickDistances[brick] = nearest;
+
+				// every point of the brick is further than the band from any surface
+				if (fabs(nearest) > halfDiagonal + band)
+					continue;
+
+				// distances are 1-Lipschitz, so a box further than nearest + 2 * halfDiagonal from the center can't be the closest anywhere in the brick
+				candidates.clear();
+				for (unsigned int i = 0; i < boxes.size(); i++)
+				{
+					if (centerDistances[i] <= nearest + 2.0f * halfDiagonal)
+						candidates.push_back(&boxes[i]);
+				}
+
+				brickIndices[brick] = (int)(samples.size() / brickVolume);
+				samples.resize(samples.size() + brickVolume);
+				float *brickSamples = &samples[samples.size() - brickVolume];
+
+				for (int z = 0; z < BRICK_SAMPLES; z++)
+				{
+					for (int y = 0; y < BRICK_SAMPLES; y++)
+					{
+						for (int x = 0; x < BRICK_SAMPLES; x++)
+						{
+							glm::vec3 position = corner + glm::vec3((float)x, (float)y, (float)z) * cellSize;
+
+							float distance = 1e30f;
+							for (unsigned int i = 0; i < candidates.size(); i++)
+								distance = glm::min(distance, boxDistance(*candidates[i], position));
+
+							brickSamples[(z * BRICK_SAMPLES + y) * BRICK_SAMPLES + x] = distance;
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+const float* DistanceField::findCell(const glm::vec3 &position, glm::vec3 &fraction, float &uniformDistance) const {
+
+	glm::vec3 local = (position - origin) * inverseCellSize;
+
+	int cellsX = bricksX * BRICK_CELLS;
+	int cellsY = bricksY * BRICK_CELLS;
+	int cellsZ = bricksZ * BRICK_CELLS;
+
+	// outside the field everything is considered free space
+	if (local.x < 0.0f || local.y < 0.0f || local.z < 0.0f || local.x >= cellsX || local.y >= cellsY || local.z >= cellsZ) {
+		uniformDistance = band;
+		return nullptr;
+	}
+
+	int cx = (int)local.x;
+	int cy = (int)local.y;
+	int cz = (int)local.z;
+
+	fraction = glm::vec3(local.x - cx, local.y - cy, local.z - cz);
+
+	int brick = ((cz / BRICK_CELLS) * bricksY + (cy / BRICK_CELLS)) * bricksX + (cx / BRICK_CELLS);
+	int index = brickIndices[brick];
+
+	if (index < 0) {
+		uniformDistance = brickDistances[brick];
+		return nullptr;
+	}
+
+	int x = cx % BRICK_CELLS;
+	int y = cy % BRICK_CELLS;
+	int z = cz % BRICK_CELLS;
+
+	return &samples[(size_t)index * BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES + (z * BRICK_SAMPLES + y) * BRICK_SAMPLES + x];
+}
+
+float DistanceField::sample(const glm::vec3 &position) const {
+
+	glm::vec3 unused;
+	return sampleGradient(position, unused);
+}
+
+glm::vec3 DistanceField::gradient(const glm::vec3 &position) const {
+
+	glm::vec3 result;
+	sampleGradient(position, result);
+	return result;
+}
+
+float DistanceField::sampleGradient(const glm::vec3 &position, glm::vec3 &gradient) const {
+
+	glm::vec3 f;
+	float uniformDistance;
+	const float *s = findCell(position, f, uniformDistance);
+
+	if (s == nullptr) {
+		gradient = glm::vec3(0.0f);
+		return uniformDistance;
+	}
+
+	float s000 = s[CORNER_OFFSETS[0]], s100 = s[CORNER_OFFSETS[1]], s010 = s[CORNER_OFFSETS[2]], s110 = s[CORNER_OFFSETS[3]];
+	float s001 = s[CORNER_OFFSETS[4]], s101 = s[CORNER_OFFSETS[5]], s011 = s[CORNER_OFFSETS[6]], s111 = s[CORNER_OFFSETS[7]];
+
+	float x00 = s000 + (s100 - s000) * f.x;
+	float x10 = s010 + (s110 - s010) * f.x;
+	float x01 = s001 + (s101 - s001) * f.x;
+	float x11 = s011 + (s111 - s011) * f.x;
+
+	float y0 = x00 + (x10 - x00) * f.y;
+	float y1 = x01 + (x11 - x01) * f.y;
+
+	// analytic derivative of the trilinear interpolant
+	gradient.x = ((s100 - s000) * (1 - f.y) * (1 - f.z) + (s110 - s010) * f.y * (1 - f.z) + (s101 - s001) * (1 - f.y) * f.z + (s111 - s011) * f.y * f.z) * inverseCellSize;
+	gradient.y = ((x10 - x00) * (1 - f.z) + (x11 - x01) * f.z) * inverseCellSize;
+	gradient.z = (y1 - y0) * inverseCellSize;
+
+	return y0 + (y1 - y0) * f.z;
+}
+
+unsigned int DistanceField::collide(float *x, float *y, float *z, size_t stride, size_t count, float radius, unsigned char *hits, float *vx, float *vy, float *vz, float restitution) const {
+
+	if (bricksX == 0)
+		return 0;
+
+	unsigned int collisions = 0;
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 epsilon = _mm_set1_ps(1e-8f);
+	const __m128 radius4 = _mm_set1_ps(radius);
+	const __m128 bounce = _mm_set1_ps(1.0f + restitution);
+	const __m128 scale = _mm_set1_ps(inverseCellSize);
+
+	for (size_t i = 0; i < count; i += 4)
+	{
+		size_t lanes = count - i < 4 ? count - i : 4;
+
+		// gather: brick lookup is an indirection per particle, the math below runs on all four lanes at once
+		float corners[8][4], fx[4], fy[4], fz[4], px[4], py[4], pz[4];
+
+		for (size_t lane = 0; lane < 4; lane++)
+		{
+			if (lane >= lanes) {
+				for (int c = 0; c < 8; c++)
+					corners[c][lane] = band;
+				fx[lane] = fy[lane] = fz[lane] = 0.0f;
+				px[lane] = py[lane] = pz[lane] = 0.0f;
+				continue;
+			}
+
+			size_t offset = (i + lane) * stride;
+			px[lane] = x[offset];
+			py[lane] = y[offset];
+			pz[lane] = z[offset];
+
+			glm::vec3 f(0.0f);
+			float uniformDistance;
+			const float *s = findCell(glm::vec3(px[lane], py[lane], pz[lane]), f, uniformDistance);
+
+			for (int c = 0; c < 8; c++)
+				corners[c][lane] = s != nullptr ? s[CORNER_OFFSETS[c]] : uniformDistance;
+
+			fx[lane] = f.x;
+			fy[lane] = f.y;
+			fz[lane] = f.z;
+		}
+
+		__m128 s000 = _mm_loadu_ps(corners[0]), s100 = _mm_loadu_ps(corners[1]), s010 = _mm_loadu_ps(corners[2]), s110 = _mm_loadu_ps(corners[3]);
+		__m128 s001 = _mm_loadu_ps(corners[4]), s101 = _mm_loadu_ps(corners[5]), s011 = _mm_loadu_ps(corners[6]), s111 = _mm_loadu_ps(corners[7]);
+		__m128 tx = _mm_loadu_ps(fx), ty = _mm_loadu_ps(fy), tz = _mm_loadu_ps(fz);
+		__m128 ux = _mm_sub_ps(one, tx), uy = _mm_sub_ps(one, ty), uz = _mm_sub_ps(one, tz);
+
+		__m128 dx00 = _mm_sub_ps(s100, s000), dx10 = _mm_sub_ps(s110, s010), dx01 = _mm_sub_ps(s101, s001), dx11 = _mm_sub_ps(s111, s011);
+		__m128 x00 = _mm_add_ps(s000, _mm_mul_ps(dx00, tx));
+		__m128 x10 = _mm_add_ps(s010, _mm_mul_ps(dx10, tx));
+		__m128 x01 = _mm_add_ps(s001, _mm_mul_ps(dx01, tx));
+		__m128 x11 = _mm_add_ps(s011, _mm_mul_ps(dx11, tx));
+		__m128 y0 = _mm_add_ps(x00, _mm_mul_ps(_mm_sub_ps(x10, x00), ty));
+		__m128 y1 = _mm_add_ps(x01, _mm_mul_ps(_mm_sub_ps(x11, x01), ty));
+		__m128 distance = _mm_add_ps(y0, _mm_mul_ps(_mm_sub_ps(y1, y0), tz));
+
+		__m128 gx = _mm_add_ps(
+			_mm_mul_ps(uz, _mm_add_ps(_mm_mul_ps(dx00, uy), _mm_mul_ps(dx10, ty))),
+			_mm_mul_ps(tz, _mm_add_ps(_mm_mul_ps(dx01, uy), _mm_mul_ps(dx11, ty))));
+		__m128 gy = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(x10, x00), uz), _mm_mul_ps(_mm_sub_ps(x11, x01), tz));
+		__m128 gz = _mm_sub_ps(y1, y0);
+		gx = _mm_mul_ps(gx, scale);
+		gy = _mm_mul_ps(gy, scale);
+		gz = _mm_mul_ps(gz, scale);
+
+		__m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy)), _mm_mul_ps(gz, gz));
+		__m128 inside = _mm_and_ps(_mm_cmplt_ps(distance, radius4), _mm_cmpgt_ps(length2, epsilon));
+
+		int mask = _mm_movemask_ps(inside) & ((1 << lanes) - 1);
+		if (hits != nullptr) {
+			for (size_t lane = 0; lane < lanes; lane++)
+				hits[i + lane] = (mask >> lane) & 1;
+		}
+
+		if (mask == 0)
+			continue;
+
+		__m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(length2, epsilon)));
+		__m128 nx = _mm_mul_ps(gx, inverseLength);
+		__m128 ny = _mm_mul_ps(gy, inverseLength);
+		__m128 nz = _mm_mul_ps(gz, inverseLength);
+		__m128 push = _mm_and_ps(inside, _mm_sub_ps(radius4, distance));
+
+		float outX[4], outY[4], outZ[4];
+		_mm_storeu_ps(outX, _mm_add_ps(_mm_loadu_ps(px), _mm_mul_ps(nx, push)));
+		_mm_storeu_ps(outY, _mm_add_ps(_mm_loadu_ps(py), _mm_mul_ps(ny, push)));
+		_mm_storeu_ps(outZ, _mm_add_ps(_mm_loadu_ps(pz), _mm_mul_ps(nz, push)));
+
+		float outVX[4], outVY[4], outVZ[4];
+		if (vx != nullptr) {
+			float velX[4] = { 0 }, velY[4] = { 0 }, velZ[4] = { 0 };
+			for (size_t lane = 0; lane < lanes; lane++)
+			{
+				velX[lane] = vx[(i + lane) * stride];
+				velY[lane] = vy[(i + lane) * stride];
+				velZ[lane] = vz[(i + lane) * stride];
+			}
+
+			__m128 vX = _mm_loadu_ps(velX), vY = _mm_loadu_ps(velY), vZ = _mm_loadu_ps(velZ);
+			__m128 normalSpeed = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vX, nx), _mm_mul_ps(vY, ny)), _mm_mul_ps(vZ, nz));
+			// only remove the approaching part of the velocity
+			__m128 impulse = _mm_and_ps(inside, _mm_mul_ps(bounce, _mm_min_ps(normalSpeed, zero)));
+
+			_mm_storeu_ps(outVX, _mm_sub_ps(vX, _mm_mul_ps(nx, impulse)));
+			_mm_storeu_ps(outVY, _mm_sub_ps(vY, _mm_mul_ps(ny, impulse)));
+			_mm_storeu_ps(outVZ, _mm_sub_ps(vZ, _mm_mul_ps(nz, impulse)));
+		}
+
+		for (size_t lane = 0; lane < lanes; lane++)
+		{
+			if (!((mask >> lane) & 1))
+				continue;
+
+			size_t offset = (i + lane) * stride;
+			x[offset] = outX[lane];
+			y[offset] = outY[lane];
+			z[offset] = outZ[lane];
+
+			if (vx != nullptr) {
+				vx[offset] = outVX[lane];
+				vy[offset] = outVY[lane];
+				vz[offset] = outVZ[lane];
+			}
+
+			collisions++;
+		}
+	}
+
+	return collisions;
+}
+
+size_t DistanceField::getBrickCount() const {
+	return samples.size() / (BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES);
+}
+
+size_t DistanceField::getMemoryUsage() const {
+	return samples.size() * sizeof(float) + brickIndices.size() * sizeof(int) + brickDistances.size() * sizeof(float);
+}
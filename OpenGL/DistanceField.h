@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+#include <glm\glm.hpp>
+#include <btBulletDynamicsCommon.h>
+
+#include "BulletWorld.h"
+
+using namespace std;
+
+// Sparse bricked signed distance field of the static level (the wall boxes of a BulletWorld).
+// Only bricks near a surface store samples, every other brick keeps a single distance value.
+class DistanceField
+{
+public:
+
+	static const int BRICK_CELLS = 8;
+	static const int BRICK_SAMPLES = BRICK_CELLS + 1;
+
+	DistanceField(BulletWorld *world, float cellSize = 0.25f, float band = 1.0f);
+	~DistanceField();
+
+	float sample(const glm::vec3 &position) const;
+	glm::vec3 gradient(const glm::vec3 &position) const;
+	float sampleGradient(const glm::vec3 &position, glm::vec3 &gradient) const;
+
+	// Pushes particles of the given radius out of the geometry, four at a time. Positions (and the optional
+	// velocities, reflected with the given restitution) are read every stride floats. Returns how many collided.
+	unsigned int collide(float *x, float *y, float *z, size_t stride, size_t count, float radius, unsigned char *hits = nullptr,
+		float *vx = nullptr, float *vy = nullptr, float *vz = nullptr, float restitution = 0.0f) const;
+
+	size_t getBrickCount() const;
+	size_t getMemoryUsage() const;
+
+private:
+
+	struct Box {
+		glm::vec3 center;
+		glm::vec3 axisX, axisY, axisZ;
+		glm::vec3 extent;
+	};
+
+	vector<Box> boxes;
+
+	glm::vec3 origin;
+	float cellSize, inverseCellSize, band;
+	int bricksX, bricksY, bricksZ;
+
+	vector<int> brickIndices;
+	vector<float> brickDistances;
+	vector<float> samples;
+
+	void build();
+	float boxDistance(const Box &box, const glm::vec3 &position) const;
+	const float* findCell(const glm::vec3 &position, glm::vec3 &fraction, float &uniformDistance) const;
+};
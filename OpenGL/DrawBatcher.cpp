@@ -0,0 +1,76 @@
+#include "DrawBatcher.h"
+#include "GLState.h"
+
+#include <algorithm>
+#include <cstring>
+
+DrawBatcher::DrawBatcher(StreamBuffer *stream) : stream(stream), drawCount(0) {}
+
+void DrawBatcher::add(Model *model, Shader *shader, Texture2D *texture, const glm::vec3 &position, float scale, const glm::vec4 &rotation) {
+	packInstance(INSTANCE_POSITION_SCALE_ROTATION, append(model, shader, texture, INSTANCE_POSITION_SCALE_ROTATION), 0, position, scale, rotation);
+}
+
+void DrawBatcher::add(Model *model, Shader *shader, Texture2D *texture, const glm::mat4 &transform) {
+	memcpy(append(model, shader, texture, INSTANCE_MATRIX), &transform, sizeof(glm::mat4));
+}
+
+unsigned char* DrawBatcher::append(Model *model, Shader *shader, Texture2D *texture, InstanceFormat format) {
+
+	Group &group = groups[GroupKey(model, shader, texture, format)];
+	size_t stride = getInstanceStride(format);
+
+	if (group.instances.size() < (group.count + 1) * stride)
+		group.instances.resize(max((group.count + 1) * stride, group.instances.size() * 2));
+
+	return &group.instances[group.count++ * stride];
+}
+
+void DrawBatcher::flush() {
+
+	drawCount = 0;
+
+	for (auto &iter : groups)
+	{
+		Group &group = iter.second;
+		if (group.count == 0)
+			continue;
+
+		Model *model = get<0>(iter.first);
+		Shader *shader = get<1>(iter.first);
+		Texture2D *texture = get<2>(iter.first);
+		InstanceFormat format = get<3>(iter.first);
+		size_t stride = getInstanceStride(format);
+
+		size_t offset;
+		void *instances = stream->map(group.count * stride, stride, offset);
+		if (!instances) {
+			group.count = 0;
+			continue;
+		}
+		memcpy(instances, &group.instances[0], group.count * stride);
+		stream->unmap();
+
+		shader->Use();
+		shader->setBool("instanced"_u, true);
+		useInstanceFormat(shader, format);
+		if (texture)
+			texture->Bind();
+
+		for (unsigned int i = 0; i < model->meshes.size(); i++)
+		{
+			if (!texture)
+				model->meshes[i].bindTextures(shader);
+			GLState::getGLState().bindVertexArray(model->meshes[i].getVAO());
+			setupInstanceAttributes(stream->getBuffer(), format, offset);
+			glDrawElementsInstanced(GL_TRIANGLES, model->meshes[i].indices.size(), GL_UNSIGNED_INT, 0, (GLsizei)group.count);
+			drawCount++;
+		}
+
+		shader->setBool("instanced"_u, false);
+		group.count = 0;
+	}
+}
+
+unsigned int DrawBatcher::getDrawCount() const {
+	return drawCount;
+}
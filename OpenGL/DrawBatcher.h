@@ -0,0 +1,49 @@
+#pragma once
+
+#include <map>
+#include <tuple>
+#include <vector>
+#include <glad\glad.h>
+#include <glm\glm.hpp>
+
+#include "InstanceFormat.h"
+#include "Model.h"
+#include "Shader.h"
+#include "StreamBuffer.h"
+#include "Texture2D.h"
+
+using namespace std;
+
+// Collects the draws of repeated meshes. Draws that share model, shader, texture and instance format form a
+// group, and flush() sends every group as one instanced draw with its instances streamed from the ring.
+// The shader must decode the instance attributes 3 to 6 when its "instanced" uniform is set. Without a texture
+// every mesh binds its own, see Mesh::bindTextures.
+class DrawBatcher
+{
+public:
+
+	DrawBatcher(StreamBuffer *stream);
+
+	void add(Model *model, Shader *shader, Texture2D *texture, const glm::vec3 &position, float scale, const glm::vec4 &rotation);
+	void add(Model *model, Shader *shader, Texture2D *texture, const glm::mat4 &transform);
+
+	// Draws and empties every group. Uniforms shared by the group (camera, lights) must already be set.
+	void flush();
+
+	unsigned int getDrawCount() const;
+
+private:
+
+	typedef tuple<Model*, Shader*, Texture2D*, InstanceFormat> GroupKey;
+
+	struct Group {
+		vector<unsigned char> instances;
+		size_t count;
+	};
+
+	StreamBuffer *stream;
+	map<GroupKey, Group> groups;
+	unsigned int drawCount;
+
+	unsigned char* append(Model *model, Shader *shader, Texture2D *texture, InstanceFormat format);
+};
@@ -0,0 +1,553 @@
+#include "FluidSystem.h"
+
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+
+static const size_t PARALLEL_GRAIN = 1024;
+static const float RELAXATION = 1.0f;
+static const float CORRECTION_K = 0.1f;
+static const float CORRECTION_DQ = 0.2f;
+static const float VISCOSITY = 0.01f;
+static const float PI = 3.14159265f;
+
+static inline float horizontalSum(__m128 v) {
+
+	__m128 pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+}
+
+static inline __m128 gather(const float *values, const unsigned int *list) {
+	return _mm_setr_ps(values[list[0]], values[list[1]], values[list[2]], values[list[3]]);
+}
+
+FluidSystem::FluidSystem(glm::vec3 boundsMin, glm::vec3 boundsMax, float waterLevel, unsigned int particles, glm::vec3 gravity) : pool(ThreadPool::getThreadPool()), boundsMin(boundsMin), boundsMax(boundsMax), gravity(gravity), count(particles), iterations(3), pendingTime(0.0f), pending(false), busy(false), stopping(false)
+{
+	glm::vec3 extent = glm::vec3(boundsMax.x - boundsMin.x, glm::min(waterLevel, boundsMax.y) - boundsMin.y, boundsMax.z - boundsMin.z);
+
+	// largest lattice spacing that still fits every particle below the water level
+	spacing = cbrt(extent.x * extent.y * extent.z / particles);
+	int nx = 0, ny = 0, nz = 0;
+	for (;;)
+	{
+		nx = glm::max(1, (int)(extent.x / spacing));
+		ny = glm::max(1, (int)(extent.y / spacing));
+		nz = glm::max(1, (int)(extent.z / spacing));
+		if ((size_t)nx * ny * nz >= count)
+			break;
+		spacing *= 0.99f;
+	}
+
+	radius = 2.0f * spacing;
+	inverseRadius = 1.0f / radius;
+	poly6 = 315.0f / (64.0f * PI * pow(radius, 9.0f));
+	spikyGradient = -45.0f / (PI * pow(radius, 6.0f));
+	correctionScale = 1.0f / kernel(CORRECTION_DQ * CORRECTION_DQ * radius * radius);
+
+	// rest density is the density of a particle inside the initial lattice
+	restDensity = 0.0f;
+	for (int i = -2; i <= 2; i++)
+		for (int j = -2; j <= 2; j++)
+			for (int k = -2; k <= 2; k++)
+				restDensity += kernel((float)(i * i + j * j + k * k) * spacing * spacing);
+
+	x.resize(count); y.resize(count); z.resize(count);
+	vx.assign(count, 0.0f); vy.assign(count, 0.0f); vz.assign(count, 0.0f);
+	px.resize(count); py.resize(count); pz.resize(count);
+	dx.resize(count); dy.resize(count); dz.resize(count);
+	lambda.resize(count);
+	scratch.resize(count);
+	cellKeys.resize(count);
+	order.resize(count);
+	neighbors.resize(count * NEIGHBOR_STRIDE);
+	neighborCounts.resize(count);
+
+	cellsX = glm::max(1, (int)ceil((boundsMax.x - boundsMin.x) * inverseRadius));
+	cellsY = glm::max(1, (int)ceil((boundsMax.y - boundsMin.y) * inverseRadius));
+	cellsZ = glm::max(1, (int)ceil((boundsMax.z - boundsMin.z) * inverseRadius));
+	cellStart.resize((size_t)cellsX * cellsY * cellsZ + 1);
+
+	// fill from the floor up, the top layer may be partial
+	size_t i = 0;
+	for (int layer = 0; layer < ny && i < count; layer++)
+		for (int row = 0; row < nz && i < count; row++)
+			for (int column = 0; column < nx && i < count; column++, i++)
+			{
+				x[i] = boundsMin.x + (column + 0.5f) * spacing;
+				y[i] = boundsMin.y + (layer + 0.5f) * spacing;
+				z[i] = boundsMin.z + (row + 0.5f) * spacing;
+			}
+
+	px = x; py = y; pz = z;
+	drawX = x; drawY = y; drawZ = z;
+	drawVX = vx; drawVY = vy; drawVZ = vz;
+	buildGrid();
+
+	worker = thread(&FluidSystem::workerLoop, this);
+}
+
+FluidSystem::~FluidSystem()
+{
+	{
+		unique_lock<mutex> lock(stepMutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+	worker.join();
+}
+
+void FluidSystem::step(float deltaTime) {
+
+	if (count == 0 || deltaTime <= 0.0f)
+		return;
+
+	predict(deltaTime);
+	buildGrid();
+	findNeighbors();
+	solveDensity();
+	updateVelocities(deltaTime);
+}
+
+void FluidSystem::beginStep(float deltaTime) {
+
+	wait();
+
+	memcpy(&drawX[0], &x[0], count * sizeof(float));
+	memcpy(&drawY[0], &y[0], count * sizeof(float));
+	memcpy(&drawZ[0], &z[0], count * sizeof(float));
+	memcpy(&drawVX[0], &vx[0], count * sizeof(float));
+	memcpy(&drawVY[0], &vy[0], count * sizeof(float));
+	memcpy(&drawVZ[0], &vz[0], count * sizeof(float));
+
+	{
+		unique_lock<mutex> lock(stepMutex);
+		pendingTime = deltaTime;
+		pending = true;
+		busy = true;
+	}
+	wakeCondition.notify_all();
+}
+
+void FluidSystem::wait() {
+
+	unique_lock<mutex> lock(stepMutex);
+	doneCondition.wait(lock, [this] { return !busy; });
+}
+
+void FluidSystem::workerLoop() {
+
+	unique_lock<mutex> lock(stepMutex);
+
+	while (true)
+	{
+		wakeCondition.wait(lock, [this] { return pending || stopping; });
+		if (stopping)
+			return;
+		pending = false;
+
+		lock.unlock();
+		step(pendingTime);
+		lock.lock();
+
+		busy = false;
+		doneCondition.notify_all();
+	}
+}
+
+void FluidSystem::predict(float deltaTime) {
+
+	pool.parallelFor(count, PARALLEL_GRAIN, [this, deltaTime](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			vx[i] += gravity.x * deltaTime;
+			vy[i] += gravity.y * deltaTime;
+			vz[i] += gravity.z * deltaTime;
+			px[i] = x[i] + vx[i] * deltaTime;
+			py[i] = y[i] + vy[i] * deltaTime;
+			pz[i] = z[i] + vz[i] * deltaTime;
+			clampToBounds(i);
+		}
+	});
+}
+
+// Counting sort of the particles by cell key, then every array is reordered so a cell is a contiguous range.
+// The water never leaves the room, so the key is the linear cell index in the room grid and never collides,
+// and the three cells of a grid row are adjacent in memory.
+void FluidSystem::buildGrid() {
+
+	pool.parallelFor(count, PARALLEL_GRAIN, [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			int cx, cy, cz;
+			cellOf(px[i], py[i], pz[i], cx, cy, cz);
+			cellKeys[i] = cellKey(cx, cy, cz);
+		}
+	});
+
+	size_t cells = cellStart.size() - 1;
+	memset(&cellStart[0], 0, cellStart.size() * sizeof(unsigned int));
+	for (size_t i = 0; i < count; i++)
+		cellStart[cellKeys[i]]++;
+
+	unsigned int sum = 0;
+	for (size_t c = 0; c < cells; c++)
+	{
+		unsigned int cellCount = cellStart[c];
+		cellStart[c] = sum;
+		sum += cellCount;
+	}
+
+	// placing advances every start to the end of its cell, which is the start of the next one
+	for (size_t i = 0; i < count; i++)
+		order[cellStart[cellKeys[i]]++] = (unsigned int)i;
+	memmove(&cellStart[1], &cellStart[0], cells * sizeof(unsigned int));
+	cellStart[0] = 0;
+
+	permute(x); permute(y); permute(z);
+	permute(vx); permute(vy); permute(vz);
+	permute(px); permute(py); permute(pz);
+}
+
+void FluidSystem::permute(vector<float> &values) {
+
+	pool.parallelFor(count, PARALLEL_GRAIN, [this, &values](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			scratch[i] = values[order[i]];
+	});
+	values.swap(scratch);
+}
+
+void FluidSystem::findNeighbors() {
+
+	const float radiusSquared = radius * radius;
+
+	pool.parallelFor(count, PARALLEL_GRAIN, [this, radiusSquared](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			int cx, cy, cz;
+			cellOf(px[i], py[i], pz[i], cx, cy, cz);
+
+			unsigned int *list = &neighbors[i * NEIGHBOR_STRIDE];
+			unsigned int found = 0;
+
+			const __m128 x4 = _mm_set1_ps(px[i]), y4 = _mm_set1_ps(py[i]), z4 = _mm_set1_ps(pz[i]);
+			const __m128 radius4 = _mm_set1_ps(radiusSquared);
+
+			int firstX = glm::max(cx - 1, 0), lastX = glm::min(cx + 1, cellsX - 1);
+			for (int oy = glm::max(cy - 1, 0); oy <= glm::min(cy + 1, cellsY - 1); oy++)
+				for (int oz = glm::max(cz - 1, 0); oz <= glm::min(cz + 1, cellsZ - 1); oz++)
+				{
+					// one contiguous range covers the three cells of this row
+					unsigned int j = cellStart[cellKey(firstX, oy, oz)];
+					unsigned int rowEnd = cellStart[cellKey(lastX, oy, oz) + 1];
+
+					for (; j + 4 <= rowEnd && found < MAX_NEIGHBORS; j += 4)
+					{
+						__m128 rx = _mm_sub_ps(x4, _mm_loadu_ps(&px[j]));
+						__m128 ry = _mm_sub_ps(y4, _mm_loadu_ps(&py[j]));
+						__m128 rz = _mm_sub_ps(z4, _mm_loadu_ps(&pz[j]));
+						__m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)), _mm_mul_ps(rz, rz));
+
+						// branchless append, a list has room for a few entries past MAX_NEIGHBORS
+						int mask = _mm_movemask_ps(_mm_cmplt_ps(distanceSquared, radius4));
+						for (unsigned int lane = 0; lane < 4; lane++)
+						{
+							list[found] = j + lane;
+							found += ((mask >> lane) & 1) & (unsigned int)(j + lane != i);
+						}
+					}
+
+					for (; j < rowEnd && found < MAX_NEIGHBORS; j++)
+					{
+						float rx = px[i] - px[j], ry = py[i] - py[j], rz = pz[i] - pz[j];
+						if (j != i && rx * rx + ry * ry + rz * rz < radiusSquared)
+							list[found++] = j;
+					}
+				}
+
+			// pad to whole groups of four with the particle itself, the solver masks those lanes out
+			found = glm::min(found, (unsigned int)MAX_NEIGHBORS);
+			for (unsigned int padded = found; padded % 4 != 0; padded++)
+				list[padded] = (unsigned int)i;
+
+			neighborCounts[i] = (unsigned char)found;
+		}
+	});
+}
+
+void FluidSystem::solveDensity() {
+
+	const float inverseRestDensity = 1.0f / restDensity;
+	const float relaxation = RELAXATION * inverseRadius * inverseRadius;
+
+	for (int iteration = 0; iteration < iterations; iteration++)
+	{
+		pool.parallelFor(count, PARALLEL_GRAIN, [this, inverseRestDensity, relaxation](size_t begin, size_t end) {
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+			const __m128 minimum = _mm_set1_ps(1e-6f);
+			const __m128 radius4 = _mm_set1_ps(radius);
+			const __m128 radiusSquared = _mm_set1_ps(radius * radius);
+			const __m128 gradientScale = _mm_set1_ps(spikyGradient * inverseRestDensity);
+
+			for (size_t i = begin; i < end; i++)
+			{
+				const unsigned int *list = &neighbors[i * NEIGHBOR_STRIDE];
+				const unsigned int found = neighborCounts[i];
+				const __m128 x4 = _mm_set1_ps(px[i]), y4 = _mm_set1_ps(py[i]), z4 = _mm_set1_ps(pz[i]);
+				__m128 density = zero, gx = zero, gy = zero, gz = zero, gradientSum = zero;
+
+				for (unsigned int n = 0; n < found; n += 4)
+				{
+					__m128 valid = _mm_cmplt_ps(lanes, _mm_set1_ps((float)(found - n)));
+					__m128 rx = _mm_sub_ps(x4, gather(&px[0], list + n));
+					__m128 ry = _mm_sub_ps(y4, gather(&py[0], list + n));
+					__m128 rz = _mm_sub_ps(z4, gather(&pz[0], list + n));
+					__m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)), _mm_mul_ps(rz, rz));
+
+					__m128 t = _mm_and_ps(_mm_max_ps(_mm_sub_ps(radiusSquared, distanceSquared), zero), valid);
+					density = _mm_add_ps(density, _mm_mul_ps(_mm_mul_ps(t, t), t));
+
+					__m128 distance = _mm_sqrt_ps(distanceSquared);
+					__m128 inside = _mm_and_ps(_mm_cmpgt_ps(distance, minimum), _mm_cmplt_ps(distance, radius4));
+					__m128 h = _mm_sub_ps(radius4, distance);
+					__m128 g = _mm_and_ps(_mm_div_ps(_mm_mul_ps(gradientScale, _mm_mul_ps(h, h)), _mm_max_ps(distance, minimum)), inside);
+
+					gx = _mm_add_ps(gx, _mm_mul_ps(g, rx));
+					gy = _mm_add_ps(gy, _mm_mul_ps(g, ry));
+					gz = _mm_add_ps(gz, _mm_mul_ps(g, rz));
+					gradientSum = _mm_add_ps(gradientSum, _mm_mul_ps(_mm_mul_ps(g, g), distanceSquared));
+				}
+
+				float sx = horizontalSum(gx), sy = horizontalSum(gy), sz = horizontalSum(gz);
+				float gradient = horizontalSum(gradientSum) + sx * sx + sy * sy + sz * sz;
+
+				// only resist compression, a free surface must not pull particles together
+				float constraint = glm::max((kernel(0.0f) + poly6 * horizontalSum(density)) * inverseRestDensity - 1.0f, 0.0f);
+				lambda[i] = -constraint / (gradient + relaxation);
+			}
+		});
+
+		pool.parallelFor(count, PARALLEL_GRAIN, [this, inverseRestDensity](size_t begin, size_t end) {
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 minimum = _mm_set1_ps(1e-6f);
+			const __m128 radius4 = _mm_set1_ps(radius);
+			const __m128 radiusSquared = _mm_set1_ps(radius * radius);
+			const __m128 correctionPoly6 = _mm_set1_ps(poly6 * correctionScale);
+			const __m128 correctionK = _mm_set1_ps(-CORRECTION_K);
+			const __m128 gradientScale = _mm_set1_ps(spikyGradient * inverseRestDensity);
+
+			for (size_t i = begin; i < end; i++)
+			{
+				const unsigned int *list = &neighbors[i * NEIGHBOR_STRIDE];
+				const unsigned int found = neighborCounts[i];
+				const __m128 x4 = _mm_set1_ps(px[i]), y4 = _mm_set1_ps(py[i]), z4 = _mm_set1_ps(pz[i]);
+				const __m128 lambda4 = _mm_set1_ps(lambda[i]);
+				__m128 sx = zero, sy = zero, sz = zero;
+
+				// padding lanes are the particle itself, at distance zero they fail the inside test
+				for (unsigned int n = 0; n < found; n += 4)
+				{
+					__m128 rx = _mm_sub_ps(x4, gather(&px[0], list + n));
+					__m128 ry = _mm_sub_ps(y4, gather(&py[0], list + n));
+					__m128 rz = _mm_sub_ps(z4, gather(&pz[0], list + n));
+					__m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)), _mm_mul_ps(rz, rz));
+					__m128 distance = _mm_sqrt_ps(distanceSquared);
+					__m128 inside = _mm_and_ps(_mm_cmpgt_ps(distance, minimum), _mm_cmplt_ps(distance, radius4));
+
+					// artificial pressure against particle clumping
+					__m128 t = _mm_max_ps(_mm_sub_ps(radiusSquared, distanceSquared), zero);
+					__m128 ratio = _mm_mul_ps(correctionPoly6, _mm_mul_ps(_mm_mul_ps(t, t), t));
+					ratio = _mm_mul_ps(ratio, ratio);
+					__m128 correction = _mm_mul_ps(correctionK, _mm_mul_ps(ratio, ratio));
+
+					__m128 h = _mm_sub_ps(radius4, distance);
+					__m128 weight = _mm_add_ps(_mm_add_ps(lambda4, gather(&lambda[0], list + n)), correction);
+					__m128 g = _mm_div_ps(_mm_mul_ps(gradientScale, _mm_mul_ps(h, h)), _mm_max_ps(distance, minimum));
+					g = _mm_and_ps(_mm_mul_ps(weight, g), inside);
+
+					sx = _mm_add_ps(sx, _mm_mul_ps(g, rx));
+					sy = _mm_add_ps(sy, _mm_mul_ps(g, ry));
+					sz = _mm_add_ps(sz, _mm_mul_ps(g, rz));
+				}
+
+				dx[i] = horizontalSum(sx);
+				dy[i] = horizontalSum(sy);
+				dz[i] = horizontalSum(sz);
+			}
+		});
+
+		pool.parallelFor(count, PARALLEL_GRAIN, [this](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+			{
+				px[i] += dx[i];
+				py[i] += dy[i];
+				pz[i] += dz[i];
+				clampToBounds(i);
+			}
+		});
+	}
+}
+
+void FluidSystem::updateVelocities(float deltaTime) {
+
+	const float inverseDeltaTime = 1.0f / deltaTime;
+	const float inverseRestDensity = 1.0f / restDensity;
+
+	pool.parallelFor(count, PARALLEL_GRAIN, [this, inverseDeltaTime](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			vx[i] = (px[i] - x[i]) * inverseDeltaTime;
+			vy[i] = (py[i] - y[i]) * inverseDeltaTime;
+			vz[i] = (pz[i] - z[i]) * inverseDeltaTime;
+			x[i] = px[i];
+			y[i] = py[i];
+			z[i] = pz[i];
+		}
+	});
+
+	// XSPH viscosity, written to the delta arrays and swapped in
+	pool.parallelFor(count, PARALLEL_GRAIN, [this, inverseRestDensity](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			const unsigned int *list = &neighbors[i * NEIGHBOR_STRIDE];
+			float sx = 0.0f, sy = 0.0f, sz = 0.0f;
+
+			for (unsigned int n = 0; n < neighborCounts[i]; n++)
+			{
+				unsigned int j = list[n];
+				float rx = x[i] - x[j], ry = y[i] - y[j], rz = z[i] - z[j];
+				float w = kernel(rx * rx + ry * ry + rz * rz) * inverseRestDensity;
+				sx += (vx[j] - vx[i]) * w;
+				sy += (vy[j] - vy[i]) * w;
+				sz += (vz[j] - vz[i]) * w;
+			}
+
+			dx[i] = vx[i] + VISCOSITY * sx;
+			dy[i] = vy[i] + VISCOSITY * sy;
+			dz[i] = vz[i] + VISCOSITY * sz;
+		}
+	});
+
+	vx.swap(dx);
+	vy.swap(dy);
+	vz.swap(dz);
+}
+
+float FluidSystem::sampleVolume(const glm::vec3 &aabbMin, const glm::vec3 &aabbMax, glm::vec3 &velocity) const {
+
+	velocity = glm::vec3(0.0f);
+
+	glm::vec3 size = aabbMax - aabbMin;
+	float volume = size.x * size.y * size.z;
+	if (count == 0 || volume <= 0.0f)
+		return 0.0f;
+	if (aabbMax.x < boundsMin.x || aabbMin.x > boundsMax.x || aabbMax.y < boundsMin.y || aabbMin.y > boundsMax.y || aabbMax.z < boundsMin.z || aabbMin.z > boundsMax.z)
+		return 0.0f;
+
+	// particles moved at most a fraction of a cell since the grid was built, so look one cell further
+	int minX, minY, minZ, maxX, maxY, maxZ;
+	cellOf(aabbMin.x - radius, aabbMin.y - radius, aabbMin.z - radius, minX, minY, minZ);
+	cellOf(aabbMax.x + radius, aabbMax.y + radius, aabbMax.z + radius, maxX, maxY, maxZ);
+
+	unsigned int inside = 0;
+
+	for (int cy = minY; cy <= maxY; cy++)
+		for (int cz = minZ; cz <= maxZ; cz++)
+			for (unsigned int j = cellStart[cellKey(minX, cy, cz)]; j < cellStart[cellKey(maxX, cy, cz) + 1]; j++)
+			{
+				if (x[j] < aabbMin.x || x[j] > aabbMax.x || y[j] < aabbMin.y || y[j] > aabbMax.y || z[j] < aabbMin.z || z[j] > aabbMax.z)
+					continue;
+				velocity += glm::vec3(vx[j], vy[j], vz[j]);
+				inside++;
+			}
+
+	if (inside == 0)
+		return 0.0f;
+
+	velocity /= (float)inside;
+	return glm::min(inside * spacing * spacing * spacing / volume, 1.0f);
+}
+
+void FluidSystem::applyBodyForces(btRigidBody *body, float buoyancy, float drag) const {
+
+	if (body->getInvMass() == 0.0f)
+		return;
+
+	btVector3 aabbMin, aabbMax;
+	body->getAabb(aabbMin, aabbMax);
+
+	glm::vec3 water;
+	float submerged = sampleVolume(glm::vec3(aabbMin.getX(), aabbMin.getY(), aabbMin.getZ()), glm::vec3(aabbMax.getX(), aabbMax.getY(), aabbMax.getZ()), water);
+	if (submerged <= 0.0f)
+		return;
+
+	float mass = 1.0f / body->getInvMass();
+	btVector3 relative = btVector3(water.x, water.y, water.z) - body->getLinearVelocity();
+
+	body->activate();
+	body->applyCentralForce(btVector3(gravity.x, gravity.y, gravity.z) * (-mass * buoyancy * submerged));
+	body->applyCentralForce(relative * (mass * drag * submerged));
+	body->setAngularVelocity(body->getAngularVelocity() * (1.0f - glm::min(drag * submerged / 60.0f, 1.0f)));
+}
+
+size_t FluidSystem::getParticleCount() const {
+	return count;
+}
+
+float FluidSystem::getParticleSpacing() const {
+	return spacing;
+}
+
+const float* FluidSystem::getPositionsX() const {
+	return &drawX[0];
+}
+
+const float* FluidSystem::getPositionsY() const {
+	return &drawY[0];
+}
+
+const float* FluidSystem::getPositionsZ() const {
+	return &drawZ[0];
+}
+
+const float* FluidSystem::getVelocitiesX() const {
+	return &drawVX[0];
+}
+
+const float* FluidSystem::getVelocitiesY() const {
+	return &drawVY[0];
+}
+
+const float* FluidSystem::getVelocitiesZ() const {
+	return &drawVZ[0];
+}
+
+void FluidSystem::setIterations(int iterations) {
+	this->iterations = glm::max(1, iterations);
+}
+
+float FluidSystem::kernel(float distanceSquared) const {
+
+	float d = radius * radius - distanceSquared;
+	return d > 0.0f ? poly6 * d * d * d : 0.0f;
+}
+
+unsigned int FluidSystem::cellKey(int cx, int cy, int cz) const {
+	return (unsigned int)((cz * cellsY + cy) * cellsX + cx);
+}
+
+void FluidSystem::cellOf(float px, float py, float pz, int &cx, int &cy, int &cz) const {
+
+	cx = glm::clamp((int)floor((px - boundsMin.x) * inverseRadius), 0, cellsX - 1);
+	cy = glm::clamp((int)floor((py - boundsMin.y) * inverseRadius), 0, cellsY - 1);
+	cz = glm::clamp((int)floor((pz - boundsMin.z) * inverseRadius), 0, cellsZ - 1);
+}
+
+void FluidSystem::clampToBounds(size_t i) {
+
+	float inset = 0.5f * spacing;
+	px[i] = glm::clamp(px[i], boundsMin.x + inset, boundsMax.x - inset);
+	py[i] = glm::clamp(py[i], boundsMin.y + inset, boundsMax.y - inset);
+	pz[i] = glm::clamp(pz[i], boundsMin.z + inset, boundsMax.z - inset);
+}
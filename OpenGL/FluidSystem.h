@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <glm\glm.hpp>
+#include <btBulletDynamicsCommon.h>
+
+#include "ThreadPool.h"
+
+using namespace std;
+
+// Position based fluid (Macklin & Mueller) kept inside an axis aligned box. Particles live in structure of
+// arrays form and are counting sorted into a uniform grid every step, so neighbours are close in memory.
+// Bodies do not push the water, the water only pushes bodies (buoyancy and drag). beginStep() runs a step on the
+// fluid's own thread, which shares the ThreadPool with the rest of the frame. The pool runs one parallelFor at a
+// time (submitMutex), so the render thread's parallel work, LightClusters::assign among it, waits for the fluid
+// pass in flight: only the fluid's serial parts and the render thread's own serial work overlap.
+class FluidSystem
+{
+public:
+
+	static const int MAX_NEIGHBORS = 64;
+	static const int NEIGHBOR_STRIDE = MAX_NEIGHBORS + 4;
+
+	FluidSystem(glm::vec3 boundsMin, glm::vec3 boundsMax, float waterLevel, unsigned int particles, glm::vec3 gravity = glm::vec3(0.0f, -10.0f, 0.0f));
+	~FluidSystem();
+
+	void step(float deltaTime);
+
+	// Copies the positions and velocities for drawing and starts step(deltaTime) on the fluid thread
+	void beginStep(float deltaTime);
+	// Blocks until the last beginStep() is done. Everything but the positions and velocities getters must wait for it.
+	void wait();
+
+	// Fraction of the box filled with water and the mean water velocity inside it
+	float sampleVolume(const glm::vec3 &aabbMin, const glm::vec3 &aabbMax, glm::vec3 &velocity) const;
+
+	// buoyancy is the water to body density ratio, drag pulls the body towards the water velocity (1/s)
+	void applyBodyForces(btRigidBody *body, float buoyancy, float drag) const;
+
+	size_t getParticleCount() const;
+	float getParticleSpacing() const;
+	// Positions as of the last beginStep(), they can be read while the step runs
+	const float* getPositionsX() const;
+	const float* getPositionsY() const;
+	const float* getPositionsZ() const;
+	// and the velocities that brought them there, for the motion vectors
+	const float* getVelocitiesX() const;
+	const float* getVelocitiesY() const;
+	const float* getVelocitiesZ() const;
+
+	void setIterations(int iterations);
+
+private:
+
+	ThreadPool &pool;
+
+	glm::vec3 boundsMin, boundsMax, gravity;
+	size_t count;
+	float spacing, radius, inverseRadius, restDensity;
+	int iterations;
+
+	float poly6, spikyGradient, correctionScale;
+
+	vector<float> x, y, z;
+	vector<float> drawX, drawY, drawZ;
+	vector<float> drawVX, drawVY, drawVZ;
+	vector<float> vx, vy, vz;
+	vector<float> px, py, pz;
+	vector<float> dx, dy, dz;
+	vector<float> lambda;
+	vector<float> scratch;
+
+	int cellsX, cellsY, cellsZ;
+	vector<unsigned int> cellKeys;
+	vector<unsigned int> cellStart;
+	vector<unsigned int> order;
+
+	vector<unsigned int> neighbors;
+	vector<unsigned char> neighborCounts;
+
+	thread worker;
+	mutex stepMutex;
+	condition_variable wakeCondition;
+	condition_variable doneCondition;
+	float pendingTime;
+	bool pending, busy, stopping;
+
+	void workerLoop();
+
+	void predict(float deltaTime);
+	void buildGrid();
+	void findNeighbors();
+	void solveDensity();
+	void updateVelocities(float deltaTime);
+
+	float kernel(float distanceSquared) const;
+	unsigned int cellKey(int cx, int cy, int cz) const;
+	void cellOf(float px, float py, float pz, int &cx, int &cy, int &cz) const;
+	void clampToBounds(size_t i);
+	void permute(vector<float> &values);
+};
@@ -0,0 +1,124 @@
+#include "Frustum.h"
+
+#include <cmath>
+#include <emmintrin.h>
+
+Frustum::Frustum() {
+	update(glm::mat4(1.0f));
+}
+
+void Frustum::update(const glm::mat4 &viewProjection) {
+
+	// rows of the matrix, glm is column major
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++)
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+	planes[0] = rows[3] + rows[0]; // left
+	planes[1] = rows[3] - rows[0]; // right
+	planes[2] = rows[3] + rows[1]; // bottom
+	planes[3] = rows[3] - rows[1]; // top
+	planes[4] = rows[3] + rows[2]; // near
+	planes[5] = rows[3] - rows[2]; // far
+
+	for (int i = 0; i < 6; i++)
+		planes[i] = planes[i] / glm::length(glm::vec3(planes[i]));
+}
+
+void Frustum::update(const glm::mat4 &viewProjection, const glm::vec4 &rect) {
+
+	// maps the rectangle onto the whole clip space
+	glm::vec2 scale(2.0f / (rect.z - rect.x), 2.0f / (rect.w - rect.y));
+	glm::vec2 center((rect.x + rect.z) * 0.5f, (rect.y + rect.w) * 0.5f);
+
+	glm::mat4 window(1.0f);
+	window[0][0] = scale.x;
+	window[1][1] = scale.y;
+	window[3][0] = -center.x * scale.x;
+	window[3][1] = -center.y * scale.y;
+
+	update(window * viewProjection);
+}
+
+bool Frustum::isVisible(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) const {
+
+	for (int i = 0; i < 6; i++)
+	{
+		// the corner furthest along the normal
+		glm::vec3 corner(planes[i].x >= 0.0f ? boundsMax.x : boundsMin.x,
+			planes[i].y >= 0.0f ? boundsMax.y : boundsMin.y,
+			planes[i].z >= 0.0f ? boundsMax.z : boundsMin.z);
+
+		if (glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < 0.0f)
+			return false;
+	}
+
+	return true;
+}
+
+size_t Frustum::cullBoxes(const float *minX, const float *minY, const float *minZ, const float *maxX, const float *maxY, const float *maxZ,
+	size_t count, unsigned char *visible) const {
+
+	size_t visibleCount = 0;
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 outside = _mm_setzero_ps();
+
+		for (int p = 0; p < 6; p++)
+		{
+			// the sign of the normal picks the same corner for the four boxes
+			__m128 x = _mm_loadu_ps(planes[p].x >= 0.0f ? &maxX[i] : &minX[i]);
+			__m128 y = _mm_loadu_ps(planes[p].y >= 0.0f ? &maxY[i] : &minY[i]);
+			__m128 z = _mm_loadu_ps(planes[p].z >= 0.0f ? &maxZ[i] : &minZ[i]);
+
+			__m128 distance = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(planes[p].x)), _mm_mul_ps(y, _mm_set1_ps(planes[p].y)));
+			distance = _mm_add_ps(distance, _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(planes[p].z)), _mm_set1_ps(planes[p].w)));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_setzero_ps()));
+		}
+
+		int mask = _mm_movemask_ps(outside);
+		for (int lane = 0; lane < 4; lane++)
+		{
+			visible[i + lane] = (mask >> lane & 1) ? 0 : 1;
+			visibleCount += visible[i + lane];
+		}
+	}
+
+	for (; i < count; i++)
+	{
+		visible[i] = isVisible(glm::vec3(minX[i], minY[i], minZ[i]), glm::vec3(maxX[i], maxY[i], maxZ[i])) ? 1 : 0;
+		visibleCount += visible[i];
+	}
+
+	return visibleCount;
+}
+
+struct CollectVisible : btDbvt::ICollide {
+
+	vector<const btCollisionObject*> &visible;
+
+	CollectVisible(vector<const btCollisionObject*> &visible) : visible(visible) {}
+
+	void Process(const btDbvtNode *leaf) {
+		visible.push_back((const btCollisionObject*)((btBroadphaseProxy*)leaf->data)->m_clientObject);
+	}
+};
+
+void Frustum::cullTree(const btDbvt &tree, vector<const btCollisionObject*> &visible) const {
+
+	if (tree.m_root == nullptr)
+		return;
+
+	btVector3 normals[6];
+	btScalar offsets[6];
+	for (int i = 0; i < 6; i++)
+	{
+		normals[i] = btVector3(planes[i].x, planes[i].y, planes[i].z);
+		offsets[i] = planes[i].w;
+	}
+
+	CollectVisible policy(visible);
+	btDbvt::collideKDOP(tree.m_root, normals, offsets, 6, policy);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include <glm\glm.hpp>
+#include <btBulletDynamicsCommon.h>
+
+using namespace std;
+
+// The six planes of a projection * view matrix (Gribb & Hartmann), normals pointing inside.
+// A box is culled when it lies completely behind one of the planes.
+class Frustum
+{
+public:
+
+	Frustum();
+
+	void update(const glm::mat4 &viewProjection);
+
+	// The part of the frustum seen through a screen rectangle (min x, min y, max x, max y in normalized device coordinates)
+	void update(const glm::mat4 &viewProjection, const glm::vec4 &rect);
+
+	bool isVisible(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) const;
+
+	// Tests boxes given in structure of arrays form four at a time, visible[i] is set to 1 or 0.
+	// Returns how many boxes are visible.
+	size_t cullBoxes(const float *minX, const float *minY, const float *minZ, const float *maxX, const float *maxY, const float *maxZ,
+		size_t count, unsigned char *visible) const;
+
+	// Descends a broadphase tree, a node outside the frustum skips its whole subtree
+	void cullTree(const btDbvt &tree, vector<const btCollisionObject*> &visible) const;
+
+private:
+
+	glm::vec4 planes[6];
+};
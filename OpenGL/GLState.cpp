@@ -0,0 +1,256 @@
+#include "GLState.h"
+
+GLState* GLState::glState = nullptr;
+
+GLState::GLState() : issued(0), skipped(0), lastIssued(0), lastSkipped(0) {
+	invalidate();
+}
+
+GLState& GLState::getGLState() {
+
+	if (glState == nullptr)
+		glState = new GLState();
+
+	return *glState;
+}
+
+void GLState::destroyGLState() {
+
+	delete glState;
+	glState = nullptr;
+}
+
+bool GLState::changed(GLuint &cached, GLuint value) {
+
+	if (cached == value) {
+		skipped++;
+		return false;
+	}
+
+	cached = value;
+	issued++;
+	return true;
+}
+
+int GLState::bufferSlot(GLenum target) const {
+
+	switch (target)
+	{
+	case GL_ARRAY_BUFFER: return 0;
+	case GL_ELEMENT_ARRAY_BUFFER: return 1;
+	case GL_UNIFORM_BUFFER: return 2;
+	case GL_COPY_READ_BUFFER: return 3;
+	case GL_COPY_WRITE_BUFFER: return 4;
+	case GL_PIXEL_PACK_BUFFER: return 5;
+	case GL_PIXEL_UNPACK_BUFFER: return 6;
+	case GL_TEXTURE_BUFFER: return 7;
+	default: return -1;
+	}
+}
+
+void GLState::useProgram(GLuint program) {
+
+	if (changed(this->program, program))
+		glUseProgram(program);
+}
+
+void GLState::bindVertexArray(GLuint vertexArray) {
+
+	if (changed(this->vertexArray, vertexArray)) {
+		glBindVertexArray(vertexArray);
+		// the element buffer belongs to the vertex array
+		buffers[bufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+	}
+}
+
+void GLState::bindBuffer(GLenum target, GLuint buffer) {
+
+	int slot = bufferSlot(target);
+	if (slot < 0) {
+		issued++;
+		glBindBuffer(target, buffer);
+		return;
+	}
+
+	if (changed(buffers[slot], buffer))
+		glBindBuffer(target, buffer);
+}
+
+void GLState::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+
+	if (target == GL_UNIFORM_BUFFER && index < MAX_UNIFORM_BINDINGS) {
+		UniformBinding &binding = uniformBindings[index];
+		if (binding.buffer == buffer && binding.offset == offset && binding.size == size) {
+			skipped++;
+			return;
+		}
+		binding.buffer = buffer;
+		binding.offset = offset;
+		binding.size = size;
+	}
+
+	issued++;
+	glBindBufferRange(target, index, buffer, offset, size);
+
+	// also binds the generic target
+	int slot = bufferSlot(target);
+	if (slot >= 0)
+		buffers[slot] = buffer;
+}
+
+void GLState::activeTexture(GLuint unit) {
+
+	if (changed(activeUnit, unit))
+		glActiveTexture(GL_TEXTURE0 + unit);
+}
+
+void GLState::bindTexture(GLuint unit, GLenum target, GLuint texture) {
+
+	if (unit >= MAX_TEXTURE_UNITS) {
+		activeTexture(unit);
+		issued++;
+		glBindTexture(target, texture);
+		return;
+	}
+
+	if (textureTargets[unit] == target && textures[unit] == texture) {
+		skipped++;
+		return;
+	}
+
+	activeTexture(unit);
+	textureTargets[unit] = target;
+	textures[unit] = texture;
+	issued++;
+	glBindTexture(target, texture);
+}
+
+void GLState::bindFramebuffer(GLenum target, GLuint framebuffer) {
+
+	bool draw = target != GL_READ_FRAMEBUFFER && drawFramebuffer != framebuffer;
+	bool read = target != GL_DRAW_FRAMEBUFFER && readFramebuffer != framebuffer;
+
+	if (!draw && !read) {
+		skipped++;
+		return;
+	}
+
+	if (target != GL_READ_FRAMEBUFFER)
+		drawFramebuffer = framebuffer;
+	if (target != GL_DRAW_FRAMEBUFFER)
+		readFramebuffer = framebuffer;
+
+	issued++;
+	glBindFramebuffer(target, framebuffer);
+}
+
+void GLState::bindRenderbuffer(GLuint renderbuffer) {
+
+	if (changed(this->renderbuffer, renderbuffer))
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+}
+
+void GLState::deleteBuffer(GLuint buffer) {
+
+	for (int i = 0; i < BUFFER_TARGETS; i++)
+		if (buffers[i] == buffer)
+			buffers[i] = 0;
+
+	for (int i = 0; i < MAX_UNIFORM_BINDINGS; i++)
+		if (uniformBindings[i].buffer == buffer)
+			uniformBindings[i].buffer = UNKNOWN;
+
+	glDeleteBuffers(1, &buffer);
+}
+
+void GLState::enable(GLenum capability) {
+
+	auto iter = capabilities.find(capability);
+	if (iter != capabilities.end() && iter->second) {
+		skipped++;
+		return;
+	}
+
+	capabilities[capability] = true;
+	issued++;
+	glEnable(capability);
+}
+
+void GLState::disable(GLenum capability) {
+
+	auto iter = capabilities.find(capability);
+	if (iter != capabilities.end() && !iter->second) {
+		skipped++;
+		return;
+	}
+
+	capabilities[capability] = false;
+	issued++;
+	glDisable(capability);
+}
+
+void GLState::blendFunc(GLenum source, GLenum destination) {
+
+	if (blendSource == source && blendDestination == destination) {
+		skipped++;
+		return;
+	}
+
+	blendSource = source;
+	blendDestination = destination;
+	issued++;
+	glBlendFunc(source, destination);
+}
+
+void GLState::depthFunc(GLenum function) {
+
+	if (changed(depthFunction, function))
+		glDepthFunc(function);
+}
+
+void GLState::depthMask(GLboolean mask) {
+
+	if (changed(depthWrite, mask))
+		glDepthMask(mask);
+}
+
+void GLState::invalidate() {
+
+	program = vertexArray = activeUnit = UNKNOWN;
+	drawFramebuffer = readFramebuffer = renderbuffer = UNKNOWN;
+	blendSource = blendDestination = depthFunction = UNKNOWN;
+	depthWrite = UNKNOWN;
+
+	for (int i = 0; i < BUFFER_TARGETS; i++)
+		buffers[i] = UNKNOWN;
+
+	for (int i = 0; i < MAX_UNIFORM_BINDINGS; i++)
+	{
+		uniformBindings[i].buffer = UNKNOWN;
+		uniformBindings[i].offset = 0;
+		uniformBindings[i].size = 0;
+	}
+
+	for (int i = 0; i < MAX_TEXTURE_UNITS; i++)
+	{
+		textureTargets[i] = UNKNOWN;
+		textures[i] = UNKNOWN;
+	}
+
+	capabilities.clear();
+}
+
+void GLState::endFrame() {
+
+	lastIssued = issued;
+	lastSkipped = skipped;
+	issued = skipped = 0;
+}
+
+unsigned int GLState::getIssuedCalls() const {
+	return lastIssued;
+}
+
+unsigned int GLState::getSkippedCalls() const {
+	return lastSkipped;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <map>
+#include <glad\glad.h>
+
+using namespace std;
+
+// Shadow copy of the GL bindings and switches the renderer touches. Every bind goes through it and the ones
+// that would not change anything are skipped. Code that changes state behind its back must call invalidate().
+class GLState
+{
+public:
+
+	static const int MAX_TEXTURE_UNITS = 16;
+	static const int MAX_UNIFORM_BINDINGS = 16;
+
+	static GLState& getGLState();
+	static void destroyGLState();
+
+	void useProgram(GLuint program);
+	void bindVertexArray(GLuint vertexArray);
+	void bindBuffer(GLenum target, GLuint buffer);
+	void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+	void bindTexture(GLuint unit, GLenum target, GLuint texture);
+	void bindFramebuffer(GLenum target, GLuint framebuffer);
+	void bindRenderbuffer(GLuint renderbuffer);
+
+	// Deleting a bound buffer unbinds it, the name may come back from the next glGenBuffers
+	void deleteBuffer(GLuint buffer);
+
+	void enable(GLenum capability);
+	void disable(GLenum capability);
+	void blendFunc(GLenum source, GLenum destination);
+	void depthFunc(GLenum function);
+	void depthMask(GLboolean mask);
+
+	void invalidate();
+
+	// Closes the frame's counters
+	void endFrame();
+	unsigned int getIssuedCalls() const;
+	unsigned int getSkippedCalls() const;
+
+private:
+
+	static GLState *glState;
+
+	static const GLuint UNKNOWN = 0xFFFFFFFF;
+	static const int BUFFER_TARGETS = 8;
+
+	struct UniformBinding {
+		GLuint buffer;
+		GLintptr offset;
+		GLsizeiptr size;
+	};
+
+	GLuint program, vertexArray, activeUnit;
+	GLuint buffers[BUFFER_TARGETS];
+	UniformBinding uniformBindings[MAX_UNIFORM_BINDINGS];
+	GLenum textureTargets[MAX_TEXTURE_UNITS];
+	GLuint textures[MAX_TEXTURE_UNITS];
+	GLuint drawFramebuffer, readFramebuffer, renderbuffer;
+	map<GLenum, bool> capabilities;
+	GLenum blendSource, blendDestination, depthFunction;
+	GLuint depthWrite;
+
+	unsigned int issued, skipped;
+	unsigned int lastIssued, lastSkipped;
+
+	GLState();
+
+	bool changed(GLuint &cached, GLuint value);
+	int bufferSlot(GLenum target) const;
+	void activeTexture(GLuint unit);
+};
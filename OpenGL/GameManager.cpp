@@ -1,4 +1,5 @@
 #include "GameManager.h"
+#include "GLState.h"
 
 GameManager* GameManager::gameManager = nullptr;
 
@@ -15,6 +16,7 @@ GameManager::~GameManager()
 {
 	glfwTerminate();
 	RenderSystem::destroyRenderSystem();
+	ThreadPool::destroyThreadPool();
 }
 
 GameManager& GameManager::getGameManager() {
@@ -35,10 +37,11 @@ GameManager& GameManager::getGameManager() {
 			std::cout << "Failed to initialize GLAD" << std::endl;
 		}
 
-		glEnable(GL_MULTISAMPLE);
-		glEnable(GL_DEPTH_TEST);
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		GLState &state = GLState::getGLState();
+		state.enable(GL_MULTISAMPLE);
+		state.enable(GL_DEPTH_TEST);
+		state.enable(GL_BLEND);
+		state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 
 		gameManager = new GameManager();
@@ -68,7 +71,7 @@ void GameManager::runGameLoop() {
 
 		processInput(_window);
 
-		_renderSystem->render();
+		_renderSystem->render(deltaTime);
 	}
 }
 
@@ -0,0 +1,86 @@
+#include "GpuTimer.h"
+
+GpuTimer::GpuTimer() : open(false), next(0), total(0.0), samples(0)
+{
+	glGenQueries(QUERIES * MAX_STRETCHES, &starts[0][0]);
+	glGenQueries(QUERIES * MAX_STRETCHES, &ends[0][0]);
+	for (int i = 0; i < QUERIES; i++)
+	{
+		stretches[i] = 0;
+		pending[i] = false;
+	}
+}
+
+GpuTimer::~GpuTimer()
+{
+	glDeleteQueries(QUERIES * MAX_STRETCHES, &starts[0][0]);
+	glDeleteQueries(QUERIES * MAX_STRETCHES, &ends[0][0]);
+}
+
+void GpuTimer::begin() {
+
+	if (!open) {
+		collect();
+
+		// all the queries still in flight, the oldest result is dropped rather than waited for
+		pending[next] = false;
+		stretches[next] = 0;
+		open = true;
+	}
+
+	// stretches past the last one of a frame are not timed
+	if (stretches[next] < MAX_STRETCHES)
+		glQueryCounter(starts[next][stretches[next]], GL_TIMESTAMP);
+}
+
+void GpuTimer::end() {
+
+	if (stretches[next] < MAX_STRETCHES)
+		glQueryCounter(ends[next][stretches[next]++], GL_TIMESTAMP);
+}
+
+void GpuTimer::endFrame() {
+
+	if (!open)
+		return;
+
+	open = false;
+	pending[next] = stretches[next] > 0;
+	next = (next + 1) % QUERIES;
+}
+
+float GpuTimer::takeAverage() {
+
+	collect();
+
+	float average = samples ? (float)(total / samples) : 0.0f;
+	total = 0.0;
+	samples = 0;
+	return average;
+}
+
+// Results come back in order, the first frame not available stops the scan
+void GpuTimer::collect() {
+
+	for (int n = 0; n < QUERIES; n++)
+	{
+		int i = (next + n) % QUERIES;
+		if (!pending[i])
+			continue;
+
+		GLint available = 0;
+		glGetQueryObjectiv(ends[i][stretches[i] - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			return;
+
+		for (int s = 0; s < stretches[i]; s++)
+		{
+			GLuint64 start = 0, end = 0;
+			glGetQueryObjectui64v(starts[i][s], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(ends[i][s], GL_QUERY_RESULT, &end);
+			total += (end - start) / 1000000.0;
+		}
+		samples++;
+		pending[i] = false;
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <glad\glad.h>
+
+using namespace std;
+
+// GPU timestamps taken around stretches of GL commands. Every stretch timed between two endFrame() calls is added
+// into that frame's time, so the CPU work between them (culling, streaming) is left out. The results are read a
+// few frames late, once the GPU has them, so measuring never stalls the pipeline. A timer has one stretch open
+// at a time, begin() must be matched by end() before the next begin(). Separate timers may overlap.
+class GpuTimer
+{
+public:
+
+	static const int QUERIES = 4;
+	static const int MAX_STRETCHES = 8;
+
+	GpuTimer();
+	~GpuTimer();
+
+	void begin();
+	void end();
+	void endFrame();
+
+	// Average frame time in milliseconds of the results read since the last call, 0 when there were none
+	float takeAverage();
+
+private:
+
+	unsigned int starts[QUERIES][MAX_STRETCHES], ends[QUERIES][MAX_STRETCHES];
+	int stretches[QUERIES];
+	bool pending[QUERIES], open;
+	int next;
+
+	double total;
+	unsigned int samples;
+
+	void collect();
+};
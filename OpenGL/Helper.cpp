@@ -46,3 +46,56 @@ glm::mat4 getBoxModelMatrix(btRigidBody* box)
 
 	return ret;
 }
+
+glm::mat4 getConvexModelMatrix(btRigidBody* body)
+{
+	btVector3 scaling = body->getCollisionShape()->getLocalScaling();
+	const btTransform &t = ((btDefaultMotionState*)body->getMotionState())->m_graphicsWorldTrans;
+	
+	float mat[16];
+	glm::mat4 ret(1.0);
+
+	t.getOpenGLMatrix(mat);
+	ret = glm::scale(ret, glm::vec3(scaling.x(), scaling.y(), scaling.z()));
+	ret = glm::make_mat4(mat) * ret;
+
+	return ret;
+}
+
+uint64_t hashFile(const std::string& path)
+{
+	// 64-bit FNV-1a over the raw file bytes, 0 when the file can't be read
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return 0;
+
+	uint64_t hash = 14695981039346656037ULL;
+	char buffer[4096];
+
+	while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+	{
+		std::streamsize count = file.gcount();
+		for (std::streamsize i = 0; i < count; i++)
+		{
+			hash ^= (unsigned char)buffer[i];
+			hash *= 1099511628211ULL;
+		}
+	}
+
+	return hash;
+}
+
+float halton(unsigned int index, unsigned int base)
+{
+	// radical inverse: the digits of index in base mirrored around the point
+	float result = 0.0f;
+	float fraction = 1.0f / base;
+	while (index > 0)
+	{
+		result += (index % base) * fraction;
+		index /= base;
+		fraction /= base;
+	}
+
+	return result;
+}
@@ -9,8 +9,18 @@
 #include <glm/gtc/matrix_inverse.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdint>
 #include <btBulletDynamicsCommon.h>
 
 glm::mat4 getSphereModelMatrix(btRigidBody* sphere);
 glm::mat4 getPlaneModelMatrix(btRigidBody* plane);
 glm::mat4 getBoxModelMatrix(btRigidBody* box);
+// bodies of BulletWorld::addConvexMesh: the model's origin is kept by the motion state, its scale is the shape's local scaling
+glm::mat4 getConvexModelMatrix(btRigidBody* body);
+
+uint64_t hashFile(const std::string& path);
+
+// index-th element (from 1) of the Halton sequence in base, in [0, 1)
+float halton(unsigned int index, unsigned int base);
@@ -0,0 +1,100 @@
+#include "InstanceFormat.h"
+#include "GLState.h"
+
+#include <cmath>
+
+InstanceFormat chooseInstanceFormat(bool rotated, bool uniformScale) {
+
+	if (!uniformScale)
+		return INSTANCE_MATRIX;
+
+	return rotated ? INSTANCE_POSITION_SCALE_ROTATION : INSTANCE_POSITION_SCALE;
+}
+
+size_t getInstanceStride(InstanceFormat format) {
+
+	switch (format)
+	{
+	case INSTANCE_POSITION_SCALE: return sizeof(InstancePositionScale);
+	case INSTANCE_POSITION_SCALE_ROTATION: return sizeof(InstancePositionScaleRotation);
+	default: return sizeof(glm::mat4);
+	}
+}
+
+static short quantize(float value) {
+	return (short)floor(glm::clamp(value, -1.0f, 1.0f) * 32767.0f + 0.5f);
+}
+
+void packInstance(InstanceFormat format, unsigned char *instances, size_t i, const glm::vec3 &position, float scale, const glm::vec4 &rotation) {
+
+	if (format == INSTANCE_POSITION_SCALE) {
+		InstancePositionScale &instance = ((InstancePositionScale*)instances)[i];
+		instance.position[0] = position.x;
+		instance.position[1] = position.y;
+		instance.position[2] = position.z;
+		instance.scale = scale;
+	}
+	else if (format == INSTANCE_POSITION_SCALE_ROTATION) {
+		InstancePositionScaleRotation &instance = ((InstancePositionScaleRotation*)instances)[i];
+		instance.position[0] = position.x;
+		instance.position[1] = position.y;
+		instance.position[2] = position.z;
+		instance.scale = scale;
+		instance.rotation[0] = quantize(rotation.x);
+		instance.rotation[1] = quantize(rotation.y);
+		instance.rotation[2] = quantize(rotation.z);
+		instance.rotation[3] = quantize(rotation.w);
+	}
+	else {
+		float xx = rotation.x * rotation.x, yy = rotation.y * rotation.y, zz = rotation.z * rotation.z;
+		float xy = rotation.x * rotation.y, xz = rotation.x * rotation.z, yz = rotation.y * rotation.z;
+		float wx = rotation.w * rotation.x, wy = rotation.w * rotation.y, wz = rotation.w * rotation.z;
+
+		glm::mat4 &m = ((glm::mat4*)instances)[i];
+		m[0][0] = scale * (1.0f - 2.0f * (yy + zz)); m[0][1] = scale * 2.0f * (xy + wz); m[0][2] = scale * 2.0f * (xz - wy); m[0][3] = 0.0f;
+		m[1][0] = scale * 2.0f * (xy - wz); m[1][1] = scale * (1.0f - 2.0f * (xx + zz)); m[1][2] = scale * 2.0f * (yz + wx); m[1][3] = 0.0f;
+		m[2][0] = scale * 2.0f * (xz + wy); m[2][1] = scale * 2.0f * (yz - wx); m[2][2] = scale * (1.0f - 2.0f * (xx + yy)); m[2][3] = 0.0f;
+		m[3][0] = position.x; m[3][1] = position.y; m[3][2] = position.z; m[3][3] = 1.0f;
+	}
+}
+
+void setupInstanceAttributes(unsigned int VBO, InstanceFormat format, size_t offset) {
+
+	GLsizei stride = (GLsizei)getInstanceStride(format);
+	GLState::getGLState().bindBuffer(GL_ARRAY_BUFFER, VBO);
+
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+	glVertexAttribDivisor(3, 1);
+
+	if (format == INSTANCE_MATRIX) {
+		for (unsigned int column = 1; column < 4; column++)
+		{
+			glEnableVertexAttribArray(3 + column);
+			glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, stride, (void*)(offset + column * sizeof(glm::vec4)));
+			glVertexAttribDivisor(3 + column, 1);
+		}
+		return;
+	}
+
+	if (format == INSTANCE_POSITION_SCALE_ROTATION) {
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 4, GL_SHORT, GL_TRUE, stride, (void*)(offset + 4 * sizeof(float)));
+		glVertexAttribDivisor(4, 1);
+	}
+	else {
+		glDisableVertexAttribArray(4);
+	}
+
+	glDisableVertexAttribArray(5);
+	glDisableVertexAttribArray(6);
+}
+
+void useInstanceFormat(Shader *shader, InstanceFormat format) {
+
+	shader->setBool("instanceMatrix"_u, format == INSTANCE_MATRIX);
+
+	// without a rotation array attribute 4 reads this constant, the identity quaternion
+	if (format == INSTANCE_POSITION_SCALE)
+		glVertexAttrib4f(4, 0.0f, 0.0f, 0.0f, 1.0f);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <glad\glad.h>
+#include <glm\glm.hpp>
+
+#include "Shader.h"
+
+// Per-instance layouts of the instanced draws, smallest first. They all use attribute locations 3 to 6
+// and wind.vert decodes every one of them.
+enum InstanceFormat {
+	INSTANCE_POSITION_SCALE,			// vec3 position + uniform scale, 16 bytes
+	INSTANCE_POSITION_SCALE_ROTATION,	// the same + rotation quaternion as four snorm16, 24 bytes
+	INSTANCE_MATRIX						// full mat4, 64 bytes
+};
+
+struct InstancePositionScale {
+	float position[3];
+	float scale;
+};
+
+struct InstancePositionScaleRotation {
+	float position[3];
+	float scale;
+	short rotation[4];
+};
+
+// Smallest format that can represent what a draw needs
+InstanceFormat chooseInstanceFormat(bool rotated, bool uniformScale);
+size_t getInstanceStride(InstanceFormat format);
+
+// Writes instance i of the buffer, rotation is a unit quaternion (x, y, z, w)
+void packInstance(InstanceFormat format, unsigned char *instances, size_t i, const glm::vec3 &position, float scale, const glm::vec4 &rotation);
+
+// Points attributes 3 to 6 of the bound vertex array at the instances starting offset bytes into the buffer
+void setupInstanceAttributes(unsigned int VBO, InstanceFormat format, size_t offset = 0);
+
+// Tells the (already used) shader how to decode the instances of the next draw
+void useInstanceFormat(Shader *shader, InstanceFormat format);
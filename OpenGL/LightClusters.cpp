@@ -0,0 +1,227 @@
+#include "LightClusters.h"
+
+#include <cfloat>
+#include <emmintrin.h>
+
+// attenuation where a light is cut off, its square is about 1/1000
+static const float CUTOFF_ATTENUATION = 32.0f;
+// tiles are widened by this much, the scene is drawn with a jitter of up to half a pixel
+static const float TILE_PADDING = 0.05f;
+
+LightClusters::LightClusters(float nearPlane, float farPlane) : nearPlane(nearPlane), farPlane(farPlane), pool(&ThreadPool::getThreadPool()), projectionX(1.0f), projectionY(1.0f)
+{
+	clusters.assign(GRID_X * GRID_Y * GRID_Z * 2, 0);
+	sliceIndices.resize(GRID_Z);
+	sliceClusters.resize(GRID_Z);
+	sliceRanges.resize(GRID_Z);
+}
+
+unsigned int LightClusters::addLight(glm::vec3 position, glm::vec3 ambient, glm::vec3 diffuse, glm::vec3 specular, glm::vec3 attenuation,
+	glm::vec3 boundsMin, glm::vec3 boundsMax) {
+
+	// 1 / (constant + linear d + quadratic d^2) reaches the cutoff at the positive root
+	float range = farPlane;
+	if (attenuation.z > 0.0f)
+		range = (-attenuation.y + sqrt(attenuation.y * attenuation.y - 4.0f * attenuation.z * (attenuation.x - CUTOFF_ATTENUATION))) / (2.0f * attenuation.z);
+	else if (attenuation.y > 0.0f)
+		range = (CUTOFF_ATTENUATION - attenuation.x) / attenuation.y;
+
+	ClusterLight light;
+	light.position = glm::vec4(position, range);
+	light.ambient = glm::vec4(ambient, 1.0f);
+	light.diffuse = glm::vec4(diffuse, 1.0f);
+	light.specular = glm::vec4(specular, 1.0f);
+	light.attenuation = glm::vec4(attenuation, 0.0f);
+	light.boundsMin = glm::vec4(boundsMin, 0.0f);
+	light.boundsMax = glm::vec4(boundsMax, 0.0f);
+
+	unsigned int index = (unsigned int)lights.size();
+	lights.push_back(light);
+
+	// the lanes past the last light keep an empty box
+	size_t padded = (lights.size() + 3) & ~(size_t)3;
+	minX.resize(padded, 1.0f); minY.resize(padded, 1.0f); minZ.resize(padded, 1.0f);
+	maxX.resize(padded, -1.0f); maxY.resize(padded, -1.0f); maxZ.resize(padded, -1.0f);
+	viewMinX.resize(padded); viewMinY.resize(padded); viewMaxX.resize(padded); viewMaxY.resize(padded);
+	viewNear.resize(padded); viewFar.resize(padded);
+
+	// the box the light reaches, empty when it is outside its room
+	glm::vec3 reachMin = glm::max(position - glm::vec3(range), boundsMin);
+	glm::vec3 reachMax = glm::min(position + glm::vec3(range), boundsMax);
+	minX[index] = reachMin.x; minY[index] = reachMin.y; minZ[index] = reachMin.z;
+	maxX[index] = reachMax.x; maxY[index] = reachMax.y; maxZ[index] = reachMax.z;
+
+	return index;
+}
+
+void LightClusters::assign(const glm::mat4 &view, const glm::mat4 &projection) {
+
+	projectionX = projection[0][0];
+	projectionY = projection[1][1];
+
+	boundLights(view);
+
+	pool->parallelFor(GRID_Z, 1, [this](size_t begin, size_t end) {
+		for (size_t slice = begin; slice < end; slice++)
+			fillSlice((int)slice);
+	});
+
+	// the slices one after the other
+	indices.clear();
+	const int tiles = GRID_X * GRID_Y;
+	for (int slice = 0; slice < GRID_Z; slice++)
+	{
+		unsigned int base = (unsigned int)indices.size();
+		indices.insert(indices.end(), sliceIndices[slice].begin(), sliceIndices[slice].end());
+
+		const vector<unsigned int> &local = sliceClusters[slice];
+		unsigned int *global = &clusters[slice * tiles * 2];
+		for (int tile = 0; tile < tiles; tile++)
+		{
+			global[tile * 2] = base + local[tile * 2];
+			global[tile * 2 + 1] = local[tile * 2 + 1];
+		}
+	}
+}
+
+// View space boxes of four lights at a time (Arvo): every axis of the result takes the smaller and the larger
+// of each rotated extent
+void LightClusters::boundLights(const glm::mat4 &view) {
+
+	__m128 rotation[3][3], translation[3];
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+			rotation[i][j] = _mm_set1_ps(view[j][i]);
+		translation[i] = _mm_set1_ps(view[3][i]);
+	}
+	const __m128 none = _mm_set1_ps(FLT_MAX);
+
+	for (size_t i = 0; i < minX.size(); i += 4)
+	{
+		__m128 boxMin[3] = { _mm_loadu_ps(&minX[i]), _mm_loadu_ps(&minY[i]), _mm_loadu_ps(&minZ[i]) };
+		__m128 boxMax[3] = { _mm_loadu_ps(&maxX[i]), _mm_loadu_ps(&maxY[i]), _mm_loadu_ps(&maxZ[i]) };
+
+		__m128 outMin[3], outMax[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			outMin[axis] = outMax[axis] = translation[axis];
+			for (int j = 0; j < 3; j++)
+			{
+				__m128 a = _mm_mul_ps(rotation[axis][j], boxMin[j]);
+				__m128 b = _mm_mul_ps(rotation[axis][j], boxMax[j]);
+				outMin[axis] = _mm_add_ps(outMin[axis], _mm_min_ps(a, b));
+				outMax[axis] = _mm_add_ps(outMax[axis], _mm_max_ps(a, b));
+			}
+		}
+
+		// empty boxes get a near depth past the far one and touch no slice
+		__m128 empty = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(boxMin[0], boxMax[0]), _mm_cmpgt_ps(boxMin[1], boxMax[1])), _mm_cmpgt_ps(boxMin[2], boxMax[2]));
+		__m128 nearDepth = _mm_sub_ps(_mm_setzero_ps(), outMax[2]);
+		nearDepth = _mm_or_ps(_mm_and_ps(empty, none), _mm_andnot_ps(empty, nearDepth));
+
+		_mm_storeu_ps(&viewMinX[i], outMin[0]);
+		_mm_storeu_ps(&viewMinY[i], outMin[1]);
+		_mm_storeu_ps(&viewMaxX[i], outMax[0]);
+		_mm_storeu_ps(&viewMaxY[i], outMax[1]);
+		_mm_storeu_ps(&viewNear[i], nearDepth);
+		_mm_storeu_ps(&viewFar[i], _mm_sub_ps(_mm_setzero_ps(), outMin[2]));
+	}
+}
+
+// Counts then lists the lights of every tile of the slice. A light covers the tiles its box spans on screen
+// between the slice's near and far depth, x / depth is largest at one of the two.
+void LightClusters::fillSlice(int slice) {
+
+	float sliceNear = sliceDepth(slice), sliceFar = sliceDepth(slice + 1);
+
+	vector<unsigned int> &local = sliceClusters[slice];
+	vector<unsigned short> &list = sliceIndices[slice];
+	vector<int> &ranges = sliceRanges[slice];
+	local.assign(GRID_X * GRID_Y * 2, 0);
+	list.clear();
+	ranges.clear();
+
+	for (size_t i = 0; i < lights.size(); i++)
+	{
+		if (viewNear[i] > sliceFar || viewFar[i] < sliceNear)
+			continue;
+
+		float depthNear = glm::max(viewNear[i], sliceNear), depthFar = glm::min(viewFar[i], sliceFar);
+		float left = glm::min(viewMinX[i] / depthNear, viewMinX[i] / depthFar) * projectionX;
+		float right = glm::max(viewMaxX[i] / depthNear, viewMaxX[i] / depthFar) * projectionX;
+		float bottom = glm::min(viewMinY[i] / depthNear, viewMinY[i] / depthFar) * projectionY;
+		float top = glm::max(viewMaxY[i] / depthNear, viewMaxY[i] / depthFar) * projectionY;
+		if (right < -1.0f || left > 1.0f || top < -1.0f || bottom > 1.0f)
+			continue;
+
+		int x0 = glm::clamp((int)floor((left * 0.5f + 0.5f) * GRID_X - TILE_PADDING), 0, GRID_X - 1);
+		int x1 = glm::clamp((int)floor((right * 0.5f + 0.5f) * GRID_X + TILE_PADDING), 0, GRID_X - 1);
+		int y0 = glm::clamp((int)floor((bottom * 0.5f + 0.5f) * GRID_Y - TILE_PADDING), 0, GRID_Y - 1);
+		int y1 = glm::clamp((int)floor((top * 0.5f + 0.5f) * GRID_Y + TILE_PADDING), 0, GRID_Y - 1);
+
+		ranges.push_back((int)i);
+		ranges.push_back(x0); ranges.push_back(x1);
+		ranges.push_back(y0); ranges.push_back(y1);
+
+		for (int y = y0; y <= y1; y++)
+			for (int x = x0; x <= x1; x++)
+				local[(y * GRID_X + x) * 2 + 1]++;
+	}
+
+	unsigned int offset = 0;
+	for (int tile = 0; tile < GRID_X * GRID_Y; tile++)
+	{
+		local[tile * 2] = offset;
+		offset += local[tile * 2 + 1];
+		local[tile * 2 + 1] = 0;
+	}
+
+	// the counts are rebuilt while the lists are written
+	list.resize(offset);
+	for (size_t r = 0; r < ranges.size(); r += 5)
+	{
+		for (int y = ranges[r + 3]; y <= ranges[r + 4]; y++)
+		{
+			for (int x = ranges[r + 1]; x <= ranges[r + 2]; x++)
+			{
+				unsigned int *cluster = &local[(y * GRID_X + x) * 2];
+				list[cluster[0] + cluster[1]++] = (unsigned short)ranges[r];
+			}
+		}
+	}
+}
+
+float LightClusters::sliceDepth(int slice) const {
+	return nearPlane * pow(farPlane / nearPlane, (float)slice / GRID_Z);
+}
+
+size_t LightClusters::getLightCount() const {
+	return lights.size();
+}
+
+const ClusterLight* LightClusters::getLights() const {
+	return lights.empty() ? nullptr : &lights[0];
+}
+
+const unsigned int* LightClusters::getClusters() const {
+	return &clusters[0];
+}
+
+size_t LightClusters::getClusterCount() const {
+	return GRID_X * GRID_Y * GRID_Z;
+}
+
+const unsigned short* LightClusters::getIndices() const {
+	return indices.empty() ? nullptr : &indices[0];
+}
+
+size_t LightClusters::getIndexCount() const {
+	return indices.size();
+}
+
+glm::vec2 LightClusters::getDepthSlicing() const {
+
+	float scale = GRID_Z / log(farPlane / nearPlane);
+	return glm::vec2(scale, -log(nearPlane) * scale);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <glm\glm.hpp>
+
+#include "ThreadPool.h"
+
+using namespace std;
+
+// One point light as LightShader.frag reads it from its buffer texture, LIGHT_TEXELS rgba32f texels
+struct ClusterLight {
+	glm::vec4 position;		// range in w
+	glm::vec4 ambient;
+	glm::vec4 diffuse;
+	glm::vec4 specular;
+	glm::vec4 attenuation;	// constant, linear, quadratic
+	glm::vec4 boundsMin;
+	glm::vec4 boundsMax;
+};
+
+// Point lights sorted into a view space grid of GRID_X x GRID_Y screen tiles and GRID_Z depth slices, spaced
+// exponentially from nearPlane to farPlane. Every frame the lights are bounded in view space four at a time,
+// then the depth slices are filled in parallel; a fragment only loops over the lights of its own cluster.
+// No GL calls, RenderSystem uploads the results.
+class LightClusters
+{
+public:
+
+	static const int GRID_X = 16;
+	static const int GRID_Y = 9;
+	static const int GRID_Z = 24;
+	static const int LIGHT_TEXELS = sizeof(ClusterLight) / sizeof(glm::vec4);
+
+	LightClusters(float nearPlane = 0.1f, float farPlane = 100.0f);
+
+	// The light stops at the edges of boundsMin/boundsMax (its room) and fades out where the attenuation squared
+	// drops under 1/1000. Returns the light index.
+	unsigned int addLight(glm::vec3 position, glm::vec3 ambient, glm::vec3 diffuse, glm::vec3 specular, glm::vec3 attenuation,
+		glm::vec3 boundsMin, glm::vec3 boundsMax);
+
+	// Clusters seen through the unjittered view and projection
+	void assign(const glm::mat4 &view, const glm::mat4 &projection);
+
+	size_t getLightCount() const;
+	const ClusterLight* getLights() const;
+
+	// Offset into the indices and light count of every cluster, x fastest, then y, then z
+	const unsigned int* getClusters() const;
+	size_t getClusterCount() const;
+	const unsigned short* getIndices() const;
+	size_t getIndexCount() const;
+
+	// The slice of a view depth is log(depth) * x + y
+	glm::vec2 getDepthSlicing() const;
+
+private:
+
+	float nearPlane, farPlane;
+	ThreadPool *pool;
+
+	vector<ClusterLight> lights;
+	// light bounds clipped to their room, padded to a multiple of four lights
+	vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+	// view space bounds of this frame, depth positive forward, near > far when the light is out of view
+	vector<float> viewMinX, viewMinY, viewMaxX, viewMaxY, viewNear, viewFar;
+
+	float projectionX, projectionY;
+	vector<unsigned int> clusters;
+	vector<unsigned short> indices;
+	// per slice: its light indices, the offset (inside the slice) and count of its clusters, and the tile ranges
+	// of the lights crossing it
+	vector<vector<unsigned short>> sliceIndices;
+	vector<vector<unsigned int>> sliceClusters;
+	vector<vector<int>> sliceRanges;
+
+	void boundLights(const glm::mat4 &view);
+	void fillSlice(int slice);
+	float sliceDepth(int slice) const;
+};
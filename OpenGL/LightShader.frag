@@ -2,8 +2,6 @@
 layout (location = 0) out vec4 FragColor;
 layout (location = 1) out vec4 BrightColor;
 
-#define NR_POINT_LIGHTS 2
-
 struct Material {
     sampler2D diffuse;
 	sampler2D specular;
@@ -20,40 +18,59 @@ struct DirectionalLight {
     vec3 specular;
 };  
 
+// ClusterLight in LightClusters.h
 struct PointLight {    
-    vec3 position;
-    
-    float constant;
-    float linear;
-    float quadratic;  
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
+    vec4 position; // range in w
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+    vec4 attenuation; // constant, linear, quadratic
+    vec4 boundsMin;
+    vec4 boundsMax;
 };
 
 in vec3 Normal;
 in vec3 FragPos;
 in vec2 TexCoords;
 
-uniform vec3 viewPos;
+layout (std140) uniform FrameData {
+    mat4 projectionMatrix;
+    mat4 viewMatrix;
+    vec4 cameraPosition;
+    float time;
+};
+
+// the lights of every cluster (offset and count into lightIndices) and the lights themselves, see LightClusters.h
+uniform usamplerBuffer clusterLights;
+uniform usamplerBuffer lightIndices;
+uniform samplerBuffer lightData;
+uniform vec3 clusterGrid;
+// tiles per pixel, and the slice of a view depth as log(depth) * x + y
+uniform vec2 clusterScale;
+uniform vec2 clusterDepth;
+
 uniform Material material;
 uniform DirectionalLight dirLight;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
 uniform sampler2D diffuseTexture;
 
 vec3 CalcDirectionalLight(DirectionalLight light, vec3 normal, vec3 viewDir);
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+int ClusterIndex(vec3 fragPos);
+PointLight FetchLight(int index);
 
 void main() {
 
 	vec3 norm = normalize(Normal);
-	vec3 viewDir = normalize(viewPos - FragPos);
+	vec3 viewDir = normalize(cameraPosition.xyz - FragPos);
 
 	//vec3 result = CalcDirectionalLight(dirLight, norm, viewDir);
 	vec3 result = vec3(0,0,0);
-	for(int i=0; i<NR_POINT_LIGHTS; i++) {
-		result += CalcPointLight(pointLights[i], norm, FragPos, viewDir); 
+	uvec2 lights = texelFetch(clusterLights, ClusterIndex(FragPos)).xy;
+	for(uint i=0u; i<lights.y; i++) {
+		PointLight light = FetchLight(int(texelFetch(lightIndices, int(lights.x + i)).r));
+		// a light stays in its room
+		if (all(greaterThanEqual(FragPos, light.boundsMin.xyz)) && all(lessThanEqual(FragPos, light.boundsMax.xyz)))
+			result += CalcPointLight(light, norm, FragPos, viewDir); 
 	}
 
 	//Emission Light
@@ -88,23 +105,41 @@ vec3 CalcDirectionalLight(DirectionalLight light, vec3 normal, vec3 viewDir) {
 
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir) {
 
-    vec3 lightDir = normalize(light.position - fragPos);
+    vec3 lightDir = normalize(light.position.xyz - fragPos);
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     // attenuation
-    float distance    = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
+    float distance    = length(light.position.xyz - fragPos);
+    float attenuation = 1.0 / (light.attenuation.x + light.attenuation.y * distance + light.attenuation.z * (distance * distance));    
+    // faded out to nothing at the range the light was clustered with
+    attenuation *= clamp(1.0 - pow(distance / light.position.w, 4.0), 0.0, 1.0);
     // combine results
-    vec3 ambient  = light.ambient  * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse  = light.diffuse  * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient  = light.ambient.rgb  * vec3(texture(material.diffuse, TexCoords));
+    vec3 diffuse  = light.diffuse.rgb  * diff * vec3(texture(material.diffuse, TexCoords));
+    vec3 specular = light.specular.rgb * spec * vec3(texture(material.specular, TexCoords));
 	
 	ambient  *= texture(diffuseTexture, TexCoords).rgb * attenuation*attenuation;
     diffuse  *= texture(diffuseTexture, TexCoords).rgb * attenuation*attenuation;
     specular *= texture(diffuseTexture, TexCoords).rgb * attenuation*attenuation;
 
     return (ambient + diffuse + specular);
-}
\ No newline at end of file
+}
+
+int ClusterIndex(vec3 fragPos) {
+
+    float depth = -(viewMatrix * vec4(fragPos, 1.0)).z;
+    ivec3 cluster = ivec3(ivec2(gl_FragCoord.xy * clusterScale), int(log(depth) * clusterDepth.x + clusterDepth.y));
+    cluster = clamp(cluster, ivec3(0), ivec3(clusterGrid) - 1);
+
+    return (cluster.z * int(clusterGrid.y) + cluster.y) * int(clusterGrid.x) + cluster.x;
+}
+
+PointLight FetchLight(int index) {
+
+    int texel = index * 7;
+    return PointLight(texelFetch(lightData, texel), texelFetch(lightData, texel + 1), texelFetch(lightData, texel + 2), texelFetch(lightData, texel + 3),
+        texelFetch(lightData, texel + 4), texelFetch(lightData, texel + 5), texelFetch(lightData, texel + 6));
+}
@@ -4,21 +4,48 @@ layout (location = 0) in vec3 aPositionVertex;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
+// instanced draws: a mat4 in 3-6, or position + scale in 3 and a rotation quaternion in 4 (see InstanceFormat.h)
+layout (location = 3) in vec4 aInstance0;
+layout (location = 4) in vec4 aInstance1;
+layout (location = 5) in vec4 aInstance2;
+layout (location = 6) in vec4 aInstance3;
 
 uniform mat4 modelMatrix;
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
+layout (std140) uniform FrameData {
+	mat4 projectionMatrix;
+	mat4 viewMatrix;
+	vec4 cameraPosition;
+	float time;
+};
+uniform bool instanced;
+uniform bool instanceMatrix;
 
 
 out vec3 Normal;
 out vec3 FragPos;
 out vec2 TexCoords;
 
+// the motion pass draws the bodies again over their own depth, see motion.vert
+invariant gl_Position;
+
+vec3 rotate(vec4 q, vec3 v)
+{
+	return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
 void main()
 {
-	Normal = normalize(mat3(transpose(inverse(modelMatrix))) * aNormal);  
-	FragPos = vec3(modelMatrix * vec4(aPositionVertex, 1.0));
+	if (instanced && !instanceMatrix) {
+		vec4 rotation = normalize(aInstance1);
+		Normal = rotate(rotation, aNormal);
+		FragPos = aInstance0.xyz + rotate(rotation, aPositionVertex * aInstance0.w);
+	}
+	else {
+		mat4 model = instanced ? mat4(aInstance0, aInstance1, aInstance2, aInstance3) : modelMatrix;
+		Normal = normalize(mat3(transpose(inverse(model))) * aNormal);  
+		FragPos = vec3(model * vec4(aPositionVertex, 1.0));
+	}
 	TexCoords = aTexCoords;
 
 	gl_Position = projectionMatrix * viewMatrix * vec4(FragPos, 1.0);
-} 
\ No newline at end of file
+} 
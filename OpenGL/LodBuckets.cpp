@@ -0,0 +1,214 @@
+#include "LodBuckets.h"
+
+#include <cfloat>
+#include <emmintrin.h>
+
+static const size_t MAX_LIMITS = 8;
+
+LodBuckets::LodBuckets() : radius(0.0f)
+{
+	first.push_back(0);
+	counts.push_back(0);
+}
+
+// Level l shows its vertices at most error(l) * projected radius / radius pixels off
+void LodBuckets::setModel(Model *model, float maxErrorPixels, float pointRadius) {
+
+	radius = model->getRadius();
+	limits.clear();
+
+	float previous = FLT_MAX;
+	for (int l = 1; l < model->getLodCount() && l < (int)MAX_LIMITS; l++)
+	{
+		float limit = glm::min(previous, maxErrorPixels * radius / model->getLodError(l));
+		limits.push_back(limit);
+		previous = limit;
+	}
+	limits.push_back(glm::min(previous, pointRadius));
+
+	first.assign(limits.size() + 1, 0);
+	counts.assign(limits.size() + 1, 0);
+}
+
+void LodBuckets::sort(const float *x, const float *y, const float *z, const float *scales, float scale, size_t count, const glm::vec3 &eye, float pixelsPerUnit) {
+
+	size_t padded = (count + 3) & ~(size_t)3;
+	buckets.resize(padded);
+	order.resize(count);
+
+	// the projected radius radius * scale * pixelsPerUnit / distance is below a limit when
+	// (radius * scale * pixelsPerUnit)^2 < limit^2 * distance^2, no square root or division needed
+	const __m128 eyeX = _mm_set1_ps(eye.x), eyeY = _mm_set1_ps(eye.y), eyeZ = _mm_set1_ps(eye.z);
+	const __m128 size = _mm_set1_ps(radius * pixelsPerUnit);
+	const __m128i one = _mm_set1_epi32(1);
+
+	__m128 squaredLimits[MAX_LIMITS];
+	size_t limitCount = limits.size();
+	for (size_t l = 0; l < limitCount; l++)
+		squaredLimits[l] = _mm_set1_ps(limits[l] * limits[l]);
+
+	for (size_t i = 0; i < padded; i += 4)
+	{
+		__m128 px, py, pz, s;
+		if (i + 4 <= count) {
+			px = _mm_loadu_ps(x + i); py = _mm_loadu_ps(y + i); pz = _mm_loadu_ps(z + i);
+			s = scales ? _mm_loadu_ps(scales + i) : _mm_set1_ps(scale);
+		}
+		else {
+			// the last partial group reads its lanes one by one, the extra lanes are dropped below
+			float lanes[4][4] = {};
+			for (size_t lane = 0; i + lane < count; lane++)
+			{
+				lanes[0][lane] = x[i + lane]; lanes[1][lane] = y[i + lane]; lanes[2][lane] = z[i + lane];
+				lanes[3][lane] = scales ? scales[i + lane] : scale;
+			}
+			px = _mm_loadu_ps(lanes[0]); py = _mm_loadu_ps(lanes[1]); pz = _mm_loadu_ps(lanes[2]); s = _mm_loadu_ps(lanes[3]);
+		}
+
+		__m128 dx = _mm_sub_ps(px, eyeX), dy = _mm_sub_ps(py, eyeY), dz = _mm_sub_ps(pz, eyeZ);
+		__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		__m128 projected = _mm_mul_ps(s, size);
+		projected = _mm_mul_ps(projected, projected);
+
+		// every limit passed moves the instance one bucket further
+		__m128i bucket = _mm_setzero_si128();
+		for (size_t l = 0; l < limitCount; l++)
+			bucket = _mm_add_epi32(bucket, _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(projected, _mm_mul_ps(squaredLimits[l], distance))), one));
+
+		int lanes[4];
+		_mm_storeu_si128((__m128i*)lanes, bucket);
+		buckets[i] = (unsigned char)lanes[0]; buckets[i + 1] = (unsigned char)lanes[1];
+		buckets[i + 2] = (unsigned char)lanes[2]; buckets[i + 3] = (unsigned char)lanes[3];
+	}
+
+	// counting sort, instances keep their relative order inside a bucket
+	counts.assign(limits.size() + 1, 0);
+	for (size_t i = 0; i < count; i++)
+		counts[buckets[i]]++;
+
+	size_t offset = 0;
+	for (size_t b = 0; b < counts.size(); b++)
+	{
+		first[b] = offset;
+		offset += counts[b];
+	}
+
+	vector<size_t> next(first);
+	for (size_t i = 0; i < count; i++)
+		order[next[buckets[i]]++] = (unsigned int)i;
+
+	runs.clear();
+	for (size_t b = 0; b < counts.size(); b++)
+	{
+		if (counts[b] > 0)
+			runs.push_back(Run{ (unsigned int)b, first[b], counts[b] });
+	}
+}
+
+// Distance along one axis, in box fractions, from e to the interval lo-hi wrapped around the box
+static float wrappedDistance(float e, float lo, float hi) {
+
+	if (hi - lo >= 1.0f)
+		return glm::max(glm::max(-e, e - 1.0f), 0.0f);
+
+	float shift = floor(lo);
+	lo -= shift;
+	hi -= shift;
+	float distance = glm::max(glm::max(lo - e, e - glm::min(hi, 1.0f)), 0.0f);
+	if (hi > 1.0f)
+		distance = glm::min(distance, glm::max(glm::max(-e, e - (hi - 1.0f)), 0.0f));
+
+	return distance;
+}
+
+void LodBuckets::sortVolume(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const glm::vec3 &shift, const glm::vec3 &drift, float scale, size_t count,
+	const glm::vec3 &eye, float pixelsPerUnit) {
+
+	glm::vec3 size = boundsMax - boundsMin;
+	glm::vec3 e = (eye - boundsMin) / size;
+	float projected = radius * scale * pixelsPerUnit;
+
+	// the nearest point of a cell is separable, one wrapped interval per axis
+	float distances[3][VOLUME_CELLS];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (int c = 0; c < VOLUME_CELLS; c++)
+		{
+			float lo = (float)c / VOLUME_CELLS + shift[axis] - drift[axis];
+			float hi = (float)(c + 1) / VOLUME_CELLS + shift[axis] + drift[axis];
+			distances[axis][c] = wrappedDistance(e[axis], lo, hi) * size[axis];
+		}
+	}
+
+	first.assign(limits.size() + 1, 0);
+	counts.assign(limits.size() + 1, 0);
+	runs.clear();
+
+	size_t cells = VOLUME_CELLS * VOLUME_CELLS * VOLUME_CELLS;
+	for (size_t cell = 0; cell < cells; cell++)
+	{
+		int x = cell % VOLUME_CELLS, y = (cell / VOLUME_CELLS) % VOLUME_CELLS, z = (int)(cell / (VOLUME_CELLS * VOLUME_CELLS));
+		float distance = sqrt(distances[0][x] * distances[0][x] + distances[1][y] * distances[1][y] + distances[2][z] * distances[2][z]);
+		unsigned int bucket = bucketOf(projected, distance);
+
+		size_t cellFirst = getVolumeCellFirst(cell, count);
+		size_t cellSize = getVolumeCellFirst(cell + 1, count) - cellFirst;
+		if (cellSize == 0)
+			continue;
+
+		// neighbouring cells of one bucket are drawn together
+		if (!runs.empty() && runs.back().bucket == bucket)
+			runs.back().size += cellSize;
+		else
+			runs.push_back(Run{ bucket, cellFirst, cellSize });
+		counts[bucket] += cellSize;
+	}
+}
+
+size_t LodBuckets::getVolumeCellFirst(size_t cell, size_t count) {
+
+	size_t cells = VOLUME_CELLS * VOLUME_CELLS * VOLUME_CELLS;
+	return (cell * count + cells - 1) / cells;
+}
+
+// an instance at distance 0, the eye inside it, keeps the first level
+unsigned int LodBuckets::bucketOf(float projected, float distance) const {
+
+	unsigned int bucket = 0;
+	while (bucket < limits.size() && projected < limits[bucket] * distance)
+		bucket++;
+
+	return bucket;
+}
+
+unsigned int LodBuckets::getBucketCount() const {
+	return (unsigned int)counts.size();
+}
+
+size_t LodBuckets::getFirst(unsigned int bucket) const {
+	return first[bucket];
+}
+
+size_t LodBuckets::getCount(unsigned int bucket) const {
+	return counts[bucket];
+}
+
+const unsigned int* LodBuckets::getOrder() const {
+	return order.empty() ? nullptr : &order[0];
+}
+
+size_t LodBuckets::getRunCount() const {
+	return runs.size();
+}
+
+unsigned int LodBuckets::getRunBucket(size_t run) const {
+	return runs[run].bucket;
+}
+
+size_t LodBuckets::getRunFirst(size_t run) const {
+	return runs[run].first;
+}
+
+size_t LodBuckets::getRunSize(size_t run) const {
+	return runs[run].size;
+}
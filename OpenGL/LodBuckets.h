@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <glm\glm.hpp>
+
+#include "Model.h"
+
+using namespace std;
+
+// Sorts the instances of a model into its levels of detail by the radius they cover on screen. A level is used
+// once its error shrinks below maxErrorPixels, and instances smaller than pointRadius pixels go into one more
+// bucket after the last level, drawn as points.
+class LodBuckets
+{
+public:
+
+	// cells along each axis of a stateless volume, see sortVolume
+	static const int VOLUME_CELLS = 4;
+
+	LodBuckets();
+
+	void setModel(Model *model, float maxErrorPixels = 1.0f, float pointRadius = 0.75f);
+
+	// pixelsPerUnit is the size in pixels of one world unit seen from one unit away. scales may be null when
+	// every instance has the same scale.
+	void sort(const float *x, const float *y, const float *z, const float *scales, float scale, size_t count, const glm::vec3 &eye, float pixelsPerUnit);
+	// For instances the CPU does not follow, seeded cell by cell in VOLUME_CELLS^3 cells of the box (see
+	// getVolumeCellFirst). Every cell is put in the bucket of an instance of the given scale at the point of the
+	// cell nearest to eye. The cells have moved by shift (a fraction of the box, wrapping around) and spread by
+	// drift on each side. Only the runs are filled.
+	void sortVolume(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const glm::vec3 &shift, const glm::vec3 &drift, float scale, size_t count,
+		const glm::vec3 &eye, float pixelsPerUnit);
+	// First of the count instances seeded in the cell, cells are numbered x first
+	static size_t getVolumeCellFirst(size_t cell, size_t count);
+
+	// Model levels then the points
+	unsigned int getBucketCount() const;
+	size_t getFirst(unsigned int bucket) const;
+	size_t getCount(unsigned int bucket) const;
+	// Instance indices grouped by bucket
+	const unsigned int* getOrder() const;
+
+	// Consecutive instances of one bucket, each is one draw
+	size_t getRunCount() const;
+	unsigned int getRunBucket(size_t run) const;
+	size_t getRunFirst(size_t run) const;
+	size_t getRunSize(size_t run) const;
+
+private:
+
+	float radius;
+	// smallest projected radius each bucket after the first is used below, decreasing
+	vector<float> limits;
+
+	vector<unsigned char> buckets;
+	vector<unsigned int> order;
+	vector<size_t> first, counts;
+
+	struct Run {
+		unsigned int bucket;
+		size_t first, size;
+	};
+	vector<Run> runs;
+
+	unsigned int bucketOf(float projected, float distance) const;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+using namespace std;
+
+// Copy-on-write memory mapping of a whole file: pages are shared with the OS file cache
+// until written, which lets serialized data be fixed up in place without touching the file.
+class MappedFile
+{
+public:
+
+	MappedFile(const string& path);
+	~MappedFile();
+
+	bool isOpen() const;
+	unsigned char* getData();
+	size_t getSize() const;
+
+private:
+
+	unsigned char *data;
+	size_t size;
+
+#ifdef _WIN32
+	void *fileHandle;
+	void *mappingHandle;
+#else
+	int fileDescriptor;
+#endif
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
@@ -1,4 +1,5 @@
 #include "Mesh.h"
+#include "GLState.h"
 
 Mesh::Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures): vertices(vertices), indices(indices),textures(textures)
 {
@@ -8,16 +9,39 @@ Mesh::Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture
 Mesh::~Mesh() {}
 
 void Mesh::setupMesh() {
+
+	// samplers are numbered per type in the order of the textures, texture_diffuse1, texture_diffuse2, ...
+	unsigned int diffuseNr = 1;
+	unsigned int specularNr = 1;
+	unsigned int normalNr = 1;
+	unsigned int heightNr = 1;
+	for (unsigned int i = 0; i < textures.size(); i++)
+	{
+		string number;
+		string name = textures[i].type;
+		if (name == "texture_diffuse")
+			number = std::to_string(diffuseNr++);
+		else if (name == "texture_specular")
+			number = std::to_string(specularNr++);
+		else if (name == "texture_normal")
+			number = std::to_string(normalNr++); 
+		else if (name == "texture_height")
+			number = std::to_string(heightNr++);
+
+		samplers.push_back(UniformHash(hashUniformName((name + number).c_str())));
+	}
+
 	glGenVertexArrays(1, &VAO);
 	glGenBuffers(1, &VBO);
 	glGenBuffers(1, &EBO);
 
-	glBindVertexArray(VAO);
+	GLState &state = GLState::getGLState();
+	state.bindVertexArray(VAO);
 
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	state.bindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 	
 	// set the vertex attribute pointers
@@ -37,42 +61,27 @@ void Mesh::setupMesh() {
 	glEnableVertexAttribArray(4);
 	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
 
-	glBindVertexArray(0);
+	state.bindVertexArray(0);
 }
 
 void Mesh::Draw(Shader *shader) {
 
-	unsigned int diffuseNr = 1;
-	unsigned int specularNr = 1;
-	unsigned int normalNr = 1;
-	unsigned int heightNr = 1;
-
-	for (unsigned int i = 0; i < textures.size(); i++)
-	{
-		glActiveTexture(GL_TEXTURE0 + i);
+	bindTextures(shader);
 
-		string number;
-		string name = textures[i].type;
-		if (name == "texture_diffuse")
-			number = std::to_string(diffuseNr++);
-		else if (name == "texture_specular")
-			number = std::to_string(specularNr++);
-		else if (name == "texture_normal")
-			number = std::to_string(normalNr++); 
-		else if (name == "texture_height")
-			number = std::to_string(heightNr++);
+	// draw mesh, the vertex array stays bound for the next draw of the same mesh
+	GLState::getGLState().bindVertexArray(VAO);
+	glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+}
 
-		shader->setFloat((name + number).c_str(), i);
-		glBindTexture(GL_TEXTURE_2D, textures[i].id);
-	}
-	glActiveTexture(GL_TEXTURE0);
+void Mesh::bindTextures(Shader *shader) {
 
-	// draw mesh
-	glBindVertexArray(VAO);
-	glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
+	GLState &state = GLState::getGLState();
 
-	glActiveTexture(GL_TEXTURE0);
+	for (unsigned int i = 0; i < textures.size(); i++)
+	{
+		shader->setInt(samplers[i], i);
+		state.bindTexture(i, GL_TEXTURE_2D, textures[i].id);
+	}
 }
 
 unsigned int Mesh::getVAO() {
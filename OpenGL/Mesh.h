@@ -37,11 +37,15 @@ public:
 	vector<Vertex> vertices;
 	vector<unsigned int> indices;
 	vector<Texture> textures;
+	// sampler uniform of each texture ("texture_diffuse1", ...), hashed once at load
+	vector<UniformHash> samplers;
 
 	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures);
 	~Mesh();
 
 	void Draw(Shader *shader);
+	// Binds the mesh's own textures to units 0, 1, ... and points its samplers at them
+	void bindTextures(Shader *shader);
 	unsigned int getVAO();
 
 private:
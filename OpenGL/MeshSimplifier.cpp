@@ -0,0 +1,110 @@
+#include "MeshSimplifier.h"
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+
+float simplifyMesh(const vector<Vertex> &vertices, const vector<unsigned int> &indices, float cellSize,
+	vector<Vertex> &simplifiedVertices, vector<unsigned int> &simplifiedIndices) {
+
+	simplifiedVertices.clear();
+	simplifiedIndices.clear();
+	if (vertices.empty() || cellSize <= 0.0f)
+		return 0.0f;
+
+	glm::vec3 boundsMin = vertices[0].Position;
+	for (size_t i = 1; i < vertices.size(); i++)
+		boundsMin = glm::min(boundsMin, vertices[i].Position);
+
+	Vertex zero;
+	zero.Position = zero.Normal = zero.Tangent = zero.Bitangent = glm::vec3(0.0f);
+	zero.TexCoords = glm::vec2(0.0f);
+
+	unordered_map<uint64_t, unsigned int> clusters;
+	vector<unsigned int> remap(vertices.size());
+	vector<unsigned int> members;
+
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		glm::vec3 cell = glm::floor((vertices[i].Position - boundsMin) / cellSize);
+		uint64_t key = (uint64_t)cell.x | ((uint64_t)cell.y << 21) | ((uint64_t)cell.z << 42);
+
+		auto iter = clusters.find(key);
+		if (iter == clusters.end()) {
+			iter = clusters.insert(make_pair(key, (unsigned int)simplifiedVertices.size())).first;
+			simplifiedVertices.push_back(zero);
+			members.push_back(0);
+		}
+
+		unsigned int cluster = iter->second;
+		Vertex &sum = simplifiedVertices[cluster];
+		sum.Position += vertices[i].Position;
+		sum.Normal += vertices[i].Normal;
+		sum.TexCoords = sum.TexCoords + vertices[i].TexCoords;
+		sum.Tangent += vertices[i].Tangent;
+		sum.Bitangent += vertices[i].Bitangent;
+		members[cluster]++;
+		remap[i] = cluster;
+	}
+
+	for (size_t c = 0; c < simplifiedVertices.size(); c++)
+	{
+		Vertex &vertex = simplifiedVertices[c];
+		float weight = 1.0f / members[c];
+		vertex.Position *= weight;
+		vertex.TexCoords = vertex.TexCoords * weight;
+
+		// opposite normals of thin parts can cancel out, the direction is then as good as any
+		float length = glm::length(vertex.Normal);
+		vertex.Normal = length > 1e-6f ? vertex.Normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+		length = glm::length(vertex.Tangent);
+		vertex.Tangent = length > 1e-6f ? vertex.Tangent / length : glm::vec3(1.0f, 0.0f, 0.0f);
+		length = glm::length(vertex.Bitangent);
+		vertex.Bitangent = length > 1e-6f ? vertex.Bitangent / length : glm::vec3(0.0f, 0.0f, 1.0f);
+	}
+
+	float error = 0.0f;
+	for (size_t i = 0; i < vertices.size(); i++)
+		error = glm::max(error, glm::distance(vertices[i].Position, simplifiedVertices[remap[i]].Position));
+
+	// collapsed triangles go, and so do copies of a triangle already kept (same corners, same winding)
+	unordered_set<uint64_t> kept;
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		unsigned int a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+		if (a == b || b == c || c == a)
+			continue;
+
+		// rotate the smallest corner first so every copy gets the same key
+		while (a > b || a > c)
+		{
+			unsigned int first = a;
+			a = b; b = c; c = first;
+		}
+
+		uint64_t key = (uint64_t)a | ((uint64_t)b << 21) | ((uint64_t)c << 42);
+		if (!kept.insert(key).second)
+			continue;
+
+		simplifiedIndices.push_back(a);
+		simplifiedIndices.push_back(b);
+		simplifiedIndices.push_back(c);
+	}
+
+	// vertices only used by dropped triangles are compacted away
+	vector<unsigned int> compact(simplifiedVertices.size(), 0xFFFFFFFFu);
+	vector<Vertex> used;
+	for (size_t i = 0; i < simplifiedIndices.size(); i++)
+	{
+		unsigned int &index = simplifiedIndices[i];
+		if (compact[index] == 0xFFFFFFFFu) {
+			compact[index] = (unsigned int)used.size();
+			used.push_back(simplifiedVertices[index]);
+		}
+		index = compact[index];
+	}
+	simplifiedVertices.swap(used);
+
+	return error;
+}
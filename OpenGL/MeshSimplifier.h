@@ -0,0 +1,13 @@
+#pragma once
+
+#include <vector>
+
+#include "Mesh.h"
+
+using namespace std;
+
+// Vertex clustering (Rossignac & Borrel): the mesh bounds are cut into cubic cells of cellSize, the vertices of a cell
+// are merged into their average and triangles left without three distinct corners are dropped. Returns how far the
+// farthest vertex moved, never more than a cell diagonal.
+float simplifyMesh(const vector<Vertex> &vertices, const vector<unsigned int> &indices, float cellSize,
+	vector<Vertex> &simplifiedVertices, vector<unsigned int> &simplifiedIndices);
@@ -1,9 +1,20 @@
 #include "Model.h"
+#include "GLState.h"
+#include "Helper.h"
+#include "MeshSimplifier.h"
 
-Model::Model(const char *path, bool gamma) : gammaCorrection(gamma)
+Model::Model(const char *path, bool gamma, int lodLevels) : path(path), gammaCorrection(gamma), radius(0.0f)
 {
 	loadModel(path);
 
+	for (unsigned int i = 0; i < meshes.size(); i++)
+		for (unsigned int j = 0; j < meshes[i].vertices.size(); j++)
+			radius = glm::max(radius, glm::length(meshes[i].vertices[j].Position));
+
+	lodErrors.push_back(0.0f);
+	if (lodLevels > 0 && !meshes.empty())
+		generateLods(lodLevels);
+
 	/*
 	minX = 0;
 	maxX = 0;
@@ -25,6 +36,195 @@ void Model::Draw(Shader *shader)
 		meshes[i].Draw(shader);
 }
 
+const string& Model::getPath()
+{
+	return path;
+}
+
+int Model::getLodCount() const
+{
+	return (int)lods.size() + 1;
+}
+
+vector<Mesh>& Model::getLodMeshes(int level)
+{
+	return level == 0 ? meshes : lods[level - 1];
+}
+
+float Model::getLodError(int level) const
+{
+	return lodErrors[level];
+}
+
+float Model::getRadius() const
+{
+	return radius;
+}
+
+void Model::generateLods(int levels)
+{
+	string cachePath = path + ".lod";
+	uint64_t hash = hashFile(path);
+	vector<LodLevel> chain;
+
+	if (!loadLodCache(cachePath, hash, levels, chain)) {
+		chain = simplifyLevels(levels);
+		saveLodCache(cachePath, hash, levels, chain);
+	}
+
+	// simplified meshes keep the textures of the mesh they come from
+	for (unsigned int l = 0; l < chain.size(); l++)
+	{
+		vector<Mesh> level;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			level.push_back(Mesh(chain[l].vertices[i], chain[l].indices[i], meshes[i].textures));
+
+		lods.push_back(level);
+		lodErrors.push_back(chain[l].error);
+	}
+}
+
+// The chain stops early once a level would lose a whole mesh or no longer remove a quarter of the triangles
+vector<Model::LodLevel> Model::simplifyLevels(int levels)
+{
+	glm::vec3 boundsMin = meshes[0].vertices[0].Position, boundsMax = boundsMin;
+	size_t previousIndices = 0;
+	for (unsigned int i = 0; i < meshes.size(); i++)
+	{
+		for (unsigned int j = 0; j < meshes[i].vertices.size(); j++)
+		{
+			boundsMin = glm::min(boundsMin, meshes[i].vertices[j].Position);
+			boundsMax = glm::max(boundsMax, meshes[i].vertices[j].Position);
+		}
+		previousIndices += meshes[i].indices.size();
+	}
+
+	glm::vec3 size = boundsMax - boundsMin;
+	float extent = glm::max(size.x, glm::max(size.y, size.z));
+
+	vector<LodLevel> chain;
+	for (int l = 1; l <= levels; l++)
+	{
+		// 16 cells along the longest side for the first level, then 8, 4...
+		int cells = 32 >> l;
+		if (cells < 1)
+			break;
+		LodLevel level;
+		level.error = 0.0f;
+		float cellSize = extent / cells;
+
+		size_t totalIndices = 0;
+		bool lostMesh = false;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			level.vertices.push_back(vector<Vertex>());
+			level.indices.push_back(vector<unsigned int>());
+			float error = simplifyMesh(meshes[i].vertices, meshes[i].indices, cellSize, level.vertices.back(), level.indices.back());
+			level.error = glm::max(level.error, error);
+
+			totalIndices += level.indices.back().size();
+			lostMesh = lostMesh || level.indices.back().empty();
+		}
+
+		if (lostMesh || totalIndices * 4 > previousIndices * 3)
+			break;
+
+		chain.push_back(level);
+		previousIndices = totalIndices;
+	}
+
+	return chain;
+}
+
+bool Model::loadLodCache(string path, uint64_t hash, int levels, vector<LodLevel>& chain)
+{
+	ifstream file(path, ios::binary);
+	if (!file)
+		return false;
+
+	unsigned int magic = 0, version = 0, count = 0, meshCount = 0;
+	uint64_t fileHash = 0;
+	int fileLevels = 0;
+
+	file.read((char*)&magic, sizeof(magic));
+	file.read((char*)&version, sizeof(version));
+	file.read((char*)&fileHash, sizeof(fileHash));
+	file.read((char*)&fileLevels, sizeof(fileLevels));
+	file.read((char*)&count, sizeof(count));
+	file.read((char*)&meshCount, sizeof(meshCount));
+
+	if (!file || magic != LOD_CACHE_MAGIC || version != LOD_CACHE_VERSION || fileHash != hash || fileLevels != levels || meshCount != meshes.size())
+		return false;
+
+	chain.resize(count);
+	for (unsigned int l = 0; l < count && file; l++)
+	{
+		LodLevel &level = chain[l];
+		file.read((char*)&level.error, sizeof(level.error));
+		level.vertices.resize(meshCount);
+		level.indices.resize(meshCount);
+
+		for (unsigned int i = 0; i < meshCount && file; i++)
+		{
+			unsigned int vertexCount = 0, indexCount = 0;
+			file.read((char*)&vertexCount, sizeof(vertexCount));
+			file.read((char*)&indexCount, sizeof(indexCount));
+			if (!file || vertexCount == 0 || indexCount == 0) {
+				chain.clear();
+				return false;
+			}
+
+			level.vertices[i].resize(vertexCount);
+			level.indices[i].resize(indexCount);
+			file.read((char*)&level.vertices[i][0], vertexCount * sizeof(Vertex));
+			file.read((char*)&level.indices[i][0], indexCount * sizeof(unsigned int));
+		}
+	}
+
+	if (!file) {
+		chain.clear();
+		return false;
+	}
+
+	return true;
+}
+
+void Model::saveLodCache(string path, uint64_t hash, int levels, const vector<LodLevel>& chain)
+{
+	if (hash == 0)
+		return;
+
+	ofstream file(path, ios::binary | ios::trunc);
+	if (!file) {
+		cout << "LOD cache not writable: " << path << endl;
+		return;
+	}
+
+	unsigned int count = (unsigned int)chain.size();
+	unsigned int meshCount = (unsigned int)meshes.size();
+
+	file.write((const char*)&LOD_CACHE_MAGIC, sizeof(LOD_CACHE_MAGIC));
+	file.write((const char*)&LOD_CACHE_VERSION, sizeof(LOD_CACHE_VERSION));
+	file.write((const char*)&hash, sizeof(hash));
+	file.write((const char*)&levels, sizeof(levels));
+	file.write((const char*)&count, sizeof(count));
+	file.write((const char*)&meshCount, sizeof(meshCount));
+
+	for (unsigned int l = 0; l < count; l++)
+	{
+		file.write((const char*)&chain[l].error, sizeof(chain[l].error));
+		for (unsigned int i = 0; i < meshCount; i++)
+		{
+			unsigned int vertexCount = (unsigned int)chain[l].vertices[i].size();
+			unsigned int indexCount = (unsigned int)chain[l].indices[i].size();
+			file.write((const char*)&vertexCount, sizeof(vertexCount));
+			file.write((const char*)&indexCount, sizeof(indexCount));
+			file.write((const char*)&chain[l].vertices[i][0], vertexCount * sizeof(Vertex));
+			file.write((const char*)&chain[l].indices[i][0], indexCount * sizeof(unsigned int));
+		}
+	}
+}
+
 void Model::loadModel(const string &path)
 {
 	Assimp::Importer importer;
@@ -186,7 +386,7 @@ unsigned int Model::TextureFromFile(const char *path, const string &directory, b
 		else if (nrComponents == 4)
 			format = GL_RGBA;
 
-		glBindTexture(GL_TEXTURE_2D, textureID);
+		GLState::getGLState().bindTexture(0, GL_TEXTURE_2D, textureID);
 		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
 		glGenerateMipmap(GL_TEXTURE_2D);
 
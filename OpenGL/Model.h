@@ -13,6 +13,7 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <cstdint>
 
 #include "Mesh.h"
 #include "Shader.h"
@@ -23,10 +24,20 @@ class Model
 {
 public:
 
-	Model(const char *path, bool gamma = false);
+	Model(const char *path, bool gamma = false, int lodLevels = 0);
 	~Model();
 
 	void Draw(Shader *shader);
+	const string& getPath();
+
+	// Level 0 is meshes, every further level is simplified from it with cells twice as large (see MeshSimplifier.h).
+	// The chain is cached next to the model file.
+	int getLodCount() const;
+	vector<Mesh>& getLodMeshes(int level);
+	// Farthest a vertex of the level moved, in model space
+	float getLodError(int level) const;
+	// Bounding sphere around the model origin, the point instances are scaled around
+	float getRadius() const;
 
 	/*float getMinX();
 	float getMaxX();
@@ -43,15 +54,34 @@ public:
 
 private:
 
+	const unsigned int LOD_CACHE_MAGIC = 0x43444F4C; // "LODC"
+	const unsigned int LOD_CACHE_VERSION = 1;
+
+	struct LodLevel {
+		float error;
+		vector<vector<Vertex> > vertices;
+		vector<vector<unsigned int> > indices;
+	};
+
+	string path;
 	string directory;
 	bool gammaCorrection;
 
+	vector<vector<Mesh> > lods;
+	vector<float> lodErrors;
+	float radius;
+
 	//float minX, maxX, minY, maxY,minZ,maxZ,width,height,depth;
 
 	void loadModel(const string &path);
 	void processNode(aiNode *node, const aiScene *scene);
 	Mesh processMesh(aiMesh *mesh, const aiScene *scene);
 
+	void generateLods(int levels);
+	vector<LodLevel> simplifyLevels(int levels);
+	bool loadLodCache(string path, uint64_t hash, int levels, vector<LodLevel>& chain);
+	void saveLodCache(string path, uint64_t hash, int levels, const vector<LodLevel>& chain);
+
 	vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName);
 	unsigned int TextureFromFile(const char *path, const string &directory, bool gamma=false);
 
@@ -0,0 +1,349 @@
+#include "OcclusionBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <emmintrin.h>
+
+// Triangles are clipped against w = NEAR_W and a guard band of GUARD_BAND times the screen, which keeps the
+// edge functions small enough for float precision
+static const float NEAR_W = 0.05f;
+static const float GUARD_BAND = 2.0f;
+static const int MAX_CLIPPED = 9;
+
+static const int boxFaces[6][4] = {
+	{ 0, 1, 3, 2 }, { 4, 6, 7, 5 }, { 0, 4, 5, 1 },
+	{ 2, 3, 7, 6 }, { 0, 2, 6, 4 }, { 1, 5, 7, 3 }
+};
+
+static const glm::vec4 clipPlanes[5] = {
+	glm::vec4(0.0f, 0.0f, 0.0f, 1.0f),
+	glm::vec4(1.0f, 0.0f, 0.0f, GUARD_BAND),
+	glm::vec4(-1.0f, 0.0f, 0.0f, GUARD_BAND),
+	glm::vec4(0.0f, 1.0f, 0.0f, GUARD_BAND),
+	glm::vec4(0.0f, -1.0f, 0.0f, GUARD_BAND)
+};
+
+static inline float planeDistance(int plane, const glm::vec4 &v) {
+	return glm::dot(clipPlanes[plane], v) - (plane == 0 ? NEAR_W : 0.0f);
+}
+
+OcclusionBuffer::OcclusionBuffer(int width, int height) : width((width + 3) & ~3), height(height), pending(false), busy(false), stopping(false)
+{
+	depth.resize(this->width * this->height, 0.0f);
+	worker = thread(&OcclusionBuffer::workerLoop, this);
+}
+
+OcclusionBuffer::~OcclusionBuffer()
+{
+	{
+		unique_lock<mutex> lock(renderMutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+	worker.join();
+}
+
+void OcclusionBuffer::addOccluder(const glm::vec3 corners[8]) {
+
+	wait();
+	for (int c = 0; c < 8; c++)
+		occluders.push_back(corners[c]);
+}
+
+void OcclusionBuffer::addOccluders(BulletWorld *world) {
+
+	map<string, btRigidBody*> walls = world->getRooms();
+
+	for (map<string, btRigidBody*>::iterator it = walls.begin(); it != walls.end(); ++it)
+	{
+		btCollisionShape *shape = (*it).second->getCollisionShape();
+		if (shape->getShapeType() != BOX_SHAPE_PROXYTYPE)
+			continue;
+
+		btVector3 extent = ((btBoxShape*)shape)->getHalfExtentsWithMargin();
+		const btTransform& t = (*it).second->getWorldTransform();
+
+		glm::vec3 corners[8];
+		for (int c = 0; c < 8; c++)
+		{
+			btVector3 corner = t(btVector3((c & 4) ? extent.x() : -extent.x(), (c & 2) ? extent.y() : -extent.y(), (c & 1) ? extent.z() : -extent.z()));
+			corners[c] = glm::vec3(corner.getX(), corner.getY(), corner.getZ());
+		}
+		addOccluder(corners);
+	}
+}
+
+void OcclusionBuffer::render(const glm::mat4 &viewProjection) {
+
+	wait();
+
+	{
+		unique_lock<mutex> lock(renderMutex);
+		this->viewProjection = viewProjection;
+		pending = true;
+		busy = true;
+	}
+	wakeCondition.notify_all();
+}
+
+void OcclusionBuffer::wait() {
+
+	unique_lock<mutex> lock(renderMutex);
+	doneCondition.wait(lock, [this] { return !busy; });
+}
+
+void OcclusionBuffer::workerLoop() {
+
+	unique_lock<mutex> lock(renderMutex);
+
+	while (true)
+	{
+		wakeCondition.wait(lock, [this] { return pending || stopping; });
+		if (stopping)
+			return;
+		pending = false;
+
+		lock.unlock();
+		rasterize();
+		lock.lock();
+
+		busy = false;
+		doneCondition.notify_all();
+	}
+}
+
+void OcclusionBuffer::rasterize() {
+
+	fill(depth.begin(), depth.end(), 0.0f);
+
+	glm::vec4 clip[8];
+	for (size_t first = 0; first < occluders.size(); first += 8)
+	{
+		// boxes entirely outside one of the clip planes are skipped
+		int outside[5] = { 0, 0, 0, 0, 0 };
+		for (int c = 0; c < 8; c++)
+		{
+			clip[c] = viewProjection * glm::vec4(occluders[first + c], 1.0f);
+			for (int p = 0; p < 5; p++)
+				if (planeDistance(p, clip[c]) < 0.0f)
+					outside[p]++;
+		}
+
+		bool rejected = false;
+		for (int p = 0; p < 5; p++)
+			rejected = rejected || outside[p] == 8;
+		if (rejected)
+			continue;
+
+		for (int f = 0; f < 6; f++)
+		{
+			glm::vec4 face[4] = { clip[boxFaces[f][0]], clip[boxFaces[f][1]], clip[boxFaces[f][2]], clip[boxFaces[f][3]] };
+			drawFace(face);
+		}
+	}
+}
+
+// Sutherland-Hodgman in clip space. The clipped face stays one convex polygon, so only its outline is shrunk
+// by the conservative rasterization and no seams open inside it.
+void OcclusionBuffer::drawFace(const glm::vec4 corners[4]) {
+
+	glm::vec4 polygon[2][MAX_CLIPPED];
+	for (int i = 0; i < 4; i++)
+		polygon[0][i] = corners[i];
+	int count = 4;
+	int current = 0;
+
+	for (int p = 0; p < 5 && count >= 3; p++)
+	{
+		const glm::vec4 *in = polygon[current];
+		bool inside = true;
+		for (int i = 0; i < count && inside; i++)
+			inside = planeDistance(p, in[i]) >= 0.0f;
+		if (inside)
+			continue;
+
+		glm::vec4 *out = polygon[1 - current];
+		int clipped = 0;
+
+		for (int i = 0; i < count; i++)
+		{
+			const glm::vec4 &from = in[i];
+			const glm::vec4 &to = in[(i + 1) % count];
+			float fromDistance = planeDistance(p, from);
+			float toDistance = planeDistance(p, to);
+
+			if (fromDistance >= 0.0f)
+				out[clipped++] = from;
+			if ((fromDistance >= 0.0f) != (toDistance >= 0.0f))
+				out[clipped++] = from + (to - from) * (fromDistance / (fromDistance - toDistance));
+		}
+
+		count = clipped;
+		current = 1 - current;
+	}
+
+	if (count < 3)
+		return;
+
+	glm::vec3 screen[MAX_CLIPPED];
+	for (int i = 0; i < count; i++)
+		screen[i] = toScreen(polygon[current][i]);
+	drawScreenPolygon(screen, count);
+}
+
+// x and y in pixels, z is 1/w
+glm::vec3 OcclusionBuffer::toScreen(const glm::vec4 &clip) const {
+
+	float inverseW = 1.0f / clip.w;
+	return glm::vec3((clip.x * inverseW * 0.5f + 0.5f) * width, (clip.y * inverseW * 0.5f + 0.5f) * height, inverseW);
+}
+
+// Conservative: only pixels entirely inside the polygon are written, with the smallest 1/w the polygon takes over
+// them, so an object peeking out by less than a pixel is never hidden. Four pixels of a row at a time.
+void OcclusionBuffer::drawScreenPolygon(const glm::vec3 *vertices, int count) {
+
+	// twice the signed area, and the fan triangle with the largest area to take the depth plane from
+	float area = 0.0f, largest = 0.0f;
+	int apex = 1;
+	for (int i = 1; i + 1 < count; i++)
+	{
+		float triangle = (vertices[i].x - vertices[0].x) * (vertices[i + 1].y - vertices[0].y) - (vertices[i].y - vertices[0].y) * (vertices[i + 1].x - vertices[0].x);
+		area += triangle;
+		if (abs(triangle) > abs(largest)) {
+			largest = triangle;
+			apex = i;
+		}
+	}
+	if (abs(area) < 1e-6f)
+		return;
+	float orientation = area > 0.0f ? 1.0f : -1.0f;
+
+	float lowX = vertices[0].x, highX = vertices[0].x, lowY = vertices[0].y, highY = vertices[0].y;
+	for (int i = 1; i < count; i++)
+	{
+		lowX = glm::min(lowX, vertices[i].x); highX = glm::max(highX, vertices[i].x);
+		lowY = glm::min(lowY, vertices[i].y); highY = glm::max(highY, vertices[i].y);
+	}
+
+	int minX = glm::max(0, (int)floor(lowX));
+	int maxX = glm::min(width - 1, (int)floor(highX));
+	int minY = glm::max(0, (int)floor(lowY));
+	int maxY = glm::min(height - 1, (int)floor(highY));
+	if (minX > maxX || minY > maxY)
+		return;
+	minX &= ~3;
+
+	// edge u->v as A*x + B*y + C, positive on the inner side. Taking half of |A| + |B| off the value at the pixel
+	// center gives its smallest value over the pixel, so the test passes only when the whole pixel is inside.
+	float edgeA[MAX_CLIPPED], edgeB[MAX_CLIPPED], edgeC[MAX_CLIPPED];
+	for (int e = 0; e < count; e++)
+	{
+		const glm::vec3 &u = vertices[e];
+		const glm::vec3 &v = vertices[(e + 1) % count];
+		edgeA[e] = (u.y - v.y) * orientation;
+		edgeB[e] = (v.x - u.x) * orientation;
+		edgeC[e] = -(edgeA[e] * u.x + edgeB[e] * u.y) - 0.5f * (abs(edgeA[e]) + abs(edgeB[e]));
+	}
+
+	// 1/w is linear in screen space over a flat polygon, the farthest value over a pixel is half of |A| + |B|
+	// below the center one
+	const glm::vec3 &p0 = vertices[0], &p1 = vertices[apex], &p2 = vertices[apex + 1];
+	float depthA = ((p1.z - p0.z) * (p2.y - p0.y) - (p2.z - p0.z) * (p1.y - p0.y)) / largest;
+	float depthB = ((p2.z - p0.z) * (p1.x - p0.x) - (p1.z - p0.z) * (p2.x - p0.x)) / largest;
+	float depthC = p0.z - depthA * p0.x - depthB * p0.y - 0.5f * (abs(depthA) + abs(depthB));
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 columns = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	__m128 stepA[MAX_CLIPPED], edgeValue[MAX_CLIPPED];
+	for (int e = 0; e < count; e++)
+		stepA[e] = _mm_set1_ps(edgeA[e] * 4.0f);
+	__m128 depthStep = _mm_set1_ps(depthA * 4.0f);
+
+	for (int y = minY; y <= maxY; y++)
+	{
+		float centerY = y + 0.5f;
+		__m128 pixelX = _mm_add_ps(_mm_set1_ps((float)minX), columns);
+
+		for (int e = 0; e < count; e++)
+			edgeValue[e] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[e]), pixelX), _mm_set1_ps(edgeB[e] * centerY + edgeC[e]));
+		__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(depthA), pixelX), _mm_set1_ps(depthB * centerY + depthC));
+
+		float *row = &depth[y * width];
+		for (int x = minX; x <= maxX; x += 4)
+		{
+			__m128 inside = _mm_cmpge_ps(edgeValue[0], zero);
+			for (int e = 1; e < count; e++)
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(edgeValue[e], zero));
+			if (_mm_movemask_ps(inside) != 0)
+				_mm_storeu_ps(row + x, _mm_max_ps(_mm_loadu_ps(row + x), _mm_and_ps(inside, _mm_max_ps(z, zero))));
+
+			for (int e = 0; e < count; e++)
+				edgeValue[e] = _mm_add_ps(edgeValue[e], stepA[e]);
+			z = _mm_add_ps(z, depthStep);
+		}
+	}
+}
+
+bool OcclusionBuffer::isVisible(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) const {
+
+	float screenMinX = (float)width, screenMinY = (float)height, screenMaxX = 0.0f, screenMaxY = 0.0f;
+	float nearest = 0.0f;
+
+	for (int c = 0; c < 8; c++)
+	{
+		glm::vec3 corner((c & 4) ? boundsMax.x : boundsMin.x, (c & 2) ? boundsMax.y : boundsMin.y, (c & 1) ? boundsMax.z : boundsMin.z);
+		glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+		if (clip.w < NEAR_W)
+			return true;
+
+		glm::vec3 screen = toScreen(clip);
+		screenMinX = glm::min(screenMinX, screen.x); screenMaxX = glm::max(screenMaxX, screen.x);
+		screenMinY = glm::min(screenMinY, screen.y); screenMaxY = glm::max(screenMaxY, screen.y);
+		nearest = glm::max(nearest, screen.z);
+	}
+
+	// off screen boxes are left to the view frustum
+	if (screenMaxX < 0.0f || screenMaxY < 0.0f || screenMinX >= width || screenMinY >= height)
+		return true;
+
+	int minX = glm::max(0, (int)floor(screenMinX));
+	int maxX = glm::min(width - 1, (int)floor(screenMaxX));
+	int minY = glm::max(0, (int)floor(screenMinY));
+	int maxY = glm::min(height - 1, (int)floor(screenMaxY));
+
+	const __m128 nearestDepth = _mm_set1_ps(nearest);
+	const __m128 first = _mm_set1_ps((float)minX), last = _mm_set1_ps((float)maxX);
+	const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+	for (int y = minY; y <= maxY; y++)
+	{
+		const float *row = &depth[y * width];
+		for (int x = minX & ~3; x <= maxX; x += 4)
+		{
+			__m128 column = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+			__m128 covered = _mm_and_ps(_mm_cmpge_ps(column, first), _mm_cmple_ps(column, last));
+
+			// any pixel with its occluder farther than the box's nearest point lets the box through
+			if (_mm_movemask_ps(_mm_and_ps(covered, _mm_cmplt_ps(_mm_loadu_ps(row + x), nearestDepth))) != 0)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+int OcclusionBuffer::getWidth() const {
+	return width;
+}
+
+int OcclusionBuffer::getHeight() const {
+	return height;
+}
+
+size_t OcclusionBuffer::getOccluderCount() const {
+	return occluders.size() / 8;
+}
+
+const float* OcclusionBuffer::getDepth() const {
+	return &depth[0];
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <glm\glm.hpp>
+
+#include "BulletWorld.h"
+
+using namespace std;
+
+// Small CPU depth buffer the level walls are drawn into, so whatever hides behind them can be skipped before it
+// reaches the GPU. Every pixel keeps 1/w of the closest occluder (0 where there is none), only pixels an occluder
+// covers entirely are written, four pixels are rasterized at a time. Drawing runs on its own thread between render() and wait(), without any GL calls.
+class OcclusionBuffer
+{
+public:
+
+	OcclusionBuffer(int width = 256, int height = 144);
+	~OcclusionBuffer();
+
+	// Boxes given by their eight world space corners, corner c at (c&4 ? +x : -x, c&2 ? +y : -y, c&1 ? +z : -z)
+	void addOccluder(const glm::vec3 corners[8]);
+	// Every wall and floor of the world's rooms
+	void addOccluders(BulletWorld *world);
+
+	// Starts drawing the occluders seen through viewProjection on the worker thread
+	void render(const glm::mat4 &viewProjection);
+	// Blocks until the last render() is done, the buffer must not be tested before
+	void wait();
+
+	// False only when the whole box is behind the occluders. Boxes crossing the near plane are always visible.
+	bool isVisible(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) const;
+
+	int getWidth() const;
+	int getHeight() const;
+	size_t getOccluderCount() const;
+	const float* getDepth() const;
+
+private:
+
+	int width, height;
+	vector<float> depth;
+	vector<glm::vec3> occluders;
+	glm::mat4 viewProjection;
+
+	thread worker;
+	mutex renderMutex;
+	condition_variable wakeCondition;
+	condition_variable doneCondition;
+	bool pending, busy, stopping;
+
+	void workerLoop();
+	void rasterize();
+	void drawFace(const glm::vec4 corners[4]);
+	void drawScreenPolygon(const glm::vec3 *vertices, int count);
+	glm::vec3 toScreen(const glm::vec4 &clip) const;
+};
@@ -0,0 +1,237 @@
+#include "ParticleSystem.h"
+
+#include <cfloat>
+#include <cmath>
+#include <emmintrin.h>
+
+static const size_t PARALLEL_GRAIN = 4096;
+static const float TWO_PI = 6.28318531f;
+
+// Four xorshift32 generators side by side, one stream per chunk so the result does not depend on the thread count
+struct RandomLanes {
+
+	__m128i state;
+
+	RandomLanes(unsigned int seed, unsigned int stream) {
+
+		unsigned int lanes[4];
+		for (int i = 0; i < 4; i++)
+		{
+			// splitmix style scramble, xorshift must never start at zero
+			unsigned int h = seed * 0x9E3779B9u ^ stream * 0x85EBCA6Bu ^ (unsigned int)i * 0xC2B2AE35u;
+			h ^= h >> 16; h *= 0x7FEB352Du; h ^= h >> 15; h *= 0x846CA68Bu; h ^= h >> 16;
+			lanes[i] = h != 0 ? h : 0x6D2B79F5u;
+		}
+		state = _mm_loadu_si128((const __m128i*)lanes);
+	}
+
+	// uniform in [0, 1)
+	__m128 next() {
+
+		state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+		state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+		state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+
+		__m128i mantissa = _mm_or_si128(_mm_srli_epi32(state, 9), _mm_set1_epi32(0x3F800000));
+		return _mm_sub_ps(_mm_castsi128_ps(mantissa), _mm_set1_ps(1.0f));
+	}
+
+	__m128 range(float minimum, float maximum) {
+		return _mm_add_ps(_mm_set1_ps(minimum), _mm_mul_ps(next(), _mm_set1_ps(maximum - minimum)));
+	}
+};
+
+static inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+ParticleSystem::ParticleSystem(const DistanceField *field, unsigned int seed) : pool(&ThreadPool::getThreadPool()), field(field), seed(seed), frame(0)
+{
+}
+
+ParticleSystem::~ParticleSystem()
+{
+}
+
+unsigned int ParticleSystem::addEmitter(const ParticleEmitter &emitter, size_t count) {
+
+	EmitterRange range;
+	range.emitter = emitter;
+	range.first = x.size();
+	range.count = count;
+	range.padded = (count + 3) & ~(size_t)3;
+	emitters.push_back(range);
+
+	size_t size = range.first + range.padded;
+	x.resize(size); y.resize(size); z.resize(size);
+	vx.resize(size); vy.resize(size); vz.resize(size);
+	life.resize(size);
+	scale.resize(size);
+	qx.resize(size); qy.resize(size); qz.resize(size); qw.resize(size);
+	hits.resize(size);
+
+	unsigned int index = (unsigned int)emitters.size() - 1;
+	pool->parallelFor(range.padded, PARALLEL_GRAIN, [this, &range, index](size_t begin, size_t end) {
+		fill(range.emitter, range.first + begin, range.first + end, index * 0x10000u + (unsigned int)(begin / PARALLEL_GRAIN));
+	});
+
+	return index;
+}
+
+void ParticleSystem::update(float deltaTime) {
+
+	frame++;
+
+	for (unsigned int e = 0; e < emitters.size(); e++)
+	{
+		const EmitterRange &range = emitters[e];
+		unsigned int stream = (frame * 0x9E3779B1u) ^ (e << 20);
+
+		pool->parallelFor(range.padded, PARALLEL_GRAIN, [this, &range, deltaTime, stream](size_t begin, size_t end) {
+			updateRange(range.emitter, range.first + begin, range.first + end, deltaTime, stream + (unsigned int)(begin / PARALLEL_GRAIN));
+		});
+	}
+}
+
+void ParticleSystem::updateRange(const ParticleEmitter &emitter, size_t begin, size_t end, float deltaTime, unsigned int stream) {
+
+	const __m128 dt = _mm_set1_ps(deltaTime);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 minX = _mm_set1_ps(emitter.boundsMin.x), maxX = _mm_set1_ps(emitter.boundsMax.x);
+	const __m128 minY = _mm_set1_ps(emitter.boundsMin.y), maxY = _mm_set1_ps(emitter.boundsMax.y);
+	const __m128 minZ = _mm_set1_ps(emitter.boundsMin.z), maxZ = _mm_set1_ps(emitter.boundsMax.z);
+
+	RandomLanes random(seed, stream);
+
+	for (size_t i = begin; i < end; i += 4)
+	{
+		__m128 px = _mm_add_ps(_mm_loadu_ps(&x[i]), _mm_mul_ps(_mm_loadu_ps(&vx[i]), dt));
+		__m128 py = _mm_add_ps(_mm_loadu_ps(&y[i]), _mm_mul_ps(_mm_loadu_ps(&vy[i]), dt));
+		__m128 pz = _mm_add_ps(_mm_loadu_ps(&z[i]), _mm_mul_ps(_mm_loadu_ps(&vz[i]), dt));
+		__m128 age = _mm_sub_ps(_mm_loadu_ps(&life[i]), dt);
+
+		__m128 outside = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(px, minX), _mm_cmpgt_ps(px, maxX)), _mm_or_ps(_mm_cmplt_ps(py, minY), _mm_cmpgt_ps(py, maxY)));
+		outside = _mm_or_ps(outside, _mm_or_ps(_mm_cmplt_ps(pz, minZ), _mm_cmpgt_ps(pz, maxZ)));
+		__m128 dead = _mm_or_ps(outside, _mm_cmple_ps(age, zero));
+
+		_mm_storeu_ps(&x[i], px);
+		_mm_storeu_ps(&y[i], py);
+		_mm_storeu_ps(&z[i], pz);
+		_mm_storeu_ps(&life[i], age);
+
+		int mask = _mm_movemask_ps(dead);
+		if (mask == 0)
+			continue;
+
+		// respawn the dead lanes only, the live ones keep their state
+		__m128 sx = random.range(emitter.spawnMin.x, emitter.spawnMax.x);
+		__m128 sy = random.range(emitter.spawnMin.y, emitter.spawnMax.y);
+		__m128 sz = random.range(emitter.spawnMin.z, emitter.spawnMax.z);
+		__m128 jx = random.range(-emitter.velocityJitter.x, emitter.velocityJitter.x);
+		__m128 jy = random.range(-emitter.velocityJitter.y, emitter.velocityJitter.y);
+		__m128 jz = random.range(-emitter.velocityJitter.z, emitter.velocityJitter.z);
+		__m128 lifetime = emitter.lifetimeMax > 0.0f ? random.range(emitter.lifetimeMin, emitter.lifetimeMax) : _mm_set1_ps(FLT_MAX);
+
+		_mm_storeu_ps(&x[i], select(dead, sx, px));
+		_mm_storeu_ps(&y[i], select(dead, sy, py));
+		_mm_storeu_ps(&z[i], select(dead, sz, pz));
+		_mm_storeu_ps(&vx[i], select(dead, _mm_add_ps(_mm_set1_ps(emitter.velocity.x), jx), _mm_loadu_ps(&vx[i])));
+		_mm_storeu_ps(&vy[i], select(dead, _mm_add_ps(_mm_set1_ps(emitter.velocity.y), jy), _mm_loadu_ps(&vy[i])));
+		_mm_storeu_ps(&vz[i], select(dead, _mm_add_ps(_mm_set1_ps(emitter.velocity.z), jz), _mm_loadu_ps(&vz[i])));
+		_mm_storeu_ps(&life[i], select(dead, lifetime, age));
+	}
+
+	if (field == nullptr || emitter.collisionRadius <= 0.0f)
+		return;
+
+	// particles touching the level respawn like the ones that left the bounds
+	if (field->collide(&x[begin], &y[begin], &z[begin], 1, end - begin, emitter.collisionRadius, &hits[begin]) == 0)
+		return;
+
+	for (size_t i = begin; i < end; i += 4)
+	{
+		int mask = hits[i] | (hits[i + 1] << 1) | (hits[i + 2] << 2) | (hits[i + 3] << 3);
+		if (mask == 0)
+			continue;
+
+		__m128 hit = _mm_castsi128_ps(_mm_setr_epi32(-(int)hits[i], -(int)hits[i + 1], -(int)hits[i + 2], -(int)hits[i + 3]));
+		_mm_storeu_ps(&x[i], select(hit, random.range(emitter.spawnMin.x, emitter.spawnMax.x), _mm_loadu_ps(&x[i])));
+		_mm_storeu_ps(&y[i], select(hit, random.range(emitter.spawnMin.y, emitter.spawnMax.y), _mm_loadu_ps(&y[i])));
+		_mm_storeu_ps(&z[i], select(hit, random.range(emitter.spawnMin.z, emitter.spawnMax.z), _mm_loadu_ps(&z[i])));
+	}
+}
+
+// Spreads new particles over the whole bounds so the effect does not start empty, respawns use the spawn box
+void ParticleSystem::fill(const ParticleEmitter &emitter, size_t begin, size_t end, unsigned int stream) {
+
+	RandomLanes random(seed, stream);
+	glm::vec3 low = emitter.boundsMin;
+	glm::vec3 high = emitter.boundsMax;
+	glm::vec3 axis = glm::length(emitter.rotationAxis) > 0.0f ? glm::normalize(emitter.rotationAxis) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+	for (size_t i = begin; i < end; i += 4)
+	{
+		_mm_storeu_ps(&x[i], random.range(low.x, high.x));
+		_mm_storeu_ps(&y[i], random.range(low.y, high.y));
+		_mm_storeu_ps(&z[i], random.range(low.z, high.z));
+		_mm_storeu_ps(&vx[i], _mm_add_ps(_mm_set1_ps(emitter.velocity.x), random.range(-emitter.velocityJitter.x, emitter.velocityJitter.x)));
+		_mm_storeu_ps(&vy[i], _mm_add_ps(_mm_set1_ps(emitter.velocity.y), random.range(-emitter.velocityJitter.y, emitter.velocityJitter.y)));
+		_mm_storeu_ps(&vz[i], _mm_add_ps(_mm_set1_ps(emitter.velocity.z), random.range(-emitter.velocityJitter.z, emitter.velocityJitter.z)));
+		_mm_storeu_ps(&scale[i], random.range(emitter.scaleMin, emitter.scaleMax));
+
+		// spread the first deaths over the whole lifetime
+		_mm_storeu_ps(&life[i], emitter.lifetimeMax > 0.0f ? random.range(0.0f, emitter.lifetimeMax) : _mm_set1_ps(FLT_MAX));
+
+		float angles[4];
+		_mm_storeu_ps(angles, random.range(0.0f, TWO_PI));
+		for (int lane = 0; lane < 4; lane++)
+		{
+			float s = sin(0.5f * angles[lane]);
+			qx[i + lane] = axis.x * s;
+			qy[i + lane] = axis.y * s;
+			qz[i + lane] = axis.z * s;
+			qw[i + lane] = cos(0.5f * angles[lane]);
+		}
+	}
+}
+
+void ParticleSystem::writeInstances(unsigned int emitter, InstanceFormat format, unsigned char *instances, const unsigned int *order) const {
+
+	const EmitterRange &range = emitters[emitter];
+
+	pool->parallelFor(range.count, PARALLEL_GRAIN, [this, &range, format, instances, order](size_t begin, size_t end) {
+		for (size_t n = begin; n < end; n++)
+		{
+			size_t i = range.first + (order ? order[n] : n);
+			packInstance(format, instances, n, glm::vec3(x[i], y[i], z[i]), scale[i], glm::vec4(qx[i], qy[i], qz[i], qw[i]));
+		}
+	});
+}
+
+const ParticleEmitter& ParticleSystem::getEmitter(unsigned int emitter) const {
+	return emitters[emitter].emitter;
+}
+
+size_t ParticleSystem::getCount(unsigned int emitter) const {
+	return emitters[emitter].count;
+}
+
+size_t ParticleSystem::getFirst(unsigned int emitter) const {
+	return emitters[emitter].first;
+}
+
+const float* ParticleSystem::getPositionsX() const {
+	return &x[0];
+}
+
+const float* ParticleSystem::getPositionsY() const {
+	return &y[0];
+}
+
+const float* ParticleSystem::getPositionsZ() const {
+	return &z[0];
+}
+
+const float* ParticleSystem::getScales() const {
+	return &scale[0];
+}
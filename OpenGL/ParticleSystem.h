@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+#include <glm\glm.hpp>
+
+#include "DistanceField.h"
+#include "InstanceFormat.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+// Particles (re)spawn inside the spawn box and are recycled once they leave the bounds, touch the level
+// or run out of lifetime. A lifetime of zero keeps them alive until one of the other two happens.
+struct ParticleEmitter {
+	glm::vec3 spawnMin, spawnMax;
+	glm::vec3 boundsMin, boundsMax;
+	glm::vec3 velocity;
+	glm::vec3 velocityJitter;
+	glm::vec3 rotationAxis;
+	float lifetimeMin, lifetimeMax;
+	float scaleMin, scaleMax;
+	float collisionRadius;
+};
+
+// CPU particles in structure of arrays form. Every emitter owns a range of particles that starts on a multiple
+// of four, the update runs four particles at a time in chunks spread over the thread pool.
+class ParticleSystem
+{
+public:
+
+	ParticleSystem(const DistanceField *field = nullptr, unsigned int seed = 1);
+	~ParticleSystem();
+
+	// Adds count particles spread over the emitter bounds, returns the emitter index
+	unsigned int addEmitter(const ParticleEmitter &emitter, size_t count);
+
+	void update(float deltaTime);
+
+	// Per-instance data of the emitter's particles in the given format, in particle order or, with order, instance n
+	// from the emitter's particle order[n]
+	void writeInstances(unsigned int emitter, InstanceFormat format, unsigned char *instances, const unsigned int *order = nullptr) const;
+
+	const ParticleEmitter& getEmitter(unsigned int emitter) const;
+	size_t getCount(unsigned int emitter) const;
+	size_t getFirst(unsigned int emitter) const;
+	const float* getPositionsX() const;
+	const float* getPositionsY() const;
+	const float* getPositionsZ() const;
+	const float* getScales() const;
+
+private:
+
+	struct EmitterRange {
+		ParticleEmitter emitter;
+		size_t first, count, padded;
+	};
+
+	ThreadPool *pool;
+	const DistanceField *field;
+	unsigned int seed, frame;
+
+	vector<EmitterRange> emitters;
+
+	vector<float> x, y, z;
+	vector<float> vx, vy, vz;
+	vector<float> life;
+	vector<float> scale;
+	vector<float> qx, qy, qz, qw;
+	vector<unsigned char> hits;
+
+	void updateRange(const ParticleEmitter &emitter, size_t begin, size_t end, float deltaTime, unsigned int stream);
+	void fill(const ParticleEmitter &emitter, size_t begin, size_t end, unsigned int stream);
+};
@@ -0,0 +1,165 @@
+#include "PortalGraph.h"
+
+#include <iostream>
+
+static const float DOOR_MATCH_DISTANCE = 0.01f;
+static const float MIN_CLIP_W = 1e-4f;
+
+PortalGraph::PortalGraph() {}
+
+void PortalGraph::addCell(string name, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) {
+
+	Cell cell;
+	cell.name = name;
+	cell.boundsMin = boundsMin;
+	cell.boundsMax = boundsMax;
+
+	cellIndex[name] = (unsigned int)cells.size();
+	cells.push_back(cell);
+}
+
+void PortalGraph::addDoor(string cell, const glm::vec3 corners[4]) {
+
+	auto iter = cellIndex.find(cell);
+	if (iter == cellIndex.end()) {
+		cout << "PortalGraph: door of unknown cell " << cell << endl;
+		return;
+	}
+
+	Door door;
+	door.cell = iter->second;
+	door.center = (corners[0] + corners[1] + corners[2] + corners[3]) * 0.25f;
+	for (int i = 0; i < 4; i++)
+		door.corners[i] = corners[i];
+
+	// the other side of the doorway may already be waiting
+	for (size_t i = 0; i < openDoors.size(); i++)
+	{
+		if (openDoors[i].cell != door.cell && glm::distance(openDoors[i].center, door.center) < DOOR_MATCH_DISTANCE) {
+			Portal portal;
+			portal.cells[0] = openDoors[i].cell;
+			portal.cells[1] = door.cell;
+			for (int c = 0; c < 4; c++)
+				portal.corners[c] = corners[c];
+
+			unsigned int index = (unsigned int)portals.size();
+			portals.push_back(portal);
+			cells[portal.cells[0]].portals.push_back(index);
+			cells[portal.cells[1]].portals.push_back(index);
+
+			openDoors.erase(openDoors.begin() + i);
+			return;
+		}
+	}
+
+	openDoors.push_back(door);
+}
+
+int PortalGraph::getCell(string name) const {
+
+	auto iter = cellIndex.find(name);
+	return iter == cellIndex.end() ? -1 : (int)iter->second;
+}
+
+int PortalGraph::findCell(const glm::vec3 &position) const {
+
+	for (size_t i = 0; i < cells.size(); i++)
+	{
+		const Cell &cell = cells[i];
+		if (position.x >= cell.boundsMin.x && position.y >= cell.boundsMin.y && position.z >= cell.boundsMin.z &&
+			position.x <= cell.boundsMax.x && position.y <= cell.boundsMax.y && position.z <= cell.boundsMax.z)
+			return (int)i;
+	}
+
+	return -1;
+}
+
+const string& PortalGraph::getCellName(unsigned int cell) const {
+	return cells[cell].name;
+}
+
+size_t PortalGraph::getCellCount() const {
+	return cells.size();
+}
+
+size_t PortalGraph::getPortalCount() const {
+	return portals.size();
+}
+
+bool PortalGraph::findVisibleCells(const glm::vec3 &eye, const glm::mat4 &viewProjection, vector<unsigned char> &visible, vector<glm::vec4> &rects) const {
+
+	visible.assign(cells.size(), 0);
+	rects.assign(cells.size(), glm::vec4(1.0f, 1.0f, -1.0f, -1.0f));
+
+	int start = findCell(eye);
+	if (start < 0)
+		return false;
+
+	vector<unsigned int> path;
+	visit((unsigned int)start, glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f), viewProjection, path, visible, rects);
+	return true;
+}
+
+void PortalGraph::visit(unsigned int cell, const glm::vec4 &rect, const glm::mat4 &viewProjection, vector<unsigned int> &path,
+	vector<unsigned char> &visible, vector<glm::vec4> &rects) const {
+
+	// a cell seen through several doors is seen through the union of them
+	visible[cell] = 1;
+	glm::vec4 &seen = rects[cell];
+	seen = glm::vec4(glm::min(seen.x, rect.x), glm::min(seen.y, rect.y), glm::max(seen.z, rect.z), glm::max(seen.w, rect.w));
+
+	path.push_back(cell);
+
+	for (unsigned int index : cells[cell].portals)
+	{
+		const Portal &portal = portals[index];
+		unsigned int next = portal.cells[0] == cell ? portal.cells[1] : portal.cells[0];
+
+		bool onPath = false;
+		for (unsigned int previous : path)
+			onPath |= previous == next;
+		if (onPath)
+			continue;
+
+		glm::vec4 door;
+		int side = project(portal, viewProjection, door);
+		if (side < 0)
+			continue;
+		if (side == 0)
+			door = rect;
+
+		glm::vec4 narrowed(glm::max(rect.x, door.x), glm::max(rect.y, door.y), glm::min(rect.z, door.z), glm::min(rect.w, door.w));
+		if (narrowed.x >= narrowed.z || narrowed.y >= narrowed.w)
+			continue;
+
+		visit(next, narrowed, viewProjection, path, visible, rects);
+	}
+
+	path.pop_back();
+}
+
+// Screen rectangle of the door. Returns -1 when the whole door is behind the eye, 0 when only some corners are
+// (the eye stands in the doorway and the door cannot narrow anything) and 1 when the rectangle is valid.
+int PortalGraph::project(const Portal &portal, const glm::mat4 &viewProjection, glm::vec4 &rect) const {
+
+	rect = glm::vec4(1e30f, 1e30f, -1e30f, -1e30f);
+	int behind = 0;
+
+	for (int i = 0; i < 4; i++)
+	{
+		glm::vec4 clip = viewProjection * glm::vec4(portal.corners[i], 1.0f);
+		if (clip.w < MIN_CLIP_W) {
+			behind++;
+			continue;
+		}
+
+		float x = clip.x / clip.w;
+		float y = clip.y / clip.w;
+		rect = glm::vec4(glm::min(rect.x, x), glm::min(rect.y, y), glm::max(rect.z, x), glm::max(rect.w, y));
+	}
+
+	if (behind == 4)
+		return -1;
+
+	return behind == 0 ? 1 : 0;
+}
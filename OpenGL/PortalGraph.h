@@ -0,0 +1,61 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <glm\glm.hpp>
+
+using namespace std;
+
+// Cells (rooms) connected by portals (door openings). The room builder adds every room as a cell and the
+// opening of every door from both sides; the two openings of a doorway meet at the same spot and become a portal.
+class PortalGraph
+{
+public:
+
+	PortalGraph();
+
+	void addCell(string name, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax);
+
+	// corners of the opening in order around it, the cell must already exist
+	void addDoor(string cell, const glm::vec3 corners[4]);
+
+	int getCell(string name) const;
+	int findCell(const glm::vec3 &position) const;
+	const string& getCellName(unsigned int cell) const;
+	size_t getCellCount() const;
+	size_t getPortalCount() const;
+
+	// Walks the portals from the cell holding the eye, narrowing the screen rectangle (min x, min y, max x, max y
+	// in normalized device coordinates) through every door. Cells never reached keep visible at 0. Returns false
+	// when the eye is outside every cell, then nothing can be said.
+	bool findVisibleCells(const glm::vec3 &eye, const glm::mat4 &viewProjection, vector<unsigned char> &visible, vector<glm::vec4> &rects) const;
+
+private:
+
+	struct Cell {
+		string name;
+		glm::vec3 boundsMin, boundsMax;
+		vector<unsigned int> portals;
+	};
+
+	struct Portal {
+		unsigned int cells[2];
+		glm::vec3 corners[4];
+	};
+
+	struct Door {
+		unsigned int cell;
+		glm::vec3 corners[4];
+		glm::vec3 center;
+	};
+
+	vector<Cell> cells;
+	vector<Portal> portals;
+	vector<Door> openDoors;
+	map<string, unsigned int> cellIndex;
+
+	void visit(unsigned int cell, const glm::vec4 &rect, const glm::mat4 &viewProjection, vector<unsigned int> &path,
+		vector<unsigned char> &visible, vector<glm::vec4> &rects) const;
+	int project(const Portal &portal, const glm::mat4 &viewProjection, glm::vec4 &rect) const;
+};
@@ -0,0 +1,105 @@
+#include "RenderQueue.h"
+
+#include <cstring>
+
+RenderQueue::RenderQueue() {}
+
+uint64_t RenderQueue::makeKey(RenderPass pass, bool translucent, unsigned int shader, unsigned int material, unsigned int mesh, float depth) {
+
+	// the bits of a non-negative float grow with its value
+	uint32_t depthBits;
+	depth = depth > 0.0f ? depth : 0.0f;
+	memcpy(&depthBits, &depth, sizeof(depthBits));
+
+	uint64_t state = ((uint64_t)(shader & 0xFF) << 16) | ((uint64_t)(material & 0xFF) << 8) | (uint64_t)(mesh & 0xFF);
+	uint64_t key = (uint64_t)(pass & 0xF) << 60;
+
+	if (translucent)
+		key |= (uint64_t)1 << 59 | (uint64_t)(~depthBits) << 27 | state << 3;
+	else
+		key |= state << 35 | (uint64_t)depthBits << 3;
+
+	return key;
+}
+
+unsigned int RenderQueue::idOf(const void *object) {
+
+	auto iter = ids.find(object);
+	if (iter != ids.end())
+		return iter->second;
+
+	// past 256 objects ids are shared, which only costs some grouping
+	unsigned int id = (unsigned int)ids.size() & 0xFF;
+	ids[object] = id;
+	return id;
+}
+
+void RenderQueue::submit(RenderPass pass, bool translucent, const void *shader, const void *material, const void *mesh, float depth, const function<void()> &draw) {
+
+	unsigned int shaderId = idOf(shader);
+	unsigned int materialId = idOf(material);
+	unsigned int meshId = idOf(mesh);
+
+	keys.push_back(makeKey(pass, translucent, shaderId, materialId, meshId, depth));
+	draws.push_back(draw);
+}
+
+// Least significant byte first radix sort of the keys together with their submission index. Each pass is
+// stable, so equal keys keep the submission order. Bytes that are the same for every key are skipped.
+void RenderQueue::sort() {
+
+	size_t count = keys.size();
+	sortedKeys.assign(keys.begin(), keys.end());
+	scratchKeys.resize(count);
+	order.resize(count);
+	scratchOrder.resize(count);
+
+	for (size_t i = 0; i < count; i++)
+		order[i] = (uint32_t)i;
+
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		size_t histogram[256] = { 0 };
+		for (size_t i = 0; i < count; i++)
+			histogram[(sortedKeys[i] >> shift) & 0xFF]++;
+
+		if (histogram[(sortedKeys[0] >> shift) & 0xFF] == count)
+			continue;
+
+		size_t sum = 0;
+		for (int b = 0; b < 256; b++)
+		{
+			size_t bucket = histogram[b];
+			histogram[b] = sum;
+			sum += bucket;
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			size_t slot = histogram[(sortedKeys[i] >> shift) & 0xFF]++;
+			scratchKeys[slot] = sortedKeys[i];
+			scratchOrder[slot] = order[i];
+		}
+
+		sortedKeys.swap(scratchKeys);
+		order.swap(scratchOrder);
+	}
+}
+
+void RenderQueue::execute() {
+
+	if (keys.empty())
+		return;
+
+	sort();
+
+	for (uint32_t index : order)
+		draws[index]();
+
+	keys.clear();
+	draws.clear();
+}
+
+size_t RenderQueue::getCount() const {
+	return keys.size();
+}
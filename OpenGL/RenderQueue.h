@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+// Passes run in order, everything of a pass is drawn before the next one starts
+enum RenderPass {
+	PASS_SCENE = 0
+};
+
+// Draws submitted in any order and executed sorted by a 64-bit key, most significant bits first:
+//   pass (4) | translucent (1) | opaque:      shader (8) | material (8) | mesh (8) | depth (32) | 3 unused
+//                              | translucent: inverted depth (32) | shader (8) | material (8) | mesh (8) | 3 unused
+// Opaque draws are grouped by state and go front to back inside a group, translucent ones go back to front.
+// Shaders, materials and meshes are any pointer, the queue hands out their 8-bit ids on first sight.
+class RenderQueue
+{
+public:
+
+	RenderQueue();
+
+	// depth is the non-negative distance from the camera
+	void submit(RenderPass pass, bool translucent, const void *shader, const void *material, const void *mesh, float depth, const function<void()> &draw);
+
+	// Sorts the frame's draws, runs them and empties the queue
+	void execute();
+
+	size_t getCount() const;
+
+	static uint64_t makeKey(RenderPass pass, bool translucent, unsigned int shader, unsigned int material, unsigned int mesh, float depth);
+
+private:
+
+	vector<uint64_t> keys, sortedKeys, scratchKeys;
+	vector<uint32_t> order, scratchOrder;
+	vector<function<void()>> draws;
+	map<const void*, unsigned int> ids;
+
+	unsigned int idOf(const void *object);
+	void sort();
+};
@@ -8,6 +8,13 @@ float quadVertices[] = {
 	 1.0f, -1.0f, 0.0f,		1.0f, 0.0f,
 };
 
+#ifndef GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT
+#define GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT 0x919F
+#endif
+
+// the water spheres are a little larger than their spacing so the water looks closed
+const float waterRadiusScale = 0.6f;
+
 RenderSystem* RenderSystem::renderSystem = nullptr;
 GLUquadricObj *quad;
 BulletWorld *_world = &BulletWorld::getBulletWorld();
@@ -18,23 +25,38 @@ RenderSystem::RenderSystem(): _window(glfwGetCurrentContext()) {
 
 	_world = &BulletWorld::getBulletWorld();
 	_camera = &Camera::getCamera();
+	_glState = &GLState::getGLState();
+	stateReportTime = glfwGetTime();
 	quad = gluNewQuadric();	
 
 	dustAmount = 20000;
 	bubblesAmount = 5000;
 	ballsAmount = 25;
 	boxesAmount = 10;
+	rocksAmount = 6;
+	extraLightsAmount = 0;
+	waterAmount = 50000;
 	exposure = 1.0f;
 	bloom = false;
+	dualFilterBloom = true;
+	temporalUpscale = true;
+	statelessParticles = true;
+	sphereImpostors = true;
 
 	initializeShaders();
 	initializeTextures();
 	initializeScreenQuad();
+	initializeBloom();
+	initializeTemporalUpscale();
+	initializeRenderScale();
 	initializeModels();
 	
 	_world->addFloor("floor", glm::vec3(0, 0, 0), glm::vec3(0, 1, 0), 0.0f);
 
 	addRooms("room");
+	initializeStaticGeometry();
+	levelField = new DistanceField(_world);
+	water = new FluidSystem(glm::vec3(-29.5f, 0.5f, 0.5f), glm::vec3(-10.5f, 19.5f, 19.5f), 19.5f, waterAmount); //inside room 5
 
 	_world->addBox("underwaterBox", 1.0f, 1.0f, 1.0f, -20.0f, 17.0f, 10.0f, 1.0f);
 	_world->getBody("underwaterBox")->setLinearVelocity(btVector3(0, 0, 0));
@@ -42,26 +64,48 @@ RenderSystem::RenderSystem(): _window(glfwGetCurrentContext()) {
 	_world->getBody("underwaterBox")->forceActivationState(true);
 
 	addBoxesToShake("cont", boxesAmount);
+	addRocksToShake("rock", rocksAmount);
 	addBallsToBounce("ball", ballsAmount);
 	
+	srand(glfwGetTime());
+	ambientParticles = new ParticleSystem(levelField, rand());
+
 	initializeDust();
 	initializeBubbles();
+	initializeParticleLods();
+
+	// room for a frame of simulated instances and light clusters (16 lights a cluster on average) plus 1 MB for everything else streamed.
+	// The motion pass streams the particles again and the water twice, with its positions of the last frame.
+	streamBuffer = new StreamBuffer(2 * (dustAmount * getInstanceStride(dustFormat) + bubblesAmount * getInstanceStride(bubblesFormat)) + 3 * waterAmount * getInstanceStride(INSTANCE_POSITION_SCALE)
+		+ LightClusters::GRID_X * LightClusters::GRID_Y * LightClusters::GRID_Z * (2 * sizeof(unsigned int) + 16 * sizeof(unsigned short)) + (1 << 20));
+	batcher = new DrawBatcher(streamBuffer);
+	impostors = new SphereImpostors(streamBuffer);
+	renderQueue = new RenderQueue();
+	initializeCulling();
+	initializeLights();
 }
 
 RenderSystem::~RenderSystem()
 {
 	glDeleteVertexArrays(1, &quadVAO);
-	glDeleteBuffers(1, &dustVBO);
-	glDeleteBuffers(1, &bubblesVBO);
+	glDeleteVertexArrays(1, &pointVAO);
+	_glState->deleteBuffer(dustSeedVBO);
+	_glState->deleteBuffer(bubblesSeedVBO);
 	glDeleteBuffers(1, &quadVAO);
 	glDeleteBuffers(1, &framebuffer);
 	glDeleteBuffers(1, &textureColorbuffer);
 	glDeleteBuffers(1, &hdrFBO);
-	glDeleteBuffers(1, &rboDepth);
+	glDeleteTextures(1, &depthBuffer);
 	glDeleteBuffers(2, attachments);
 	glDeleteBuffers(2, pingpongFBOs);
 	glDeleteBuffers(2, pingpongColorbuffers);
 	glDeleteBuffers(2, colorBuffers);
+	glDeleteFramebuffers(BLOOM_LEVELS, bloomFBOs);
+	glDeleteTextures(BLOOM_LEVELS, bloomBuffers);
+	glDeleteFramebuffers(1, &motionFBO);
+	glDeleteTextures(1, &motionBuffer);
+	glDeleteFramebuffers(2, historyFBOs);
+	glDeleteTextures(2, historyBuffers);
 
 	for (auto iter : Shaders)
 		glDeleteProgram(iter.second->programID);
@@ -71,7 +115,27 @@ RenderSystem::~RenderSystem()
 	delete cubeModel;
 	delete sphereModel;
 	delete dustModel;
+	delete levelField;
+	delete water;
+	delete ambientParticles;
+	delete batcher;
+	delete impostors;
+	delete renderQueue;
+	delete occlusion;
+	delete bloomTimer;
+	delete frameTimer;
+	delete lightClusters;
+	glDeleteTextures(1, &lightDataTexture);
+	glDeleteTextures(1, &clusterTexture);
+	_glState->deleteBuffer(clusterBuffer);
+	_glState->deleteBuffer(lightIndexBuffer);
+	glDeleteTextures(1, &lightIndexTexture);
+	_glState->deleteBuffer(lightDataBuffer);
+	delete streamBuffer;
+	delete staticGeometry;
 	delete _world;
+
+	GLState::destroyGLState();
 }
 
 RenderSystem& RenderSystem::getRenderSystem() {
@@ -88,51 +152,87 @@ void RenderSystem::destroyRenderSystem() {
 	delete renderSystem;
 }
 
-void RenderSystem::render() {
+void RenderSystem::render(float deltaTime) {
 	
 	applyWind();
 	applyEathquake();
+	// the water steps on its own thread during the frame and pushes the bodies at the start of the next one
+	water->wait();
 	applyUnderwater();
+	water->beginStep(_world->getTimeStep());
+	if (!statelessParticles)
+		ambientParticles->update(glm::min(deltaTime, 0.1f));
 	_world->stepSimulate();
 
 	btVector3 cam = _world->getBody("player")->getCenterOfMassPosition();
 	_camera->Position = glm::vec3(cam.getX(), cam.getY(), cam.getZ());
 
+	// nothing to draw into while the window is minimized, sleep until an event (the restore) arrives
+	int width, height;
+	glfwGetFramebufferSize(_window, &width, &height);
+	if (width <= 0 || height <= 0) {
+		glfwWaitEvents();
+		return;
+	}
+
+	updateRenderScale();
+	if (width != windowWidth || height != windowHeight)
+		resizeHistory(width, height);
+	windowWidth = width;
+	windowHeight = height;
+	unsigned int sceneWidth = glm::max((unsigned int)(windowWidth * renderScale), 1u);
+	unsigned int sceneHeight = glm::max((unsigned int)(windowHeight * renderScale), 1u);
+	if (sceneWidth != renderWidth || sceneHeight != renderHeight)
+		resizeTargets(sceneWidth, sceneHeight);
+
+	// only the GPU passes are timed, the culling, light assignment and streaming in between would count the GPU
+	// waiting for the CPU and lower the resolution of frames it cannot help
+	frameTimer->begin();
 	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	
-	glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+	_glState->bindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+	glViewport(0, 0, renderWidth, renderHeight);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	frameTimer->end();
 
-	glm::mat4 projection = glm::perspective(glm::radians(_camera->Zoom), 1280.0f / 720.0f, 0.1f, 100.0f);
+	glm::mat4 projection = glm::perspective(glm::radians(_camera->Zoom), (float)windowWidth / windowHeight, 0.1f, 100.0f);
 	glm::mat4 view = _camera->GetViewMatrix();
+	pixelsPerUnit = renderHeight / (2.0f * tan(glm::radians(_camera->Zoom) * 0.5f));
+
+	// only the drawing is jittered, the culling keeps the real frustum
+	glm::vec2 jitter(0.0f);
+	glm::mat4 jittered = temporalUpscale ? jitterProjection(projection, jitter) : projection;
+
+	// the walls are drawn on the CPU while the GL setup and the other culling run
+	occlusion->render(projection * view);
+	uploadUniformBlocks(jittered, view);
+
+	cullScene(projection * view);
+	uploadLightClusters(projection, view);
+	queueScene();
+	frameTimer->begin();
+	renderQueue->execute();
+	frameTimer->end();
+
+	frameTimer->begin();
+	unsigned int scene = colorBuffers[0];
+	if (temporalUpscale) {
+		renderMotion();
+		scene = applyTemporalUpscale(jittered * view, jitter);
+		previousViewProjection = projection * view;
+	}
 
-	setupLightsParameter(glm::vec3(0.60f, 0.65f, 1.0f), glm::vec3(-20.0f, 10.0f, 10.0f));
-	renderBox("underwaterBox", projection, view, glm::vec3(0, 0, 0));
-	
-	renderRoom1("room_1", projection, view, glm::vec3(0.9f, 0.9f, 0.8f)); //beige
-
-	renderRoom2("room_2", projection, view, glm::vec3(2.0f, 0.6f, 0.8f)); //pink
-	renderBallsToBounce("ball", projection, view, ballsAmount);
-
-	renderRoom3("room_3", projection, view, glm::vec3(0.7f, 2.0f, 0.7f)); //green
-	renderDust(projection, view, dustAmount, dustModelMatrices);
-
-	renderRoom4("room_4", projection, view, glm::vec3(0.9f, 0.9f, 0.8f)); //beige
-
-	renderRoom5("room_5", projection, view, glm::vec3(0.60f, 0.65f, 1.0f)); //blue
-	renderBubbles(projection, view, bubblesAmount, bubblesModelMatrices);
-
-	renderRoom6("room_6", projection, view, glm::vec3(1.6f, 1.0f, 0.6f)); //brown
-	renderBoxesToShake("cont", projection, view, boxesAmount);
-	
-	renderWaterWaves(projection, view);
-
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	_glState->bindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	applyBloom();
+	applyBloom(scene);
 
 	renderScreen();
+	frameTimer->end();
+	frameTimer->endFrame();
+
+	streamBuffer->endFrame();
+	reportStateCalls();
 
 	glfwSwapBuffers(_window);
 	glfwPollEvents();
@@ -140,9 +240,13 @@ void RenderSystem::render() {
 
 void RenderSystem::initializeModels() {
 
-	sphereModel = new Model("../models/sphere.obj");
+	sphereModel = new Model("../models/sphere.obj", false, 4);
 	cubeModel = new Model("../models/cube.obj");
-	dustModel = new Model("../models/rock.obj");
+	dustModel = new Model("../models/rock.obj", false, 4);
+
+	// the impostors take the instance scales the sphere mesh was drawn with
+	getShader("impostor")->Use();
+	getShader("impostor")->setFloat("radiusScale"_u, sphereModel->getRadius());
 }
 
 void RenderSystem::addShader(Shader *shader, string name) {
@@ -163,24 +267,99 @@ void RenderSystem::initializeShaders() {
 	shader = new Shader("wind.vert", "wind.frag");
 	addShader(shader, "wind");
 
-	shader = new Shader("wave.vert", "wave.frag");
-	addShader(shader, "wave");
+	shader = new Shader("ambient.vert", "wind.frag");
+	addShader(shader, "ambient");
+
+	shader = new Shader("point.vert", "point.frag");
+	addShader(shader, "windPoints");
+
+	shader = new Shader("ambientPoint.vert", "point.frag");
+	addShader(shader, "ambientPoints");
+
+	shader = new Shader("impostor.vert", "impostor.frag");
+	addShader(shader, "impostor");
+
 
 	shader = new Shader("gaussianBlur.vert", "gaussianBlur.frag");
 	addShader(shader, "blur");
 
+	shader = new Shader("gaussianBlur.vert", "bloomDown.frag");
+	addShader(shader, "bloomDown");
+
+	shader = new Shader("gaussianBlur.vert", "bloomUp.frag");
+	addShader(shader, "bloomUp");
+
+	shader = new Shader("motion.vert", "motion.frag");
+	addShader(shader, "motion");
+
+	shader = new Shader("wind.vert", "reactive.frag");
+	addShader(shader, "windReactive");
+
+	shader = new Shader("ambient.vert", "reactive.frag");
+	addShader(shader, "ambientReactive");
+
+	shader = new Shader("point.vert", "reactive.frag");
+	addShader(shader, "windPointsReactive");
+
+	shader = new Shader("ambientPoint.vert", "reactive.frag");
+	addShader(shader, "ambientPointsReactive");
+
+	shader = new Shader("gaussianBlur.vert", "taa.frag");
+	addShader(shader, "taa");
+
 	shader = new Shader("bloom_final.vert", "bloom_final.frag");
 	addShader(shader, "bloomFinal");
 
+	for (auto iter : Shaders)
+	{
+		iter.second->bindUniformBlock("FrameData", FRAME_BLOCK);
+	}
+
+	getShader("light")->Use();
+	getShader("light")->setInt("material.diffuse"_u, 0);
+	getShader("light")->setFloat("material.shininess"_u, 64.0f);
+	getShader("light")->setInt("clusterLights"_u, LIGHT_TEXTURE_UNIT);
+	getShader("light")->setInt("lightIndices"_u, LIGHT_TEXTURE_UNIT + 1);
+	getShader("light")->setInt("lightData"_u, LIGHT_TEXTURE_UNIT + 2);
+
+	getShader("impostor")->Use();
+	getShader("impostor")->setInt("material.diffuse"_u, 0);
+	getShader("impostor")->setFloat("material.shininess"_u, 64.0f);
+	getShader("impostor")->setInt("diffuseTexture"_u, 0);
+	getShader("impostor")->setInt("clusterLights"_u, LIGHT_TEXTURE_UNIT);
+	getShader("impostor")->setInt("lightIndices"_u, LIGHT_TEXTURE_UNIT + 1);
+	getShader("impostor")->setInt("lightData"_u, LIGHT_TEXTURE_UNIT + 2);
+
 	getShader("wind")->Use();
-	getShader("wind")->setInt("texture_diffuse1", 0);
+	getShader("wind")->setInt("texture_diffuse1"_u, 0);
+
+	getShader("ambient")->Use();
+	getShader("ambient")->setInt("texture_diffuse1"_u, 0);
+
+	getShader("windPoints")->Use();
+	getShader("windPoints")->setInt("texture_diffuse1"_u, 0);
+
+	getShader("ambientPoints")->Use();
+	getShader("ambientPoints")->setInt("texture_diffuse1"_u, 0);
 
 	getShader("blur")->Use();
-	getShader("blur")->setInt("image", 0);
+	getShader("blur")->setInt("image"_u, 0);
+
+	getShader("bloomDown")->Use();
+	getShader("bloomDown")->setInt("image"_u, 0);
+
+	getShader("bloomUp")->Use();
+	getShader("bloomUp")->setInt("image"_u, 0);
+
+	getShader("taa")->Use();
+	getShader("taa")->setInt("scene"_u, 0);
+	getShader("taa")->setInt("depth"_u, 1);
+	getShader("taa")->setInt("motion"_u, 2);
+	getShader("taa")->setInt("history"_u, 3);
 
 	getShader("bloomFinal")->Use();
-	getShader("bloomFinal")->setInt("scene", 0);
-	getShader("bloomFinal")->setInt("bloomBlur", 1);
+	getShader("bloomFinal")->setInt("scene"_u, 0);
+	getShader("bloomFinal")->setInt("bloomBlur"_u, 1);
 }
 
 void RenderSystem::initializeTextures() {
@@ -210,8 +389,8 @@ void RenderSystem::initializeScreenQuad() {
 
 	glGenVertexArrays(1, &quadVAO);
 	glGenBuffers(1, &quadVBO);
-	glBindVertexArray(quadVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+	_glState->bindVertexArray(quadVAO);
+	_glState->bindBuffer(GL_ARRAY_BUFFER, quadVBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
@@ -219,13 +398,12 @@ void RenderSystem::initializeScreenQuad() {
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
 
 	glGenFramebuffers(1, &hdrFBO);
-	glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+	_glState->bindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
 	// create 2 floating point color buffers (1 for normal rendering, other for brightness treshold values)
 	glGenTextures(2, colorBuffers);
 	for (unsigned int i = 0; i < 2; i++)
 	{
-		glBindTexture(GL_TEXTURE_2D, colorBuffers[i]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
+		_glState->bindTexture(0, GL_TEXTURE_2D, colorBuffers[i]);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -234,34 +412,195 @@ void RenderSystem::initializeScreenQuad() {
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colorBuffers[i], 0);
 	}
 
-	glGenRenderbuffers(1, &rboDepth);
-	glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, SCR_WIDTH, SCR_HEIGHT);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
+	// a texture rather than a renderbuffer, the temporal upscale reprojects from it
+	glGenTextures(1, &depthBuffer);
+	_glState->bindTexture(0, GL_TEXTURE_2D, depthBuffer);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthBuffer, 0);
 
 	glDrawBuffers(2, attachments);
-
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-		std::cout << "Framebuffer not complete!" << std::endl;
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	_glState->bindFramebuffer(GL_FRAMEBUFFER, 0);
 
 	
 	glGenFramebuffers(2, pingpongFBOs);
 	glGenTextures(2, pingpongColorbuffers);
 	for (unsigned int i = 0; i < 2; i++)
 	{
-		glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBOs[i]);
-		glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[i]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
+		_glState->bindFramebuffer(GL_FRAMEBUFFER, pingpongFBOs[i]);
+		_glState->bindTexture(0, GL_TEXTURE_2D, pingpongColorbuffers[i]);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pingpongColorbuffers[i], 0);
+	}
+	_glState->bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Half resolution down to 1/32, the bright parts are blurred on the way down and back up the chain
+void RenderSystem::initializeBloom() {
+
+	glGenFramebuffers(BLOOM_LEVELS, bloomFBOs);
+	glGenTextures(BLOOM_LEVELS, bloomBuffers);
+	for (int level = 0; level < BLOOM_LEVELS; level++)
+	{
+		_glState->bindFramebuffer(GL_FRAMEBUFFER, bloomFBOs[level]);
+		_glState->bindTexture(0, GL_TEXTURE_2D, bloomBuffers[level]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, bloomBuffers[level], 0);
+	}
+	_glState->bindFramebuffer(GL_FRAMEBUFFER, 0);
 
+	bloomTimer = new GpuTimer();
+}
+
+void RenderSystem::initializeTemporalUpscale() {
+
+	historyIndex = 0;
+	jitterIndex = 0;
+	historyValid = false;
+	previousViewProjection = glm::mat4(1.0f);
+
+	// the body motion and the reactive mark of the particles are drawn over the scene depth
+	glGenFramebuffers(1, &motionFBO);
+	glGenTextures(1, &motionBuffer);
+	_glState->bindFramebuffer(GL_FRAMEBUFFER, motionFBO);
+	_glState->bindTexture(0, GL_TEXTURE_2D, motionBuffer);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, motionBuffer, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthBuffer, 0);
+
+	glGenFramebuffers(2, historyFBOs);
+	glGenTextures(2, historyBuffers);
+	for (unsigned int i = 0; i < 2; i++)
+	{
+		_glState->bindFramebuffer(GL_FRAMEBUFFER, historyFBOs[i]);
+		_glState->bindTexture(0, GL_TEXTURE_2D, historyBuffers[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, historyBuffers[i], 0);
+	}
+	_glState->bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void RenderSystem::initializeRenderScale() {
+
+	// the temporal upscale rebuilds the window resolution from about half its pixels
+	maxRenderScale = temporalUpscale ? 0.75f : 1.0f;
+	renderScale = maxRenderScale;
+	minRenderScale = 0.5f;
+	frameBudget = 14.0f;
+	smoothedFrameTime = 0.0f;
+	scaleChangeTime = glfwGetTime();
+	frameTimer = new GpuTimer();
+
+	int width, height;
+	glfwGetFramebufferSize(_window, &width, &height);
+	windowWidth = glm::max(width, 1);
+	windowHeight = glm::max(height, 1);
+	resizeTargets((unsigned int)(windowWidth * renderScale), (unsigned int)(windowHeight * renderScale));
+	resizeHistory(windowWidth, windowHeight);
+}
+
+// (Re)allocates the scene targets at width x height, the window keeps its own size and the last pass stretches
+// the scene over it
+void RenderSystem::resizeTargets(unsigned int width, unsigned int height) {
+
+	renderWidth = width;
+	renderHeight = height;
+
+	for (unsigned int i = 0; i < 2; i++)
+	{
+		_glState->bindTexture(0, GL_TEXTURE_2D, colorBuffers[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
+		_glState->bindTexture(0, GL_TEXTURE_2D, pingpongColorbuffers[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
+	}
+
+	_glState->bindTexture(0, GL_TEXTURE_2D, depthBuffer);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	_glState->bindTexture(0, GL_TEXTURE_2D, motionBuffer);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+
+	for (int level = 0; level < BLOOM_LEVELS; level++)
+	{
+		_glState->bindTexture(0, GL_TEXTURE_2D, bloomBuffers[level]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, glm::max(width >> (level + 1), 1u), glm::max(height >> (level + 1), 1u), 0, GL_RGB, GL_FLOAT, NULL);
+	}
+
+	_glState->bindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "Framebuffer not complete!" << std::endl;
+	for (unsigned int i = 0; i < 2; i++)
+	{
+		_glState->bindFramebuffer(GL_FRAMEBUFFER, pingpongFBOs[i]);
 		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 			std::cout << "Framebuffer not complete!" << std::endl;
-	}	
+	}
+	for (int level = 0; level < BLOOM_LEVELS; level++)
+	{
+		_glState->bindFramebuffer(GL_FRAMEBUFFER, bloomFBOs[level]);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "Framebuffer not complete!" << std::endl;
+	}
+	_glState->bindFramebuffer(GL_FRAMEBUFFER, motionFBO);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "Framebuffer not complete!" << std::endl;
+	_glState->bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// The history follows the window, a new one has nothing to reproject from
+void RenderSystem::resizeHistory(unsigned int width, unsigned int height) {
+
+	for (unsigned int i = 0; i < 2; i++)
+	{
+		_glState->bindTexture(0, GL_TEXTURE_2D, historyBuffers[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
+
+		_glState->bindFramebuffer(GL_FRAMEBUFFER, historyFBOs[i]);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "Framebuffer not complete!" << std::endl;
+	}
+	_glState->bindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	historyValid = false;
+}
+
+// Moves the scene resolution toward the frame budget. The GPU time follows the pixel count, so the scale moves
+// by the square root of how far off the budget it is, in steps of 1/16 and at most twice a second since the
+// timings come back a few frames late.
+void RenderSystem::updateRenderScale() {
+
+	float gpuTime = frameTimer->takeAverage();
+	if (gpuTime > 0.0f)
+		smoothedFrameTime = smoothedFrameTime > 0.0f ? glm::mix(smoothedFrameTime, gpuTime, 0.1f) : gpuTime;
+
+	double now = glfwGetTime();
+	if (smoothedFrameTime <= 0.0f || now - scaleChangeTime < 0.5)
+		return;
+
+	// some room under the budget before going back up, so the scale does not swing around it
+	float ratio = frameBudget / smoothedFrameTime;
+	if (ratio >= 1.0f && ratio < 1.25f)
+		return;
+
+	float scale = glm::clamp(floor(renderScale * sqrt(ratio) * 16.0f + 0.5f) / 16.0f, minRenderScale, maxRenderScale);
+	if (scale == renderScale)
+		return;
+
+	renderScale = scale;
+	scaleChangeTime = now;
 }
 
 Shader* RenderSystem::getShader(string name) {
@@ -294,6 +633,23 @@ void RenderSystem::addRooms(string name) {
 	_world->addRoom6(name + "_6", 20.0f, 20.0f, 20.0f, 20.0f, 0.0f, 20.0f); //eartquake
 }
 
+void RenderSystem::initializeStaticGeometry() {
+
+	// every wall of a room shares its texture and lights, so a room is one batch
+	staticGeometry = new StaticGeometry();
+
+	for (auto iter : _world->getRooms())
+	{
+		if (iter.second->getCollisionShape()->getShapeType() != BOX_SHAPE_PROXYTYPE)
+			continue;
+
+		string room = iter.first.substr(0, iter.first.find('.'));
+		staticGeometry->add(room, cubeModel, getBoxModelMatrix(iter.second));
+	}
+
+	staticGeometry->bake();
+}
+
 void RenderSystem::addBallsToBounce(string name, unsigned int amount) {
 
 	float maxX = -(11 - 0.0002f);
@@ -318,6 +674,7 @@ void RenderSystem::addBallsToBounce(string name, unsigned int amount) {
 
 		_world->getBody(name + to_string(i))->setLinearVelocity(btVector3(x, y, z));
 		_world->getBody(name + to_string(i))->setRestitution(1.1f);
+		balls.push_back(_world->getBody(name + to_string(i)));
 	}
 }
 
@@ -335,685 +692,1070 @@ void RenderSystem::addBoxesToShake(string name, unsigned int amount) {
 
 		_world->addBox(name + to_string(i), 1, 1, 1, x, 5.0f, z, 10.0f);
 		_world->getBody(name + to_string(i))->setAngularFactor(1);
+		boxes.push_back(_world->getBody(name + to_string(i)));
 	}
 }
 
-void RenderSystem::initializeDust() {
-
-	dustModelMatrices = new glm::mat4[dustAmount];
+// rock.obj about a unit across, its convex hull is computed once and cached next to the model
+void RenderSystem::addRocksToShake(string name, unsigned int amount) {
 
-	srand(glfwGetTime());
-
-	float minX = (11 - 0.0002f);
 	float maxX = (29 + 0.0002f);
-	float minY = (0 + 0.0002f);
-	float maxY = (19 - 0.0002f);
-	float minZ = (-19 - 0.0002f);
-	float maxZ = (-1 + 0.0002f);
+	float minX = (13 - 0.0002f);
+	float minZ = (2 - 0.0002f);
+	float maxZ = (19 + 0.0002f);
+	float scale = 0.5f / dustModel->getRadius();
 
-	for (unsigned int i = 0; i < dustAmount; i++)
+	for (unsigned int i = 0; i < amount; i++)
 	{
-		glm::mat4 model;
-
 		float x = minX + (((float)rand()) / (float)RAND_MAX) * (maxX - minX);
 		float z = minZ + (((float)rand()) / (float)RAND_MAX) * (maxZ - minZ);
-		float y = minY + (((float)rand()) / (float)RAND_MAX) * (maxY - minY);
-
-		model = glm::translate(model, glm::vec3(x, y, z));
 
-		float scale = (rand() % 1) / 100.0f + 0.005f;
-		model = glm::scale(model, glm::vec3(scale));
-
-		float rotAngle = (rand() % 360);
-		model = glm::rotate(model, rotAngle, glm::vec3(0.4f, 0.6f, 0.8f));
-
-		dustModelMatrices[i] = model;
+		_world->addConvexMesh(name + to_string(i), dustModel, scale, x, 8.0f, z, 10.0f);
+		_world->getBody(name + to_string(i))->setAngularFactor(1);
+		rocks.push_back(_world->getBody(name + to_string(i)));
 	}
+}
 
-	glGenBuffers(1, &dustVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, dustVBO);
-	glBufferData(GL_ARRAY_BUFFER, dustAmount * sizeof(glm::mat4), &dustModelMatrices[0], GL_STREAM_DRAW);
+void RenderSystem::initializeDust() {
 
-	for (unsigned int i = 0; i < dustModel->meshes.size(); i++)
-	{
-		unsigned int VAO = dustModel->meshes[i].getVAO();
-		glBindVertexArray(VAO);
-
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)0);
-		glEnableVertexAttribArray(4);
-		glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4)));
-		glEnableVertexAttribArray(5);
-		glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(2 * sizeof(glm::vec4)));
-		glEnableVertexAttribArray(6);
-		glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(3 * sizeof(glm::vec4)));
-
-		glVertexAttribDivisor(3, 1);
-		glVertexAttribDivisor(4, 1);
-		glVertexAttribDivisor(5, 1);
-		glVertexAttribDivisor(6, 1);
-
-		glBindVertexArray(0);
-	}
+	ParticleEmitter emitter;
+	emitter.spawnMin = glm::vec3(10.0f, 1.0f, -20.0f);
+	emitter.spawnMax = glm::vec3(30.0f, 19.0f, 0.0f);
+	emitter.boundsMin = glm::vec3(10.0f - 0.0002f, 0.0f, -20.0f - 0.0002f);
+	emitter.boundsMax = glm::vec3(30.0f + 0.0002f, 19.0f, 0.0f + 0.0002f);
+	emitter.velocity = glm::vec3(1.8f, 0.0f, -1.8f); //the wind of room 3
+	emitter.velocityJitter = glm::vec3(0.0f);
+	emitter.rotationAxis = glm::vec3(0.4f, 0.6f, 0.8f);
+	emitter.lifetimeMin = emitter.lifetimeMax = 0.0f;
+	emitter.scaleMin = emitter.scaleMax = 0.005f;
+	emitter.collisionRadius = 0.01f;
+
+	dustEmitter = ambientParticles->addEmitter(emitter, dustAmount);
+	dustFormat = chooseInstanceFormat(true, true);
+	initializeParticleSeeds(dustAmount, dustSeedVBO);
+}
+
+ParticleEmitter RenderSystem::makeBubblesEmitter() {
+
+	// the spawn box starts above the floor slab (y 0 to 0.5) by more than the collision radius, otherwise every
+	// bubble touches the level as it spawns and respawns into the floor again
+	ParticleEmitter emitter;
+	emitter.spawnMin = glm::vec3(-29.0f, 0.6f, 1.0f);
+	emitter.spawnMax = glm::vec3(-11.0f, 1.0f, 19.0f);
+	emitter.boundsMin = glm::vec3(-29.0f - 0.0002f, 0.5f, 1.0f - 0.0002f);
+	emitter.boundsMax = glm::vec3(-11.0f + 0.0002f, 20.0f - 0.0002f, 19.0f + 0.0002f);
+	emitter.velocity = glm::vec3(0.0f, 1.8f, 0.0f);
+	emitter.velocityJitter = glm::vec3(0.05f, 0.2f, 0.05f);
+	emitter.rotationAxis = glm::vec3(0.4f, 0.6f, 0.8f);
+	emitter.lifetimeMin = emitter.lifetimeMax = 0.0f;
+	emitter.scaleMin = 0.01f;
+	emitter.scaleMax = 0.05f;
+	emitter.collisionRadius = 0.05f;
+
+	return emitter;
 }
 
 void RenderSystem::initializeBubbles() {
 
-	bubblesModelMatrices = new glm::mat4[bubblesAmount];
-	srand(glfwGetTime());
+	bubblesEmitter = ambientParticles->addEmitter(makeBubblesEmitter(), bubblesAmount);
+	bubblesFormat = chooseInstanceFormat(false, true);
+	initializeParticleSeeds(bubblesAmount, bubblesSeedVBO);
+}
 
-	float maxX = (-11 + 0.0002f);
-	float minX = (-29 - 0.0002f);
-	float minY = (0 + 0.0002f);
-	float maxY = (19 - 0.0002f);
-	float maxZ = (19 + 0.0002f);
-	float minZ = (1 - 0.0002f);
+// Stateless particles only need where they start inside their bounds and a random number
+void RenderSystem::initializeParticleSeeds(unsigned int amount, unsigned int &seedVBO) {
 
-	for (unsigned int i = 0; i < bubblesAmount; i++)
+	// seeded cell by cell so LodBuckets::sortVolume can give every cell its own level
+	vector<glm::vec4> seeds(amount);
+	const int cells = LodBuckets::VOLUME_CELLS;
+	for (int cell = 0; cell < cells * cells * cells; cell++)
 	{
-		glm::mat4 model;
+		glm::vec3 corner((float)(cell % cells), (float)(cell / cells % cells), (float)(cell / (cells * cells)));
+		for (size_t i = LodBuckets::getVolumeCellFirst(cell, amount); i < LodBuckets::getVolumeCellFirst(cell + 1, amount); i++)
+		{
+			glm::vec3 inside((float)rand() / RAND_MAX, (float)rand() / RAND_MAX, (float)rand() / RAND_MAX);
+			seeds[i] = glm::vec4((corner + inside) / (float)cells, (float)rand() / RAND_MAX);
+		}
+	}
 
-		float x = minX + (((float)rand()) / (float)RAND_MAX) * (maxX - minX);
-		float z = minZ + (((float)rand()) / (float)RAND_MAX) * (maxZ - minZ);
-		float y = minY + (((float)rand()) / (float)RAND_MAX) * (maxY - minY);
+	glGenBuffers(1, &seedVBO);
+	_glState->bindBuffer(GL_ARRAY_BUFFER, seedVBO);
+	glBufferData(GL_ARRAY_BUFFER, amount * sizeof(glm::vec4), amount ? &seeds[0] : NULL, GL_STATIC_DRAW);
+}
 
-		model = glm::translate(model, glm::vec3(x, y, z));
+// Points have no vertex data, every attribute they read is per instance
+void RenderSystem::initializeParticleLods() {
 
-		float scale = (rand() % 5) / 100.0f + 0.01f;
-		model = glm::scale(model, glm::vec3(scale));
+	dustLods.setModel(dustModel);
+	bubblesLods.setModel(sphereModel);
 
-		float rotAngle = (rand() % 360);
-		model = glm::rotate(model, rotAngle, glm::vec3(0.4f, 0.6f, 0.8f));
+	glGenVertexArrays(1, &pointVAO);
+	_glState->enable(GL_PROGRAM_POINT_SIZE);
+}
 
-		bubblesModelMatrices[i] = model;
-	}
+// Rooms, particle volumes and the water surface never move, their boxes are tested together every frame.
+// Bodies are culled with the broadphase trees. Both then have to be in a room seen through the doors
+// and not hidden behind the walls.
+void RenderSystem::initializeCulling() {
 
-	glGenBuffers(1, &bubblesVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, bubblesVBO);
-	glBufferData(GL_ARRAY_BUFFER, bubblesAmount * sizeof(glm::mat4), &bubblesModelMatrices[0], GL_STREAM_DRAW);
+	occlusion = new OcclusionBuffer();
+	occlusion->addOccluders(_world);
 
-	for (unsigned int i = 0; i < sphereModel->meshes.size(); i++)
+	for (unsigned int i = 1; i <= 6; i++)
 	{
-		unsigned int VAO = sphereModel->meshes[i].getVAO();
-		glBindVertexArray(VAO);
-
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)0);
-		glEnableVertexAttribArray(4);
-		glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4)));
-		glEnableVertexAttribArray(5);
-		glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(2 * sizeof(glm::vec4)));
-		glEnableVertexAttribArray(6);
-		glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(3 * sizeof(glm::vec4)));
-
-		glVertexAttribDivisor(3, 1);
-		glVertexAttribDivisor(4, 1);
-		glVertexAttribDivisor(5, 1);
-		glVertexAttribDivisor(6, 1);
-
-		glBindVertexArray(0);
+		string name = "room_" + to_string(i);
+		glm::vec3 boundsMin, boundsMax;
+		if (staticGeometry->getBounds(name, boundsMin, boundsMax))
+			addVolume(name, boundsMin, boundsMax);
 	}
-}
 
-void RenderSystem::renderRoom1(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color) {
+	const ParticleEmitter &dust = ambientParticles->getEmitter(dustEmitter);
+	addVolume("dust", dust.boundsMin, dust.boundsMax);
 
-	getShader("light")->Use();
-	setupLightsParameter(color, glm::vec3(0.0f, 10.0f, -10.0f));
+	// particles are scaled around their position
+	const ParticleEmitter &bubbles = ambientParticles->getEmitter(bubblesEmitter);
+	addVolume("bubbles", bubbles.boundsMin - glm::vec3(bubbles.scaleMax), bubbles.boundsMax + glm::vec3(bubbles.scaleMax));
 
-	getTexture("wall")->Bind();
-	getShader("light")->setInt("material.diffuse", 0);
+	addVolume("water", glm::vec3(-30, 0, 0), glm::vec3(-10, 20, 20));
+}
 
-	glm::mat4 model(1.0);
-	getShader("light")->setMat4("projectionMatrix", projection);
-	getShader("light")->setMat4("viewMatrix", view);
-	
-	model = getBoxModelMatrix(_world->getWall(name + ".1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+void RenderSystem::addVolume(string name, glm::vec3 boundsMin, glm::vec3 boundsMax) {
 
-	model = getBoxModelMatrix(_world->getWall(name + ".2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	volumes[name] = (unsigned int)volumeMinX.size();
+	volumeMinX.push_back(boundsMin.x); volumeMinY.push_back(boundsMin.y); volumeMinZ.push_back(boundsMin.z);
+	volumeMaxX.push_back(boundsMax.x); volumeMaxY.push_back(boundsMax.y); volumeMaxZ.push_back(boundsMax.z);
+	volumeVisible.push_back(1);
+}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".3.1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+void RenderSystem::cullScene(glm::mat4 viewProjection) {
 
-	model = getBoxModelMatrix(_world->getWall(name + ".3.2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	frustum.update(viewProjection);
 
-	model = getBoxModelMatrix(_world->getWall(name + ".3.3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	frustum.cullBoxes(&volumeMinX[0], &volumeMinY[0], &volumeMinZ[0], &volumeMaxX[0], &volumeMaxY[0], &volumeMaxZ[0], volumeVisible.size(), &volumeVisible[0]);
 
-	model = getBoxModelMatrix(_world->getWall(name + ".4"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	// every room reached through the doors is seen through the union of the doors on the way
+	portalCulling = _world->getPortals()->findVisibleCells(_camera->Position, viewProjection, cellVisible, cellRects);
+	if (portalCulling) {
+		cellFrusta.resize(cellVisible.size());
+		for (size_t i = 0; i < cellVisible.size(); i++)
+			if (cellVisible[i])
+				cellFrusta[i].update(viewProjection, cellRects[i]);
 
-	model = getBoxModelMatrix(_world->getWall(name + ".5.1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+		for (size_t i = 0; i < volumeVisible.size(); i++)
+		{
+			if (volumeVisible[i])
+				volumeVisible[i] = isInVisibleCell(glm::vec3(volumeMinX[i], volumeMinY[i], volumeMinZ[i]), glm::vec3(volumeMaxX[i], volumeMaxY[i], volumeMaxZ[i]));
+		}
+	}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".5.2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	// moving proxies live in the first tree, resting ones in the second
+	btDbvtBroadphase *broadphase = _world->getBroadphase();
+	treeVisible.clear();
+	frustum.cullTree(broadphase->m_sets[0], treeVisible);
+	frustum.cullTree(broadphase->m_sets[1], treeVisible);
 
-	model = getBoxModelMatrix(_world->getWall(name + ".5.3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	occlusion->wait();
+	for (size_t i = 0; i < volumeVisible.size(); i++)
+	{
+		if (volumeVisible[i])
+			volumeVisible[i] = occlusion->isVisible(glm::vec3(volumeMinX[i], volumeMinY[i], volumeMinZ[i]), glm::vec3(volumeMaxX[i], volumeMaxY[i], volumeMaxZ[i]));
+	}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".6.1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	visibleBodies.clear();
+	for (const btCollisionObject *object : treeVisible)
+	{
+		// walls are drawn with their room
+		if (object->isStaticObject())
+			continue;
 
-	model = getBoxModelMatrix(_world->getWall(name + ".6.2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+		const btBroadphaseProxy *proxy = object->getBroadphaseHandle();
+		glm::vec3 boundsMin(proxy->m_aabbMin.getX(), proxy->m_aabbMin.getY(), proxy->m_aabbMin.getZ());
+		glm::vec3 boundsMax(proxy->m_aabbMax.getX(), proxy->m_aabbMax.getY(), proxy->m_aabbMax.getZ());
 
-	model = getBoxModelMatrix(_world->getWall(name + ".6.3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+		if ((!portalCulling || isInVisibleCell(boundsMin, boundsMax)) && occlusion->isVisible(boundsMin, boundsMax))
+			visibleBodies.insert(object);
+	}
 }
 
-void RenderSystem::renderRoom2(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color) {
+// Boxes are placed in the room holding their center, a box outside every room is left to the view frustum
+bool RenderSystem::isInVisibleCell(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) {
 
-	getShader("light")->Use();
-	setupLightsParameter(color, glm::vec3(-20.0f, 10.0f, -10.0f));
+	int cell = _world->getPortals()->findCell((boundsMin + boundsMax) * 0.5f);
+	if (cell < 0)
+		return true;
 
-	getTexture("wall")->Bind();
+	return cellVisible[cell] && cellFrusta[cell].isVisible(boundsMin, boundsMax);
+}
 
-	glm::mat4 model(1.0);
-	getShader("light")->setMat4("projectionMatrix", projection);
-	getShader("light")->setMat4("viewMatrix", view);
-	
-	model = getBoxModelMatrix(_world->getWall(name + ".1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+bool RenderSystem::isVolumeVisible(string name) {
 
-	model = getBoxModelMatrix(_world->getWall(name + ".2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	auto iter = volumes.find(name);
+	return iter == volumes.end() || volumeVisible[iter->second] != 0;
+}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".3.1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+bool RenderSystem::isBodyVisible(const btCollisionObject *body) {
+	return visibleBodies.find(body) != visibleBodies.end();
+}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".3.2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+// Every draw of the frame goes into the render queue, which picks the order
+void RenderSystem::queueScene() {
+
+	Shader *light = getShader("light");
+	Shader *particles = statelessParticles ? getShader("ambient") : getShader("wind");
+	Shader *spheres = sphereImpostors ? getShader("impostor") : light;
+	const void *sphereMesh = sphereImpostors ? (const void*)impostors : (const void*)sphereModel;
+
+	queueRoom("room_1", "wall"); //beige
+	queueRoom("room_2", "wall"); //pink
+	queueRoom("room_3", "wall"); //green
+	queueRoom("room_4", "wall"); //beige
+	queueRoom("room_5", "underwater"); //blue
+	queueRoom("room_6", "wall"); //brown
+
+	btRigidBody *underwaterBox = _world->getBody("underwaterBox");
+	if (isBodyVisible(underwaterBox)) {
+		btVector3 box = underwaterBox->getCenterOfMassPosition();
+		renderQueue->submit(PASS_SCENE, false, light, getTexture("container"), cubeModel, distanceToCamera(glm::vec3(box.getX(), box.getY(), box.getZ())), [this]() {
+			renderBox("underwaterBox", glm::vec3(0, 0, 0));
+		});
+	}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".3.3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	// the bodies of a room are one instanced draw, sorted as a whole at the room's center
+	renderQueue->submit(PASS_SCENE, false, spheres, getTexture("bouncing"), sphereMesh, distanceToCamera(roomCenter("room_2")), [this]() {
+		renderBallsToBounce("ball", ballsAmount);
+	});
+	renderQueue->submit(PASS_SCENE, false, light, getTexture("container"), cubeModel, distanceToCamera(roomCenter("room_6")), [this]() {
+		renderBoxesToShake("cont", boxesAmount);
+	});
+	renderQueue->submit(PASS_SCENE, false, light, dustModel, dustModel, distanceToCamera(roomCenter("room_6")), [this]() {
+		renderRocksToShake("rock", rocksAmount);
+	});
+
+	const ParticleEmitter &dust = ambientParticles->getEmitter(dustEmitter);
+	if (isVolumeVisible("dust")) {
+		renderQueue->submit(PASS_SCENE, false, particles, dustModel, dustModel, distanceToCamera((dust.boundsMin + dust.boundsMax) * 0.5f), [this]() {
+			renderDust();
+		});
+	}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".4"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	const ParticleEmitter &bubbles = ambientParticles->getEmitter(bubblesEmitter);
+	if (isVolumeVisible("bubbles")) {
+		renderQueue->submit(PASS_SCENE, true, sphereImpostors ? spheres : particles, getTexture("bubble"), sphereMesh, distanceToCamera((bubbles.boundsMin + bubbles.boundsMax) * 0.5f), [this]() {
+			renderBubbles();
+		});
+	}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".5"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	if (isVolumeVisible("water")) {
+		renderQueue->submit(PASS_SCENE, false, getShader("impostor"), getTexture("wave"), impostors, distanceToCamera(glm::vec3(-20, 10, 10)), [this]() {
+			renderWater();
+		});
+	}
+}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".6.1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+void RenderSystem::queueRoom(string name, string texture) {
 
-	model = getBoxModelMatrix(_world->getWall(name + ".6.2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	if (!isVolumeVisible(name))
+		return;
 
-	model = getBoxModelMatrix(_world->getWall(name + ".6.3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	renderQueue->submit(PASS_SCENE, false, getShader("light"), getTexture(texture), staticGeometry, distanceToCamera(roomCenter(name)), [this, name, texture]() {
+		renderRoom(name, texture);
+	});
 }
 
-void RenderSystem::renderRoom3(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color) {
+glm::vec3 RenderSystem::roomCenter(string name) {
 
-	getShader("light")->Use();
-	setupLightsParameter(color, glm::vec3(20.0f, 10.0f, -10.0f));
-
-	getTexture("wall")->Bind();
+	glm::vec3 boundsMin, boundsMax;
+	if (!staticGeometry->getBounds(name, boundsMin, boundsMax))
+		return glm::vec3(0.0f);
 
-	glm::mat4 model(1.0);
-	getShader("light")->setMat4("projectionMatrix", projection);
-	getShader("light")->setMat4("viewMatrix", view);
-	
-	model = getBoxModelMatrix(_world->getWall(name + ".1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	return (boundsMin + boundsMax) * 0.5f;
+}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+float RenderSystem::distanceToCamera(glm::vec3 position) {
+	return glm::distance(position, _camera->Position);
+}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".3.1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+void RenderSystem::renderRoom(string name, string texture) {
 
-	model = getBoxModelMatrix(_world->getWall(name + ".3.2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	getShader("light")->Use();
+	getTexture(texture)->Bind();
 
-	model = getBoxModelMatrix(_world->getWall(name + ".3.3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	getShader("light")->setMat4("modelMatrix"_u, glm::mat4(1.0));
 
-	model = getBoxModelMatrix(_world->getWall(name + ".4"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	staticGeometry->draw(name);
+}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".5.1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+void RenderSystem::renderBox(string name, glm::vec3 color) {
+	
+	getShader("light")->Use();
+	getTexture("container")->Bind();
 
-	model = getBoxModelMatrix(_world->getWall(name + ".5.2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	glm::mat4 model = getBoxModelMatrix(_world->getBody(name));
 
-	model = getBoxModelMatrix(_world->getWall(name + ".5.3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	getShader("light")->setMat4("modelMatrix"_u, model);
 
-	model = getBoxModelMatrix(_world->getWall(name + ".6"));
-	getShader("light")->setMat4("modelMatrix", model);
 	cubeModel->Draw(getShader("light"));
 }
 
-void RenderSystem::renderRoom4(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color) {
+void RenderSystem::renderSphere(string name, glm::vec3 color) {
 
 	getShader("light")->Use();
-	setupLightsParameter(color, glm::vec3(0.0f, 10.0f, 10.0f));
+	getTexture("bouncing")->Bind();
 
-	getTexture("wall")->Bind();
+	glm::mat4 model = getSphereModelMatrix(_world->getBody(name));
 
-	glm::mat4 model(1.0);
-	getShader("light")->setMat4("projectionMatrix", projection);
-	getShader("light")->setMat4("viewMatrix", view);
-	
-	model = getBoxModelMatrix(_world->getWall(name + ".1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	getShader("light")->setMat4("modelMatrix"_u, model);
 
-	model = getBoxModelMatrix(_world->getWall(name + ".2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	sphereModel->Draw(getShader("light"));
+}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+void RenderSystem::renderBallsToBounce(string name, unsigned int amount) {
+	
+	Shader *shader = sphereImpostors ? getShader("impostor") : getShader("light");
+	shader->Use();
+
+	if (sphereImpostors) {
+		shader->setBool("lit"_u, true);
+		shader->setBool("stateless"_u, false);
+		shader->setFloat("pixelsPerUnit"_u, pixelsPerUnit);
+		getTexture("bouncing")->Bind();
+	}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".4.1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	for (unsigned int i = 0; i < amount && i < balls.size(); i++)
+	{
+		if (!isBodyVisible(balls[i]))
+			continue;
+
+		btTransform t;
+		balls[i]->getMotionState()->getWorldTransform(t);
+		btQuaternion rotation = t.getRotation();
+		float radius = ((btSphereShape*)balls[i]->getCollisionShape())->getRadius();
+		glm::vec3 position(t.getOrigin().x(), t.getOrigin().y(), t.getOrigin().z());
+		glm::vec4 quaternion(rotation.x(), rotation.y(), rotation.z(), rotation.w());
+
+		if (sphereImpostors)
+			impostors->add(position, radius, quaternion);
+		else
+			batcher->add(sphereModel, shader, getTexture("bouncing"), position, radius, quaternion);
+	}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".4.2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	if (sphereImpostors)
+		impostors->flush(shader);
+	else
+		batcher->flush();
+}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".4.3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+void RenderSystem::renderBoxesToShake(string name, unsigned int amount) {
 	
-	model = getBoxModelMatrix(_world->getWall(name + ".5.1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	getShader("light")->Use();
 
-	model = getBoxModelMatrix(_world->getWall(name + ".5.2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	for (unsigned int i = 0; i < amount && i < boxes.size(); i++)
+	{
+		if (!isBodyVisible(boxes[i]))
+			continue;
 
-	model = getBoxModelMatrix(_world->getWall(name + ".5.3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+		btVector3 extent = ((btBoxShape*)boxes[i]->getCollisionShape())->getHalfExtentsWithMargin();
 
-	model = getBoxModelMatrix(_world->getWall(name + ".6.1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+		// cubes fit the compact format, stretched boxes need the full matrix
+		if (extent.x() == extent.y() && extent.y() == extent.z()) {
+			btTransform t;
+			boxes[i]->getMotionState()->getWorldTransform(t);
+			btQuaternion rotation = t.getRotation();
 
-	model = getBoxModelMatrix(_world->getWall(name + ".6.2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+			batcher->add(cubeModel, getShader("light"), getTexture("container"), glm::vec3(t.getOrigin().x(), t.getOrigin().y(), t.getOrigin().z()),
+				extent.x(), glm::vec4(rotation.x(), rotation.y(), rotation.z(), rotation.w()));
+		}
+		else {
+			batcher->add(cubeModel, getShader("light"), getTexture("container"), getBoxModelMatrix(boxes[i]));
+		}
+	}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".6.3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	batcher->flush();
 }
 
-void RenderSystem::renderRoom5(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color) {
-	
+void RenderSystem::renderRocksToShake(string name, unsigned int amount) {
+
 	getShader("light")->Use();
-	setupLightsParameter(color, glm::vec3(-20.0f, 10.0f, 10.0f));
 
-	getTexture("underwater")->Bind();
+	// rock.obj brings its own textures
+	for (unsigned int i = 0; i < amount && i < rocks.size(); i++)
+	{
+		if (isBodyVisible(rocks[i]))
+			batcher->add(dustModel, getShader("light"), nullptr, getConvexModelMatrix(rocks[i]));
+	}
 
-	glm::mat4 model(1.0);
-	getShader("light")->setMat4("projectionMatrix", projection);
-	getShader("light")->setMat4("viewMatrix", view);
+	batcher->flush();
+}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+void RenderSystem::renderDust() {
 
-	model = getBoxModelMatrix(_world->getWall(name + ".2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	_glState->bindTexture(0, GL_TEXTURE_2D, dustModel->textures_loaded[0].id);
+	renderParticles(dustModel, dustEmitter, dustFormat, dustLods, dustSeedVBO, glm::vec4(1, 1, 0, 1), 0.8f, false);
+}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+// The fluid particles as lit spheres
+void RenderSystem::renderWater() {
 
-	model = getBoxModelMatrix(_world->getWall(name + ".4.1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	size_t count = water->getParticleCount();
+	size_t stride = getInstanceStride(INSTANCE_POSITION_SCALE);
 
-	model = getBoxModelMatrix(_world->getWall(name + ".4.2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	size_t offset;
+	unsigned char *instances = (unsigned char*)streamBuffer->map(count * stride, stride, offset);
+	if (!instances)
+		return;
 
-	model = getBoxModelMatrix(_world->getWall(name + ".4.3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	const float *x = water->getPositionsX(), *y = water->getPositionsY(), *z = water->getPositionsZ();
+	float radius = water->getParticleSpacing() * waterRadiusScale;
+	for (size_t i = 0; i < count; i++)
+		packInstance(INSTANCE_POSITION_SCALE, instances, i, glm::vec3(x[i], y[i], z[i]), radius, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	streamBuffer->unmap();
 
-	model = getBoxModelMatrix(_world->getWall(name + ".5"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	Shader *shader = getShader("impostor");
+	shader->Use();
+	shader->setBool("lit"_u, true);
+	shader->setBool("stateless"_u, false);
+	shader->setFloat("pixelsPerUnit"_u, pixelsPerUnit);
+	getTexture("wave")->Bind();
 
-	model = getBoxModelMatrix(_world->getWall(name + ".6.1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	impostors->draw(shader, INSTANCE_POSITION_SCALE, offset, count);
+}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".6.2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+void RenderSystem::renderBubbles() {
 
-	model = getBoxModelMatrix(_world->getWall(name + ".6.3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	getTexture("bubble")->Bind();
+	if (sphereImpostors)
+		renderBubbleImpostors();
+	else
+		renderParticles(sphereModel, bubblesEmitter, bubblesFormat, bubblesLods, bubblesSeedVBO, glm::vec4(0.40f, 0.4f, 1.0f, 0.5f), 0.5f, false);
 }
 
-void RenderSystem::renderRoom6(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color) {
+// One quad per bubble at any distance, so no levels of detail. The stateless bubbles are drawn from their seeds.
+void RenderSystem::renderBubbleImpostors() {
 
-	getShader("light")->Use();
-	setupLightsParameter(color, glm::vec3(20.0f, 10.0f, 10.0f));
+	size_t count = ambientParticles->getCount(bubblesEmitter);
+	Shader *shader = getShader("impostor");
 
-	getTexture("wall")->Bind();
+	if (statelessParticles) {
+		shader->Use();
+		shader->setBool("stateless"_u, true);
+		setupStatelessParticles(shader, ambientParticles->getEmitter(bubblesEmitter));
+		setupBubbleImpostors(shader);
+		impostors->drawSeeds(shader, bubblesSeedVBO, count);
+		return;
+	}
 
-	glm::mat4 model(1.0);
-	getShader("light")->setMat4("projectionMatrix", projection);
-	getShader("light")->setMat4("viewMatrix", view);
-	
-	model = getBoxModelMatrix(_world->getWall(name + ".1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	size_t stride = getInstanceStride(bubblesFormat);
+	size_t offset;
+	unsigned char *instances = (unsigned char*)streamBuffer->map(count * stride, stride, offset);
+	if (!instances)
+		return;
 
-	model = getBoxModelMatrix(_world->getWall(name + ".2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	ambientParticles->writeInstances(bubblesEmitter, bubblesFormat, instances);
+	streamBuffer->unmap();
 
-	model = getBoxModelMatrix(_world->getWall(name + ".3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	shader->Use();
+	shader->setBool("stateless"_u, false);
+	setupBubbleImpostors(shader);
+	impostors->draw(shader, bubblesFormat, offset, count);
+}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".4.1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+void RenderSystem::setupBubbleImpostors(Shader *shader) {
 
-	model = getBoxModelMatrix(_world->getWall(name + ".4.2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	shader->setBool("lit"_u, false);
+	shader->setFloat("pixelsPerUnit"_u, pixelsPerUnit);
+	shader->setVec4("color"_u, glm::vec4(0.40f, 0.4f, 1.0f, 0.5f));
+	shader->setFloat("mixRatio"_u, 0.5f);
+}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".4.3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
-	
-	model = getBoxModelMatrix(_world->getWall(name + ".5.1"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+// The particles are sorted by the level of detail their size on screen calls for and streamed in that order.
+// Every run of one level is an instanced draw of its meshes, the particles below a pixel or so are drawn as points.
+// The stateless particles stay in their static seed buffer, seeded in cells that each take the level of their
+// point nearest to the camera, so nothing is computed or streamed per particle. The simulated ones are sorted one
+// by one.
+// Reactive draws write the reactive mark of the motion pass instead of the colour.
+void RenderSystem::renderParticles(Model *model, unsigned int emitter, InstanceFormat format, LodBuckets &lods, unsigned int seedVBO, glm::vec4 color, float mixRatio, bool reactive) {
+
+	const ParticleEmitter &settings = ambientParticles->getEmitter(emitter);
+	size_t count = ambientParticles->getCount(emitter);
+
+	unsigned int buffer;
+	size_t offset, stride;
+
+	if (statelessParticles) {
+		// the seed cells are carried along as ambient.vert moves the particles: the emitter's velocity shifts them
+		// all, the jitter spreads them further apart as the time period goes on
+		glm::vec3 size = settings.boundsMax - settings.boundsMin;
+		float period = (float)TIME_PERIOD, phase = frameTime / period;
+		glm::vec3 crossings = glm::floor(settings.velocity * period / size + 0.5f);
+		glm::vec3 fastest = glm::floor((settings.velocity + settings.velocityJitter) * period / size + 0.5f);
+		glm::vec3 slowest = glm::floor((settings.velocity - settings.velocityJitter) * period / size + 0.5f);
+		glm::vec3 spread = glm::max(fastest - crossings, crossings - slowest);
+		lods.sortVolume(settings.boundsMin, settings.boundsMax, glm::fract(crossings * phase), spread * phase, settings.scaleMax, count, _camera->Position, pixelsPerUnit);
+		buffer = seedVBO;
+		offset = 0;
+		stride = sizeof(glm::vec4);
+	}
+	else {
+		size_t first = ambientParticles->getFirst(emitter);
+		lods.sort(ambientParticles->getPositionsX() + first, ambientParticles->getPositionsY() + first, ambientParticles->getPositionsZ() + first,
+			ambientParticles->getScales() + first, 0.0f, count, _camera->Position, pixelsPerUnit);
+
+		stride = getInstanceStride(format);
+		unsigned char *instances = (unsigned char*)streamBuffer->map(count * stride, stride, offset);
+		if (!instances)
+			return;
+
+		ambientParticles->writeInstances(emitter, format, instances, lods.getOrder());
+		streamBuffer->unmap();
+		buffer = streamBuffer->getBuffer();
+	}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".5.2"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	Shader *shader = statelessParticles ? getShader(reactive ? "ambientReactive" : "ambient") : getShader(reactive ? "windReactive" : "wind");
+	setupParticleShader(shader, settings, format, color, mixRatio);
 
-	model = getBoxModelMatrix(_world->getWall(name + ".5.3"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	unsigned int points = lods.getBucketCount() - 1;
+	for (size_t run = 0; run < lods.getRunCount(); run++)
+	{
+		unsigned int level = lods.getRunBucket(run);
+		if (level == points)
+			continue;
+
+		vector<Mesh> &meshes = model->getLodMeshes(level);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			_glState->bindVertexArray(meshes[i].getVAO());
+			setupParticleAttributes(buffer, format, offset + lods.getRunFirst(run) * stride);
+			glDrawElementsInstanced(GL_TRIANGLES, meshes[i].indices.size(), GL_UNSIGNED_INT, 0, (GLsizei)lods.getRunSize(run));
+		}
+	}
 
-	model = getBoxModelMatrix(_world->getWall(name + ".6"));
-	getShader("light")->setMat4("modelMatrix", model);
-	cubeModel->Draw(getShader("light"));
+	if (lods.getCount(points) == 0)
+		return;
+
+	shader = statelessParticles ? getShader(reactive ? "ambientPointsReactive" : "ambientPoints") : getShader(reactive ? "windPointsReactive" : "windPoints");
+	setupParticleShader(shader, settings, format, color, mixRatio);
+	shader->setFloat("pointSize"_u, 2.0f * model->getRadius() * pixelsPerUnit);
+
+	_glState->bindVertexArray(pointVAO);
+	for (size_t run = 0; run < lods.getRunCount(); run++)
+	{
+		if (lods.getRunBucket(run) != points)
+			continue;
+
+		setupParticleAttributes(buffer, format, offset + lods.getRunFirst(run) * stride);
+		glDrawArraysInstanced(GL_POINTS, 0, 1, (GLsizei)lods.getRunSize(run));
+	}
 }
 
-void RenderSystem::renderBox(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color) {
-	
-	getShader("light")->Use();
-	getTexture("container")->Bind();
+void RenderSystem::setupParticleShader(Shader *shader, const ParticleEmitter &emitter, InstanceFormat format, glm::vec4 color, float mixRatio) {
 
-	glm::mat4 model = getBoxModelMatrix(_world->getBody(name));
+	shader->Use();
 
-	getShader("light")->setMat4("projectionMatrix", projection);
-	getShader("light")->setMat4("viewMatrix", view);
-	getShader("light")->setMat4("modelMatrix", model);
+	if (statelessParticles)
+		setupStatelessParticles(shader, emitter);
+	else
+		useInstanceFormat(shader, format);
 
-	cubeModel->Draw(getShader("light"));
+	shader->setVec4("color"_u, color);
+	shader->setFloat("mixRatio"_u, mixRatio);
 }
 
-void RenderSystem::renderSphere(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color) {
+// Points the bound vertex array at the particles streamed offset bytes into the ring, seeds or instances
+void RenderSystem::setupParticleAttributes(unsigned int buffer, InstanceFormat format, size_t offset) {
 
-	getShader("light")->Use();
-	getTexture("bouncing")->Bind();
+	if (!statelessParticles) {
+		setupInstanceAttributes(buffer, format, offset);
+		return;
+	}
 
-	glm::mat4 model = getSphereModelMatrix(_world->getBody(name));
+	_glState->bindBuffer(GL_ARRAY_BUFFER, buffer);
+	glEnableVertexAttribArray(7);
+	glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)offset);
+	glVertexAttribDivisor(7, 1);
+}
 
-	getShader("light")->setMat4("projectionMatrix", projection);
-	getShader("light")->setMat4("viewMatrix", view);
-	getShader("light")->setMat4("modelMatrix", model);
+// The bodies again over the scene depth, with where their transform of the last frame put them. Each is drawn
+// the way the scene drew it, so it passes the depth test against itself. The particles move too fast and too
+// many to follow, they are only marked reactive. Everything else is still and keeps the cleared 0, its motion is
+// the camera's alone.
+void RenderSystem::renderMotion() {
 
-	sphereModel->Draw(getShader("light"));
-}
+	_glState->bindFramebuffer(GL_FRAMEBUFFER, motionFBO);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 
-void RenderSystem::renderBallsToBounce(string name, glm::mat4 projection, glm::mat4 view, unsigned int amount) {
-	
-	getShader("light")->Use();
-	getTexture("bouncing")->Bind();
+	_glState->depthFunc(GL_LEQUAL);
+	_glState->depthMask(GL_FALSE);
+
+	// the hidden ones too, they may come into view next frame
+	btRigidBody *underwaterBox = _world->getBody("underwaterBox");
+	map<const btCollisionObject*, glm::mat4> transforms;
+	for (btRigidBody *body : balls)
+		transforms[body] = getSphereModelMatrix(body);
+	for (btRigidBody *body : boxes)
+		transforms[body] = getBoxModelMatrix(body);
+	for (btRigidBody *body : rocks)
+		transforms[body] = getConvexModelMatrix(body);
+	transforms[underwaterBox] = getBoxModelMatrix(underwaterBox);
+
+	// as renderBoxesToShake, renderRocksToShake and renderBallsToBounce batch them
+	vector<btRigidBody*> cubes, stretched, spheres, shownRocks;
+	for (unsigned int i = 0; i < boxesAmount && i < boxes.size(); i++)
+	{
+		if (!isBodyVisible(boxes[i]))
+			continue;
 
-	setupLightsParameter(glm::vec3(1.0f, 0.6f, 0.8f), glm::vec3(-20.0f, 10.0f, -10.0f));
-	
-	getShader("light")->setMat4("projectionMatrix", projection);
-	getShader("light")->setMat4("viewMatrix", view);
-	
-	for (unsigned int i = 0; i < amount; i++)
+		btVector3 extent = ((btBoxShape*)boxes[i]->getCollisionShape())->getHalfExtentsWithMargin();
+		(extent.x() == extent.y() && extent.y() == extent.z() ? cubes : stretched).push_back(boxes[i]);
+	}
+	for (unsigned int i = 0; i < ballsAmount && i < balls.size(); i++)
+	{
+		if (isBodyVisible(balls[i]))
+			spheres.push_back(balls[i]);
+	}
+	for (unsigned int i = 0; i < rocksAmount && i < rocks.size(); i++)
 	{
-		glm::mat4 model = getSphereModelMatrix(_world->getBody(name + to_string(i)));
+		if (isBodyVisible(rocks[i]))
+			shownRocks.push_back(rocks[i]);
+	}
 
-		getShader("light")->setMat4("modelMatrix", model);
+	Shader *shader = getShader("motion");
+	shader->Use();
+	shader->setMat4("previousViewProjection"_u, previousViewProjection);
+
+	renderMeshMotion(shader, cubeModel, INSTANCE_POSITION_SCALE_ROTATION, cubes, transforms);
+	renderMeshMotion(shader, cubeModel, INSTANCE_MATRIX, stretched, transforms);
+	if (!sphereImpostors)
+		renderMeshMotion(shader, sphereModel, INSTANCE_POSITION_SCALE_ROTATION, spheres, transforms);
+	renderMeshMotion(shader, dustModel, INSTANCE_MATRIX, shownRocks, transforms);
+
+	// drawn on its own by renderBox
+	if (isBodyVisible(underwaterBox)) {
+		shader->setMat4("modelMatrix"_u, transforms[underwaterBox]);
+		shader->setMat4("previousModelMatrix"_u, getPreviousTransform(underwaterBox, transforms[underwaterBox]));
+		cubeModel->Draw(shader);
+	}
 
-		sphereModel->Draw(getShader("light"));
+	Shader *impostor = getShader("impostor");
+	impostor->Use();
+	impostor->setBool("motion"_u, true);
+	impostor->setMat4("previousViewProjection"_u, previousViewProjection);
+	impostor->setFloat("pixelsPerUnit"_u, pixelsPerUnit);
+
+	if (sphereImpostors)
+		renderBallMotion(impostor, spheres, transforms);
+	if (isVolumeVisible("water"))
+		renderWaterMotion(impostor);
+
+	if (isVolumeVisible("dust"))
+		renderParticles(dustModel, dustEmitter, dustFormat, dustLods, dustSeedVBO, glm::vec4(0.0f), 0.0f, true);
+
+	if (isVolumeVisible("bubbles")) {
+		if (sphereImpostors) {
+			impostor->Use();
+			impostor->setBool("reactive"_u, true);
+			renderBubbleImpostors();
+			impostor->setBool("reactive"_u, false);
+		}
+		else {
+			renderParticles(sphereModel, bubblesEmitter, bubblesFormat, bubblesLods, bubblesSeedVBO, glm::vec4(0.0f), 0.0f, true);
+		}
 	}
+
+	impostor->Use();
+	impostor->setBool("motion"_u, false);
+
+	_glState->depthMask(GL_TRUE);
+	_glState->depthFunc(GL_LESS);
+
+	previousTransforms.swap(transforms);
 }
 
-void RenderSystem::renderBoxesToShake(string name, glm::mat4 projection, glm::mat4 view, unsigned int amount) {
-	
-	getShader("light")->Use();
-	getTexture("container")->Bind();
+glm::mat4 RenderSystem::getPreviousTransform(const btCollisionObject *body, const glm::mat4 &transform) {
 
-	setupLightsParameter(glm::vec3(1.6f, 1.0f, 0.6f), glm::vec3(20.0f, 10.0f, 10.0f));
+	auto previous = previousTransforms.find(body);
+	return previous != previousTransforms.end() ? previous->second : transform;
+}
 
-	getShader("light")->setMat4("projectionMatrix", projection);
-	getShader("light")->setMat4("viewMatrix", view);
-	
+// The bodies streamed exactly as the batcher streams them for the scene, with last frame's model matrix of each
+// after them for motion.vert
+void RenderSystem::renderMeshMotion(Shader *shader, Model *model, InstanceFormat format, const vector<btRigidBody*> &bodies, map<const btCollisionObject*, glm::mat4> &transforms) {
 
-	for (unsigned int i = 0; i < amount; i++)
+	if (bodies.empty())
+		return;
+
+	size_t count = bodies.size();
+	size_t stride = getInstanceStride(format);
+	size_t offset;
+	unsigned char *instances = (unsigned char*)streamBuffer->map(count * (stride + sizeof(glm::mat4)), stride, offset);
+	if (!instances)
+		return;
+
+	glm::mat4 *previous = (glm::mat4*)(instances + count * stride);
+	for (size_t i = 0; i < count; i++)
 	{
-		glm::mat4 model = getBoxModelMatrix(_world->getBody(name + to_string(i)));
+		glm::mat4 &transform = transforms[bodies[i]];
+		previous[i] = getPreviousTransform(bodies[i], transform);
 
-		getShader("light")->setMat4("modelMatrix", model);
+		if (format == INSTANCE_MATRIX) {
+			memcpy(instances + i * stride, &transform, sizeof(glm::mat4));
+			continue;
+		}
+
+		btCollisionShape *shape = bodies[i]->getCollisionShape();
+		float scale = shape->getShapeType() == SPHERE_SHAPE_PROXYTYPE ? ((btSphereShape*)shape)->getRadius() : ((btBoxShape*)shape)->getHalfExtentsWithMargin().x();
 
-		cubeModel->Draw(getShader("light"));
+		btTransform t;
+		bodies[i]->getMotionState()->getWorldTransform(t);
+		btQuaternion rotation = t.getRotation();
+		packInstance(format, instances, i, glm::vec3(t.getOrigin().x(), t.getOrigin().y(), t.getOrigin().z()), scale,
+			glm::vec4(rotation.x(), rotation.y(), rotation.z(), rotation.w()));
 	}
-}
+	streamBuffer->unmap();
 
-void RenderSystem::renderDust(glm::mat4 projection, glm::mat4 view, unsigned int amount, glm::mat4* modelMatrices) {
+	shader->setBool("instanced"_u, true);
+	useInstanceFormat(shader, format);
 
-	for (unsigned int i = 0; i < amount; i++)
+	size_t previousOffset = offset + count * stride;
+	for (unsigned int i = 0; i < model->meshes.size(); i++)
 	{
-		if ((modelMatrices[i][3][0] > (10 - 0.0002f) && modelMatrices[i][3][0] < (30 + 0.0002f)) && modelMatrices[i][3][2] > (-20 - 0.0002f) && modelMatrices[i][3][2] < (0 + 0.0002f)) {
-			modelMatrices[i][3][0] += 0.03f;
-			modelMatrices[i][3][2] -= 0.03f;
-		}
-		else {
-			modelMatrices[i][3][0] = (10) + (((float)rand()) / (float)RAND_MAX) * ((30 + 0.0002f) - (10 - 0.0002f));
-			modelMatrices[i][3][2] = (-20 - 0.0002f) + (((float)rand()) / (float)RAND_MAX) * ((0 + 0.0002f) - (-20 - 0.0002f));
+		_glState->bindVertexArray(model->meshes[i].getVAO());
+		setupInstanceAttributes(streamBuffer->getBuffer(), format, offset);
+		for (unsigned int column = 0; column < 4; column++)
+		{
+			glEnableVertexAttribArray(7 + column);
+			glVertexAttribPointer(7 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(previousOffset + column * sizeof(glm::vec4)));
+			glVertexAttribDivisor(7 + column, 1);
 		}
+
+		glDrawElementsInstanced(GL_TRIANGLES, model->meshes[i].indices.size(), GL_UNSIGNED_INT, 0, (GLsizei)count);
+
+		for (unsigned int column = 0; column < 4; column++)
+			glDisableVertexAttribArray(7 + column);
 	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, dustVBO);
-	glBufferData(GL_ARRAY_BUFFER, amount * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, amount * sizeof(glm::mat4), &modelMatrices[0]);
+	shader->setBool("instanced"_u, false);
+}
+
+// The impostors take their position and radius as renderBallsToBounce streams them, so their depth is the scene's
+void RenderSystem::renderBallMotion(Shader *shader, const vector<btRigidBody*> &spheres, map<const btCollisionObject*, glm::mat4> &transforms) {
 
-	getShader("wind")->Use();
+	if (spheres.empty())
+		return;
 
-	getShader("wind")->setMat4("projection", projection);
-	getShader("wind")->setMat4("view", view);
-	getShader("wind")->setVec4("color", glm::vec4(1, 1, 0, 1));
-	getShader("wind")->setFloat("mixRatio", 0.8f);
+	size_t count = spheres.size();
+	size_t stride = getInstanceStride(INSTANCE_POSITION_SCALE);
+	size_t offset;
+	unsigned char *instances = (unsigned char*)streamBuffer->map(2 * count * stride, stride, offset);
+	if (!instances)
+		return;
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, dustModel->textures_loaded[0].id);
-	for (unsigned int i = 0; i < dustModel->meshes.size(); i++)
+	for (size_t i = 0; i < count; i++)
 	{
-		glBindVertexArray(dustModel->meshes[i].getVAO());
-		glDrawElementsInstanced(GL_TRIANGLES, dustModel->meshes[i].indices.size(), GL_UNSIGNED_INT, 0, amount);
-		glBindVertexArray(0);
+		btTransform t;
+		spheres[i]->getMotionState()->getWorldTransform(t);
+		float radius = ((btSphereShape*)spheres[i]->getCollisionShape())->getRadius();
+		glm::vec4 previous = getPreviousTransform(spheres[i], transforms[spheres[i]])[3];
+
+		packInstance(INSTANCE_POSITION_SCALE, instances, i, glm::vec3(t.getOrigin().x(), t.getOrigin().y(), t.getOrigin().z()), radius, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		packInstance(INSTANCE_POSITION_SCALE, instances, count + i, glm::vec3(previous), radius, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
 	}
+	streamBuffer->unmap();
+
+	shader->setBool("stateless"_u, false);
+	impostors->drawMotion(shader, offset, offset + count * stride, count);
 }
 
-void RenderSystem::renderWaterWaves(glm::mat4 projection, glm::mat4 view) {
-	
-	getShader("wave")->Use();
-	getTexture("wave")->Bind();
+// The fluid moved by its velocity over the last step
+void RenderSystem::renderWaterMotion(Shader *shader) {
+
+	size_t count = water->getParticleCount();
+	size_t stride = getInstanceStride(INSTANCE_POSITION_SCALE);
+	size_t offset;
+	unsigned char *instances = (unsigned char*)streamBuffer->map(2 * count * stride, stride, offset);
+	if (!instances)
+		return;
+
+	const float *x = water->getPositionsX(), *y = water->getPositionsY(), *z = water->getPositionsZ();
+	const float *vx = water->getVelocitiesX(), *vy = water->getVelocitiesY(), *vz = water->getVelocitiesZ();
+	float radius = water->getParticleSpacing() * waterRadiusScale;
+	float timeStep = _world->getTimeStep();
+	for (size_t i = 0; i < count; i++)
+	{
+		glm::vec3 position(x[i], y[i], z[i]);
+		packInstance(INSTANCE_POSITION_SCALE, instances, i, position, radius, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		packInstance(INSTANCE_POSITION_SCALE, instances, count + i, position - glm::vec3(vx[i], vy[i], vz[i]) * timeStep, radius, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	}
+	streamBuffer->unmap();
+
+	shader->setBool("stateless"_u, false);
+	impostors->drawMotion(shader, offset, offset + count * stride, count);
+}
+
+void RenderSystem::renderScreen() {
 
-	getShader("wave")->setMat4("projectionMatrix", projection);
-	getShader("wave")->setMat4("viewMatrix", view);
+	_glState->bindVertexArray(quadVAO);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
 
-	glm::mat4 model = glm::mat4(1.0);
+// GL calls issued and skipped by the state cache in the last frame, refreshed in the title once a second
+void RenderSystem::reportStateCalls() {
 
-	model = glm::translate(model, glm::vec3(-20, 10, 10));
-	model = glm::scale(model, glm::vec3(10, 10, 10));
+	_glState->endFrame();
 
-	getShader("wave")->setMat4("modelMatrix", model);
+	double now = glfwGetTime();
+	if (now - stateReportTime < 1.0)
+		return;
 
-	glm::vec2 texCoord;
-	float decimal;
-	texCoord.x = -modf(glfwGetTime() * 0.1f, &decimal);
-	texCoord.y = 1;
+	stateReportTime = now;
+	string title = "PGTR | GL state calls: " + to_string(_glState->getIssuedCalls()) + " issued, " + to_string(_glState->getSkippedCalls()) + " skipped";
+	title += " | scene " + to_string(renderWidth) + "x" + to_string(renderHeight) + ", GPU " + to_string(smoothedFrameTime) + " ms";
+	title += " | " + string(dualFilterBloom ? "dual filter" : "gaussian") + " bloom: " + to_string(bloomTimer->takeAverage()) + " ms";
+	glfwSetWindowTitle(_window, title.c_str());
+}
 
-	getShader("wave")->setVec2("uvRotation", texCoord);
+void RenderSystem::initializeLights() {
+
+	lightClusters = new LightClusters(0.1f, 100.0f);
+
+	// two lights per room, each confined to its own room
+	addLights("room_1", glm::vec3(0.9f, 0.9f, 0.8f), glm::vec3(0.0f, 10.0f, -10.0f)); //beige
+	addLights("room_2", glm::vec3(2.0f, 0.6f, 0.8f), glm::vec3(-20.0f, 10.0f, -10.0f)); //pink
+	addLights("room_3", glm::vec3(0.7f, 2.0f, 0.7f), glm::vec3(20.0f, 10.0f, -10.0f)); //green
+	addLights("room_4", glm::vec3(0.9f, 0.9f, 0.8f), glm::vec3(0.0f, 10.0f, 10.0f)); //beige
+	addLights("room_5", glm::vec3(0.60f, 0.65f, 1.0f), glm::vec3(-20.0f, 10.0f, 10.0f)); //blue
+	addLights("room_6", glm::vec3(1.6f, 1.0f, 0.6f), glm::vec3(20.0f, 10.0f, 10.0f)); //brown
+	addExtraLights(extraLightsAmount);
+
+	GLint alignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	uniformAlignment = glm::max(alignment, 16);
+
+	// the lights never change, they get a buffer of their own
+	glGenBuffers(1, &lightDataBuffer);
+	glGenTextures(1, &lightDataTexture);
+	glGenTextures(1, &clusterTexture);
+	glGenTextures(1, &lightIndexTexture);
+
+	_glState->bindBuffer(GL_TEXTURE_BUFFER, lightDataBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, glm::max(lightClusters->getLightCount(), (size_t)1) * sizeof(ClusterLight), lightClusters->getLights(), GL_STATIC_DRAW);
+	_glState->bindTexture(LIGHT_TEXTURE_UNIT + 2, GL_TEXTURE_BUFFER, lightDataTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightDataBuffer);
+
+	// the clusters and indices are streamed and each frame's slice of the ring is viewed on its own. Without
+	// glTexBufferRange they are copied into buffers of their own, viewed once here.
+	texBufferRange = nullptr;
+	if (glfwExtensionSupported("GL_ARB_texture_buffer_range"))
+		texBufferRange = (TexBufferRangeProc)glfwGetProcAddress("glTexBufferRange");
+
+	GLint texels = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &texels);
+	maxTexBufferTexels = (size_t)texels;
+	texBufferAlignment = sizeof(unsigned int);
+	if (texBufferRange) {
+		GLint alignment = 0;
+		glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		texBufferAlignment = glm::max((size_t)alignment, texBufferAlignment);
+	}
 
-	cubeModel->Draw(getShader("wave"));
+	emptyClusters.assign(lightClusters->getClusterCount() * 2, 0);
+
+	glGenBuffers(1, &clusterBuffer);
+	glGenBuffers(1, &lightIndexBuffer);
+	_glState->bindBuffer(GL_TEXTURE_BUFFER, clusterBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, emptyClusters.size() * sizeof(unsigned int), &emptyClusters[0], GL_STREAM_DRAW);
+	_glState->bindBuffer(GL_TEXTURE_BUFFER, lightIndexBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(unsigned short), NULL, GL_STREAM_DRAW);
+	_glState->bindTexture(LIGHT_TEXTURE_UNIT, GL_TEXTURE_BUFFER, clusterTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, clusterBuffer);
+	_glState->bindTexture(LIGHT_TEXTURE_UNIT + 1, GL_TEXTURE_BUFFER, lightIndexTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, lightIndexBuffer);
+
+	glm::vec3 grid(LightClusters::GRID_X, LightClusters::GRID_Y, LightClusters::GRID_Z);
+	glm::vec2 slicing = lightClusters->getDepthSlicing();
+	for (string name : { "light", "impostor" })
+	{
+		getShader(name)->Use();
+		getShader(name)->setVec3("clusterGrid"_u, grid);
+		getShader(name)->setVec2("clusterDepth"_u, slicing);
+	}
 }
 
-void RenderSystem::renderBubbles(glm::mat4 projection, glm::mat4 view, unsigned int amount, glm::mat4* modelMatrices) {
+void RenderSystem::addLights(string name, glm::vec3 ambientColor, glm::vec3 pointPosition) {
+
+	glm::vec3 boundsMin, boundsMax;
+	if (!staticGeometry->getBounds(name, boundsMin, boundsMax)) {
+		cout << "No room " << name << " to put lights in" << endl;
+		return;
+	}
+
+	// directional light (unused)
+	//direction (0.0f, 1.0f, 0.0f), ambient (0.3f, 0.3f, 0.3f), diffuse (0.2f, 0.2f, 0.2f), specular (0.3f, 0.3f, 0.3f)
+
+	glm::vec3 positions[2] = {
+		pointPosition,
+		glm::vec3(pointPosition.x - abs(pointPosition.x*0.25f), pointPosition.y, pointPosition.z /*- abs(pointPosition.z*0.25f)*/)
+	};
+
+	for (int i = 0; i < 2; i++)
+		lightClusters->addLight(positions[i], ambientColor, glm::vec3(0.8f, 0.8f, 0.8f), glm::vec3(0.5f, 0.5f, 0.5f), glm::vec3(1.0f, 0.09f, 0.032f), boundsMin, boundsMax);
+}
+
+// Small coloured lights scattered over the rooms, to load the clusters
+void RenderSystem::addExtraLights(unsigned int amount) {
 
 	for (unsigned int i = 0; i < amount; i++)
 	{
-		if ( modelMatrices[i][3][1] < (20 - 0.0002f)) {
-			modelMatrices[i][3][1] += 0.03f;
+		string room = "room_" + to_string(1 + i % 6);
+		glm::vec3 boundsMin, boundsMax;
+		if (!staticGeometry->getBounds(room, boundsMin, boundsMax))
+			continue;
+
+		// a unit away from the walls
+		glm::vec3 position;
+		for (int axis = 0; axis < 3; axis++)
+			position[axis] = boundsMin[axis] + 1.0f + (boundsMax[axis] - boundsMin[axis] - 2.0f) * ((float)rand()) / RAND_MAX;
+		glm::vec3 color(((float)rand()) / RAND_MAX, ((float)rand()) / RAND_MAX, ((float)rand()) / RAND_MAX);
+
+		lightClusters->addLight(position, color * 0.05f, color, color * 0.5f, glm::vec3(1.0f, 0.35f, 0.44f), boundsMin, boundsMax);
+	}
+}
+
+// Sorts the lights into the clusters seen by the unjittered camera and hands them to the lit shaders
+void RenderSystem::uploadLightClusters(glm::mat4 projection, glm::mat4 view) {
+
+	lightClusters->assign(view, projection);
+
+	// without their indices every cluster is left empty rather than pointing at missing ones
+	size_t indexCount = lightClusters->getIndexCount();
+	size_t indexSize = indexCount * sizeof(unsigned short);
+	size_t clusterSize = lightClusters->getClusterCount() * 2 * sizeof(unsigned int);
+	bool indexed = indexCount <= maxTexBufferTexels;
+
+	if (texBufferRange) {
+		size_t indexBytes = 0;
+		if (indexed && indexCount > 0) {
+			unsigned char *indices = (unsigned char*)streamBuffer->map(indexSize, texBufferAlignment, indexBytes);
+			if (indices) {
+				memcpy(indices, lightClusters->getIndices(), indexSize);
+				streamBuffer->unmap();
+			}
+			else {
+				indexed = false;
+			}
 		}
-		else {
-			modelMatrices[i][3][1] = (0 + 0.0002f) + (((float)rand()) / (float)RAND_MAX) * ((20 - 0.0002f) - (0 + 0.0002f));
+
+		// a full ring keeps last frame's views, their data is still intact
+		size_t clusterBytes;
+		unsigned char *clusters = (unsigned char*)streamBuffer->map(clusterSize, texBufferAlignment, clusterBytes);
+		if (!clusters)
+			return;
+
+		memcpy(clusters, indexed ? (const void*)lightClusters->getClusters() : (const void*)&emptyClusters[0], clusterSize);
+		streamBuffer->unmap();
+
+		_glState->bindTexture(LIGHT_TEXTURE_UNIT, GL_TEXTURE_BUFFER, clusterTexture);
+		texBufferRange(GL_TEXTURE_BUFFER, GL_RG32UI, streamBuffer->getBuffer(), clusterBytes, clusterSize);
+		if (indexed && indexCount > 0) {
+			_glState->bindTexture(LIGHT_TEXTURE_UNIT + 1, GL_TEXTURE_BUFFER, lightIndexTexture);
+			texBufferRange(GL_TEXTURE_BUFFER, GL_R16UI, streamBuffer->getBuffer(), indexBytes, indexSize);
 		}
 	}
+	else {
+		// orphaned each frame, so the copy never waits for the frames still reading the last one
+		_glState->bindBuffer(GL_TEXTURE_BUFFER, clusterBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, clusterSize, indexed ? (const void*)lightClusters->getClusters() : (const void*)&emptyClusters[0], GL_STREAM_DRAW);
+		if (indexed && indexCount > 0) {
+			_glState->bindBuffer(GL_TEXTURE_BUFFER, lightIndexBuffer);
+			glBufferData(GL_TEXTURE_BUFFER, indexSize, lightClusters->getIndices(), GL_STREAM_DRAW);
+		}
 
-	glBindBuffer(GL_ARRAY_BUFFER, bubblesVBO);
-	glBufferData(GL_ARRAY_BUFFER, amount * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, amount * sizeof(glm::mat4), &modelMatrices[0]);
-
-	getShader("wind")->Use();
-	getTexture("bubble")->Bind();
+		_glState->bindTexture(LIGHT_TEXTURE_UNIT, GL_TEXTURE_BUFFER, clusterTexture);
+		_glState->bindTexture(LIGHT_TEXTURE_UNIT + 1, GL_TEXTURE_BUFFER, lightIndexTexture);
+	}
+	_glState->bindTexture(LIGHT_TEXTURE_UNIT + 2, GL_TEXTURE_BUFFER, lightDataTexture);
 
-	getShader("wind")->setMat4("projection", projection);
-	getShader("wind")->setMat4("view", view);
-	getShader("wind")->setVec4("color", glm::vec4(0.40f, 0.4f, 1.0f, 0.5f));
-	getShader("wind")->setFloat("mixRatio", 0.5f);
-	
-	for (unsigned int i = 0; i < sphereModel->meshes.size(); i++)
+	// the tiles follow the scene resolution
+	glm::vec2 scale((float)LightClusters::GRID_X / renderWidth, (float)LightClusters::GRID_Y / renderHeight);
+	for (string name : { "light", "impostor" })
 	{
-		glBindVertexArray(sphereModel->meshes[i].getVAO());
-		glDrawElementsInstanced(GL_TRIANGLES, sphereModel->meshes[i].indices.size(), GL_UNSIGNED_INT, 0, amount);
-		glBindVertexArray(0);
+		getShader(name)->Use();
+		getShader(name)->setVec2("clusterScale"_u, scale);
 	}
 }
 
-void RenderSystem::renderScreen() {
+void RenderSystem::uploadUniformBlocks(glm::mat4 projection, glm::mat4 view) {
+
+	double now = glfwGetTime();
+	frameTime = (float)fmod(now, (double)TIME_PERIOD);
+
+	size_t offset;
+	FrameBlock *frame = (FrameBlock*)streamBuffer->map(sizeof(FrameBlock), uniformAlignment, offset);
+	if (frame) {
+		frame->projectionMatrix = projection;
+		frame->viewMatrix = view;
+		frame->cameraPosition = glm::vec4(_camera->Position, 1.0f);
+		frame->time = (float)now;
+		frame->particleTime = frameTime;
+		streamBuffer->unmap();
+		_glState->bindBufferRange(GL_UNIFORM_BUFFER, FRAME_BLOCK, streamBuffer->getBuffer(), offset, sizeof(FrameBlock));
+	}
+}
 
-	glBindVertexArray(quadVAO);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glBindVertexArray(0);
+void RenderSystem::setupStatelessParticles(Shader *shader, const ParticleEmitter &emitter) {
 
+	shader->setVec3("boundsMin"_u, emitter.boundsMin);
+	shader->setVec3("boundsSize"_u, emitter.boundsMax - emitter.boundsMin);
+	shader->setVec3("velocity"_u, emitter.velocity);
+	shader->setVec3("velocityJitter"_u, emitter.velocityJitter);
+	shader->setVec3("rotationAxis"_u, glm::normalize(emitter.rotationAxis));
+	shader->setVec2("scaleRange"_u, emitter.scaleMin, emitter.scaleMax);
+	shader->setFloat("timePeriod"_u, (float)TIME_PERIOD);
 }
 
-void RenderSystem::setupLightsParameter(glm::vec3 ambientColor, glm::vec3 pointPosition) {
+// Sub-pixel offsets of the scene from the (2, 3) Halton sequence, over the frames each window pixel is covered
+// by scene samples all over it. jitter is how far the image moved, in texture coordinates.
+glm::mat4 RenderSystem::jitterProjection(glm::mat4 projection, glm::vec2 &jitter) {
 
-	getShader("light")->Use();
+	unsigned int index = jitterIndex++ % 16 + 1;
+	glm::vec2 ndc((halton(index, 2) - 0.5f) * 2.0f / renderWidth, (halton(index, 3) - 0.5f) * 2.0f / renderHeight);
 
-	getShader("light")->setInt("material.diffuse", 0);
-	getShader("light")->setVec3("viewPos", _camera->Position);
-	getShader("light")->setFloat("material.shininess", 64.0f);
-
-	// directional light
-	//getShader("light")->setVec3("dirLight.direction", 0.0f, 1.0f, 0.0f);
-	//getShader("light")->setVec3("dirLight.ambient", -ambientColor.x*0, -ambientColor.y*0, -ambientColor.z*0);
-	//getShader("light")->setVec3("dirLight.ambient", 0.3f, 0.3f, 0.3f);
-	//getShader("light")->setVec3("dirLight.diffuse", 0.2f, 0.2f, 0.2f);
-	//getShader("light")->setVec3("dirLight.specular", 0.3f, 0.3f, 0.3f);
-
-	// point light 1
-	getShader("light")->setVec3("pointLights[0].position", glm::vec3(pointPosition.x, pointPosition.y, pointPosition.z));
-	getShader("light")->setVec3("pointLights[0].ambient", ambientColor.x, ambientColor.y, ambientColor.z);
-	getShader("light")->setVec3("pointLights[0].diffuse", 0.8f, 0.8f, 0.8f);
-	getShader("light")->setVec3("pointLights[0].specular", 0.5f, 0.5f, 0.5f);
-	getShader("light")->setFloat("pointLights[0].constant", 1.0f);
-	getShader("light")->setFloat("pointLights[0].linear", 0.09f);
-	getShader("light")->setFloat("pointLights[0].quadratic", 0.032f);
-
-	// point light 2
-	getShader("light")->setVec3("pointLights[1].position", glm::vec3(pointPosition.x - abs(pointPosition.x*0.25f), pointPosition.y, pointPosition.z /*- abs(pointPosition.z*0.25f)*/));
-	getShader("light")->setVec3("pointLights[1].ambient", ambientColor.x, ambientColor.y, ambientColor.z);
-	getShader("light")->setVec3("pointLights[1].diffuse",  0.8f, 0.8f, 0.8f);
-	getShader("light")->setVec3("pointLights[1].specular", 0.5f, 0.5f, 0.5f);
-	getShader("light")->setFloat("pointLights[1].constant", 1.0f);
-	getShader("light")->setFloat("pointLights[1].linear", 0.09f);
-	getShader("light")->setFloat("pointLights[1].quadratic", 0.032f);
-}
-
-void RenderSystem::applyBloom() {
+	// the third column is scaled by the view depth, -w, so this moves the image by ndc after the divide
+	projection[2][0] -= ndc.x;
+	projection[2][1] -= ndc.y;
 
-	getShader("blur")->Use();
+	jitter = ndc * 0.5f;
+	return projection;
+}
 
-	bool horizontal = true, first_iteration = true;
-	unsigned int amount = 10;
+// Resolves the scene into the history at the window size, returns the texture to show
+unsigned int RenderSystem::applyTemporalUpscale(glm::mat4 jitteredViewProjection, glm::vec2 jitter) {
 
-	for (unsigned int i = 0; i < amount; i++)
-	{
-		glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBOs[horizontal]);
-		getShader("blur")->setInt("horizontal", horizontal);
-		glBindTexture(GL_TEXTURE_2D, first_iteration ? colorBuffers[1] : pingpongColorbuffers[!horizontal]);  // bind texture of other framebuffer (or scene if first iteration)
-		renderScreen();
-		horizontal = !horizontal;
-		if (first_iteration)
-			first_iteration = false;
-	}
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	_glState->bindFramebuffer(GL_FRAMEBUFFER, historyFBOs[historyIndex]);
+	glViewport(0, 0, windowWidth, windowHeight);
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	Shader *shader = getShader("taa");
+	shader->Use();
+	shader->setVec2("jitter"_u, jitter);
+	shader->setMat4("reprojection"_u, previousViewProjection * glm::inverse(jitteredViewProjection));
+	shader->setBool("historyValid"_u, historyValid);
 
-	getShader("bloomFinal")->Use();
+	_glState->bindTexture(0, GL_TEXTURE_2D, colorBuffers[0]);
+	_glState->bindTexture(1, GL_TEXTURE_2D, depthBuffer);
+	_glState->bindTexture(2, GL_TEXTURE_2D, motionBuffer);
+	_glState->bindTexture(3, GL_TEXTURE_2D, historyBuffers[1 - historyIndex]);
+	renderScreen();
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, colorBuffers[0]);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[!horizontal]);
+	unsigned int resolved = historyBuffers[historyIndex];
+	historyIndex = 1 - historyIndex;
+	historyValid = true;
+
+	glViewport(0, 0, renderWidth, renderHeight);
+	return resolved;
+}
+
+void RenderSystem::applyBloom(unsigned int scene) {
 
 	if ((_world->getBody("player")->getWorldTransform().getOrigin().getX() < (-9.75f) && _world->getBody("player")->getWorldTransform().getOrigin().getX() > (-29.3f)) && (_world->getBody("player")->getWorldTransform().getOrigin().getZ() > (-0.08f) && _world->getBody("player")->getWorldTransform().getOrigin().getZ() < (19.3f))) {
 		if (!bloom)
@@ -1025,15 +1767,80 @@ void RenderSystem::applyBloom() {
 			bloom = false;		
 	}
 
-	getShader("bloomFinal")->setBool("bloom", bloom);
-	getShader("bloomFinal")->setFloat("exposure", exposure);
+	// without bloom bloom_final.frag never reads the blur, so it is not drawn at all
+	unsigned int blurred = 0;
+	if (bloom) {
+		bloomTimer->begin();
+		blurred = dualFilterBloom ? applyDualFilterBloom() : applyGaussianBloom();
+		bloomTimer->end();
+		bloomTimer->endFrame();
+	}
+	_glState->bindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, windowWidth, windowHeight);
 
-	//getShader("bloomFinal")->setBool("shake", true);
-	//getShader("bloomFinal")->setFloat("time", glfwGetTime());
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	getShader("bloomFinal")->Use();
+
+	_glState->bindTexture(0, GL_TEXTURE_2D, scene);
+	_glState->bindTexture(1, GL_TEXTURE_2D, blurred);
+
+	getShader("bloomFinal")->setBool("bloom"_u, bloom);
+	getShader("bloomFinal")->setFloat("exposure"_u, exposure);
+
+	//getShader("bloomFinal")->setBool("shake"_u, true);
+	//getShader("bloomFinal")->setFloat("time"_u, glfwGetTime());
 
 	//cout << "bloom: " << (bloom ? "on" : "off") << "| exposure: " << exposure << endl;
 }
 
+// Down the mip chain then back up to half resolution, a few bilinear taps per pixel of each level. Returns the
+// blurred texture, bloom_final.frag stretches it over the screen.
+unsigned int RenderSystem::applyDualFilterBloom() {
+
+	getShader("bloomDown")->Use();
+	for (int level = 0; level < BLOOM_LEVELS; level++)
+	{
+		glViewport(0, 0, glm::max(renderWidth >> (level + 1), 1u), glm::max(renderHeight >> (level + 1), 1u));
+		_glState->bindFramebuffer(GL_FRAMEBUFFER, bloomFBOs[level]);
+		_glState->bindTexture(0, GL_TEXTURE_2D, level == 0 ? colorBuffers[1] : bloomBuffers[level - 1]);
+		renderScreen();
+	}
+
+	getShader("bloomUp")->Use();
+	for (int level = BLOOM_LEVELS - 2; level >= 0; level--)
+	{
+		glViewport(0, 0, glm::max(renderWidth >> (level + 1), 1u), glm::max(renderHeight >> (level + 1), 1u));
+		_glState->bindFramebuffer(GL_FRAMEBUFFER, bloomFBOs[level]);
+		_glState->bindTexture(0, GL_TEXTURE_2D, bloomBuffers[level + 1]);
+		renderScreen();
+	}
+
+	return bloomBuffers[0];
+}
+
+// The former bloom, ten full resolution gaussian passes, kept to compare against
+unsigned int RenderSystem::applyGaussianBloom() {
+
+	getShader("blur")->Use();
+
+	bool horizontal = true, first_iteration = true;
+	unsigned int amount = 10;
+
+	for (unsigned int i = 0; i < amount; i++)
+	{
+		_glState->bindFramebuffer(GL_FRAMEBUFFER, pingpongFBOs[horizontal]);
+		getShader("blur")->setInt("horizontal"_u, horizontal);
+		_glState->bindTexture(0, GL_TEXTURE_2D, first_iteration ? colorBuffers[1] : pingpongColorbuffers[!horizontal]);  // bind texture of other framebuffer (or scene if first iteration)
+		renderScreen();
+		horizontal = !horizontal;
+		if (first_iteration)
+			first_iteration = false;
+	}
+
+	return pingpongColorbuffers[!horizontal];
+}
+
 void RenderSystem::applyWind() {
 
 	map<string, btRigidBody*> bodies= _world->getBodies();
@@ -1106,10 +1913,12 @@ void RenderSystem::applyUnderwater() {
 
 	for (map<string, btRigidBody*>::iterator it = bodies.begin(); it != bodies.end(); ++it)
 	{
+		// the water carries half of a body's weight and drags it along with the flow
+		water->applyBodyForces((*it).second, 0.5f, 2.0f);
+
 		if (((*it).second->getWorldTransform().getOrigin().getX() < (-11 - 0.0002) && (*it).second->getWorldTransform().getOrigin().getX() > (-29 + 0.0002)) && ((*it).second->getWorldTransform().getOrigin().getZ() > (1 - 0.0002) && (*it).second->getWorldTransform().getOrigin().getZ() < (19 + 0.0002))) {
 			
 			(*it).second->activate();
-			(*it).second->setGravity(btVector3(0,-5,0));
 			(*it).second->setFriction(3);
 			if ((*it).first == "player") {
 				_camera->MaxSpeed = 5.0f;
@@ -1118,8 +1927,6 @@ void RenderSystem::applyUnderwater() {
 		else
 		{		
 			(*it).second->activate();
-			if((*it).second->getGravity().getY() == -5)
-				(*it).second->setGravity(btVector3(0, -10, 0));
 			if ((*it).second->getFriction() == 3) {
 				(*it).second->setFriction(1);
 				if ((*it).first == "player") {
@@ -5,6 +5,7 @@
 #include <GLFW\glfw3.h>
 #include <iostream>
 #include <vector>
+#include <unordered_set>
 #include <glm\glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/matrix_inverse.hpp>
@@ -12,10 +13,26 @@
 #include <btBulletDynamicsCommon.h>
 
 #include "BulletWorld.h"
+#include "DistanceField.h"
+#include "DrawBatcher.h"
+#include "FluidSystem.h"
+#include "Frustum.h"
+#include "GpuTimer.h"
+#include "GLState.h"
+#include "InstanceFormat.h"
+#include "LightClusters.h"
+#include "LodBuckets.h"
+#include "OcclusionBuffer.h"
+#include "ParticleSystem.h"
+#include "RenderQueue.h"
+#include "StreamBuffer.h"
 #include "Shader.h"
+#include "SphereImpostors.h"
+#include "StaticGeometry.h"
 #include "Camera.h"
 #include "Model.h"
 #include "Texture2D.h"
+#include "UniformBlocks.h"
 
 using namespace std;
 
@@ -33,23 +50,96 @@ public:
 	static RenderSystem& getRenderSystem();
 	static void destroyRenderSystem();
 
-	void render();
+	// The bubbles rising through room 5, shared with the headless spawn check
+	static ParticleEmitter makeBubblesEmitter();
+
+	void render(float deltaTime);
 	
 private:
 
 	bool bloom;
+	bool dualFilterBloom;
+	bool temporalUpscale;
+	bool statelessParticles;
+	bool sphereImpostors;
 	float exposure;
 
-	unsigned int dustVBO, bubblesVBO, quadVAO, quadVBO, framebuffer, textureColorbuffer;
-	unsigned int dustAmount, bubblesAmount, ballsAmount, boxesAmount;
-	unsigned int hdrFBO, rboDepth;
+	unsigned int pointVAO, quadVAO, quadVBO, framebuffer, textureColorbuffer;
+	unsigned int dustAmount, bubblesAmount, ballsAmount, boxesAmount, rocksAmount, waterAmount;
+	unsigned int hdrFBO, depthBuffer;
 	unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
 	unsigned int pingpongFBOs[2];
 	unsigned int pingpongColorbuffers[2];
 	unsigned int colorBuffers[2];
 
+	// bloom mip chain, level l is the screen size divided by 2^(l + 1)
+	static const int BLOOM_LEVELS = 5;
+	unsigned int bloomFBOs[BLOOM_LEVELS], bloomBuffers[BLOOM_LEVELS];
+	GpuTimer *bloomTimer;
+
+	// the scene is drawn at renderScale times the window size, lowered while the GPU misses frameBudget
+	// (milliseconds) and stretched over the window by the last pass
+	unsigned int windowWidth, windowHeight, renderWidth, renderHeight;
+	float renderScale, minRenderScale, maxRenderScale, frameBudget, smoothedFrameTime;
+	double scaleChangeTime;
+	GpuTimer *frameTimer;
+
+	// temporal upscaling: the jittered scene is accumulated into a history at the window size, reprojected with
+	// the depth and the motion of the bodies
+	unsigned int motionFBO, motionBuffer;
+	unsigned int historyFBOs[2], historyBuffers[2];
+	unsigned int historyIndex, jitterIndex;
+	bool historyValid;
+	glm::mat4 previousViewProjection;
+	map<const btCollisionObject*, glm::mat4> previousTransforms;
+
 	Model *cubeModel, *sphereModel, *dustModel;
-	glm::mat4 *dustModelMatrices, *bubblesModelMatrices;
+	InstanceFormat dustFormat, bubblesFormat;
+	unsigned int dustEmitter, bubblesEmitter;
+	unsigned int dustSeedVBO, bubblesSeedVBO;
+	LodBuckets dustLods, bubblesLods;
+	float pixelsPerUnit, frameTime;
+	// frameTime (FrameData.particleTime) wraps around every TIME_PERIOD seconds so the particle shaders keep a
+	// float's precision, the stateless particles cross their bounds a whole number of times in it and loop seamlessly
+	static const int TIME_PERIOD = 600;
+
+	DistanceField *levelField;
+	FluidSystem *water;
+	StreamBuffer *streamBuffer;
+	StaticGeometry *staticGeometry;
+	DrawBatcher *batcher;
+	SphereImpostors *impostors;
+	RenderQueue *renderQueue;
+
+	Frustum frustum;
+	unordered_set<const btCollisionObject*> visibleBodies;
+	vector<const btCollisionObject*> treeVisible;
+	map<string, unsigned int> volumes;
+	vector<float> volumeMinX, volumeMinY, volumeMinZ, volumeMaxX, volumeMaxY, volumeMaxZ;
+	vector<unsigned char> volumeVisible;
+	bool portalCulling;
+	vector<unsigned char> cellVisible;
+	vector<glm::vec4> cellRects;
+	vector<Frustum> cellFrusta;
+	OcclusionBuffer *occlusion;
+
+	vector<btRigidBody*> balls, boxes, rocks;
+
+	// every point light of the level, sorted into clusters each frame and read by the lit shaders from buffer
+	// textures on units LIGHT_TEXTURE_UNIT and the next two. The clusters and their indices are streamed and
+	// viewed with glTexBufferRange (GL 4.3 / ARB_texture_buffer_range, loaded by hand), or copied into buffers
+	// of their own without it.
+	typedef void (APIENTRY *TexBufferRangeProc)(GLenum target, GLenum internalFormat, GLuint buffer, GLintptr offset, GLsizeiptr size);
+	static const int LIGHT_TEXTURE_UNIT = 4;
+	LightClusters *lightClusters;
+	unsigned int extraLightsAmount;
+	unsigned int lightDataBuffer, clusterBuffer, lightIndexBuffer;
+	unsigned int lightDataTexture, clusterTexture, lightIndexTexture;
+	TexBufferRangeProc texBufferRange;
+	size_t texBufferAlignment, maxTexBufferTexels;
+	vector<unsigned int> emptyClusters;
+	size_t uniformAlignment;
+	ParticleSystem *ambientParticles;
 
 	static RenderSystem *renderSystem;
 	static map<string, Shader*> Shaders;
@@ -58,6 +148,8 @@ private:
 	BulletWorld *_world;
 	GLFWwindow *_window;
 	Camera *_camera;
+	GLState *_glState;
+	double stateReportTime;
 
 	RenderSystem();
 	~RenderSystem();
@@ -68,34 +160,72 @@ private:
 	void initializeScreenQuad();
 	void initializeDust();
 	void initializeBubbles();
+	void initializeStaticGeometry();
+	void initializeLights();
+	void initializeCulling();
+	void initializeParticleSeeds(unsigned int amount, unsigned int &seedVBO);
+	void initializeParticleLods();
+	void initializeBloom();
+	void initializeRenderScale();
+	void initializeTemporalUpscale();
 
 	void addShader(Shader *shader, string name);
 	void addTexture(Texture2D *texture, string name);
 	void addRooms(string name);
+	void addLights(string name, glm::vec3 ambientColor, glm::vec3 pointPosition);
+	void addExtraLights(unsigned int amount);
 	void addBallsToBounce(string name, unsigned int amount);
 	void addBoxesToShake(string name, unsigned int amount);
+	void addRocksToShake(string name, unsigned int amount);
 
 	Shader* RenderSystem::getShader(string name);
 	Texture2D* RenderSystem::getTexture(string name);
 
-	void setupLightsParameter(glm::vec3 dirAmbient, glm::vec3 pointPosition);
+	void resizeTargets(unsigned int width, unsigned int height);
+	void resizeHistory(unsigned int width, unsigned int height);
+	void updateRenderScale();
+	glm::mat4 jitterProjection(glm::mat4 projection, glm::vec2 &jitter);
+	void uploadUniformBlocks(glm::mat4 projection, glm::mat4 view);
+	void uploadLightClusters(glm::mat4 projection, glm::mat4 view);
+	void setupStatelessParticles(Shader *shader, const ParticleEmitter &emitter);
+	void setupParticleShader(Shader *shader, const ParticleEmitter &emitter, InstanceFormat format, glm::vec4 color, float mixRatio);
+	void setupParticleAttributes(unsigned int buffer, InstanceFormat format, size_t offset);
 	
-	void renderRoom1(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color);
-	void renderRoom2(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color);
-	void renderRoom3(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color);
-	void renderRoom4(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color);
-	void renderRoom5(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color);
-	void renderRoom6(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color);
-	void renderBox(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color);
-	void renderSphere(string name, glm::mat4 projection, glm::mat4 view, glm::vec3 color);
-	void renderBallsToBounce(string name, glm::mat4 projection, glm::mat4 view, unsigned int amount);
-	void renderBoxesToShake(string name, glm::mat4 projection, glm::mat4 view, unsigned int amount);
-	void renderDust(glm::mat4 projection, glm::mat4 view, unsigned int amount, glm::mat4* modelMatrices);
-	void renderWaterWaves(glm::mat4 projection, glm::mat4 view);
-	void renderBubbles(glm::mat4 projection, glm::mat4 view, unsigned int amount, glm::mat4* modelMatrices);
+	void addVolume(string name, glm::vec3 boundsMin, glm::vec3 boundsMax);
+	void cullScene(glm::mat4 viewProjection);
+	bool isVolumeVisible(string name);
+	bool isBodyVisible(const btCollisionObject *body);
+	bool isInVisibleCell(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax);
+
+	void queueScene();
+	void queueRoom(string name, string texture);
+	glm::vec3 roomCenter(string name);
+	float distanceToCamera(glm::vec3 position);
+
+	void renderRoom(string name, string texture);
+	void renderBox(string name, glm::vec3 color);
+	void renderSphere(string name, glm::vec3 color);
+	void renderBallsToBounce(string name, unsigned int amount);
+	void renderBoxesToShake(string name, unsigned int amount);
+	void renderRocksToShake(string name, unsigned int amount);
+	void renderDust();
+	void renderWater();
+	void renderBubbles();
+	void renderBubbleImpostors();
+	void setupBubbleImpostors(Shader *shader);
+	void renderParticles(Model *model, unsigned int emitter, InstanceFormat format, LodBuckets &lods, unsigned int seedVBO, glm::vec4 color, float mixRatio, bool reactive);
+	void renderMotion();
+	glm::mat4 getPreviousTransform(const btCollisionObject *body, const glm::mat4 &transform);
+	void renderMeshMotion(Shader *shader, Model *model, InstanceFormat format, const vector<btRigidBody*> &bodies, map<const btCollisionObject*, glm::mat4> &transforms);
+	void renderBallMotion(Shader *shader, const vector<btRigidBody*> &spheres, map<const btCollisionObject*, glm::mat4> &transforms);
+	void renderWaterMotion(Shader *shader);
 	void renderScreen();
+	void reportStateCalls();
 	
-	void applyBloom();
+	unsigned int applyTemporalUpscale(glm::mat4 jitteredViewProjection, glm::vec2 jitter);
+	void applyBloom(unsigned int scene);
+	unsigned int applyDualFilterBloom();
+	unsigned int applyGaussianBloom();
 	void applyWind();
 	void applyEathquake();
 	void applyUnderwater();
@@ -1,4 +1,5 @@
 #include "Shader.h"
+#include "GLState.h"
 
 Shader::Shader(const GLchar* vertexPath, const GLchar* fragmentPath)
 {
@@ -52,6 +53,7 @@ Shader::Shader(const GLchar* vertexPath, const GLchar* fragmentPath)
 	glAttachShader(programID, fragment);
 	glLinkProgram(programID);
 	checkCompileErrors(programID, "PROGRAM");
+	reflectUniforms();
 
 	glDeleteShader(vertex);
 	glDeleteShader(fragment);
@@ -91,6 +93,7 @@ void Shader::Compile(const GLchar* vertexSource, const GLchar* fragmentSource, c
 		glAttachShader(this->programID, gShader);
 	glLinkProgram(this->programID);
 	checkCompileErrors(this->programID, "PROGRAM");
+	reflectUniforms();
 	// Delete the shaders as they're linked into our program now and no longer necessery
 	glDeleteShader(sVertex);
 	glDeleteShader(sFragment);
@@ -100,68 +103,262 @@ void Shader::Compile(const GLchar* vertexSource, const GLchar* fragmentSource, c
 
 Shader &Shader::Use()
 {
-	glUseProgram(this->programID);
+	GLState::getGLState().useProgram(this->programID);
 	return *this;
 }
 
-void Shader::setBool(const std::string &name, bool value) const
+void Shader::setBool(const char *name, bool value) const
 {
-	glUniform1i(glGetUniformLocation(programID, name.c_str()), (int)value);
+	setBool(UniformHash(hashUniformName(name)), value);
 }
 
-void Shader::setInt(const std::string &name, int value) const
+void Shader::setInt(const char *name, int value) const
 {
-	glUniform1i(glGetUniformLocation(programID, name.c_str()), value);
+	setInt(UniformHash(hashUniformName(name)), value);
 }
 
-void Shader::setFloat(const std::string &name, float value) const
+void Shader::setFloat(const char *name, float value) const
 {
-	glUniform1f(glGetUniformLocation(programID, name.c_str()), value);
+	setFloat(UniformHash(hashUniformName(name)), value);
 }
 
-void Shader::setVec2(const std::string &name, const glm::vec2 &value) const
+void Shader::setVec2(const char *name, const glm::vec2 &value) const
 {
-	glUniform2fv(glGetUniformLocation(programID, name.c_str()), 1, &value[0]);
+	setVec2(UniformHash(hashUniformName(name)), value);
 }
 
-void Shader::setVec2(const std::string &name, float x, float y) const
+void Shader::setVec2(const char *name, float x, float y) const
 {
-	glUniform2f(glGetUniformLocation(programID, name.c_str()), x, y);
+	setVec2(UniformHash(hashUniformName(name)), x, y);
 }
 
-void Shader::setVec3(const std::string &name, const glm::vec3 &value) const
+void Shader::setVec3(const char *name, const glm::vec3 &value) const
 {
-	glUniform3fv(glGetUniformLocation(programID, name.c_str()), 1, &value[0]);
+	setVec3(UniformHash(hashUniformName(name)), value);
 }
 
-void Shader::setVec3(const std::string &name, float x, float y, float z) const
+void Shader::setVec3(const char *name, float x, float y, float z) const
 {
-	glUniform3f(glGetUniformLocation(programID, name.c_str()), x, y, z);
+	setVec3(UniformHash(hashUniformName(name)), x, y, z);
 }
 
-void Shader::setVec4(const std::string &name, const glm::vec4 &value) const
+void Shader::setVec4(const char *name, const glm::vec4 &value) const
 {
-	glUniform4fv(glGetUniformLocation(programID, name.c_str()), 1, &value[0]);
+	setVec4(UniformHash(hashUniformName(name)), value);
 }
 
-void Shader::setVec4(const std::string &name, float x, float y, float z, float w)
+void Shader::setVec4(const char *name, float x, float y, float z, float w) const
 {
-	glUniform4f(glGetUniformLocation(programID, name.c_str()), x, y, z, w);
+	setVec4(UniformHash(hashUniformName(name)), x, y, z, w);
 }
 
-void Shader::setMat2(const std::string &name, const glm::mat2 &mat) const
+void Shader::setMat2(const char *name, const glm::mat2 &mat) const
 {
-	glUniformMatrix2fv(glGetUniformLocation(programID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+	setMat2(UniformHash(hashUniformName(name)), mat);
 }
 
-void Shader::setMat3(const std::string &name, const glm::mat3 &mat) const
+void Shader::setMat3(const char *name, const glm::mat3 &mat) const
 {
-	glUniformMatrix3fv(glGetUniformLocation(programID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+	setMat3(UniformHash(hashUniformName(name)), mat);
 }
 
-void Shader::setMat4(const std::string &name, const glm::mat4 &mat) const
+void Shader::setMat4(const char *name, const glm::mat4 &mat) const
 {
-	glUniformMatrix4fv(glGetUniformLocation(programID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+	setMat4(UniformHash(hashUniformName(name)), mat);
+}
+
+void Shader::setBool(UniformHash name, bool value) const
+{
+	glUniform1i(getLocation(name), (int)value);
+}
+
+void Shader::setInt(UniformHash name, int value) const
+{
+	glUniform1i(getLocation(name), value);
+}
+
+void Shader::setFloat(UniformHash name, float value) const
+{
+	glUniform1f(getLocation(name), value);
+}
+
+void Shader::setVec2(UniformHash name, const glm::vec2 &value) const
+{
+	glUniform2fv(getLocation(name), 1, &value[0]);
+}
+
+void Shader::setVec2(UniformHash name, float x, float y) const
+{
+	glUniform2f(getLocation(name), x, y);
+}
+
+void Shader::setVec3(UniformHash name, const glm::vec3 &value) const
+{
+	glUniform3fv(getLocation(name), 1, &value[0]);
+}
+
+void Shader::setVec3(UniformHash name, float x, float y, float z) const
+{
+	glUniform3f(getLocation(name), x, y, z);
+}
+
+void Shader::setVec4(UniformHash name, const glm::vec4 &value) const
+{
+	glUniform4fv(getLocation(name), 1, &value[0]);
+}
+
+void Shader::setVec4(UniformHash name, float x, float y, float z, float w) const
+{
+	glUniform4f(getLocation(name), x, y, z, w);
+}
+
+void Shader::setMat2(UniformHash name, const glm::mat2 &mat) const
+{
+	glUniformMatrix2fv(getLocation(name), 1, GL_FALSE, &mat[0][0]);
+}
+
+void Shader::setMat3(UniformHash name, const glm::mat3 &mat) const
+{
+	glUniformMatrix3fv(getLocation(name), 1, GL_FALSE, &mat[0][0]);
+}
+
+void Shader::setMat4(UniformHash name, const glm::mat4 &mat) const
+{
+	glUniformMatrix4fv(getLocation(name), 1, GL_FALSE, &mat[0][0]);
+}
+
+void Shader::set(Uniform<bool> uniform, bool value) const
+{
+	glUniform1i(uniform.location, (int)value);
+}
+
+void Shader::set(Uniform<int> uniform, int value) const
+{
+	glUniform1i(uniform.location, value);
+}
+
+void Shader::set(Uniform<float> uniform, float value) const
+{
+	glUniform1f(uniform.location, value);
+}
+
+void Shader::set(Uniform<glm::vec2> uniform, const glm::vec2 &value) const
+{
+	glUniform2fv(uniform.location, 1, &value[0]);
+}
+
+void Shader::set(Uniform<glm::vec3> uniform, const glm::vec3 &value) const
+{
+	glUniform3fv(uniform.location, 1, &value[0]);
+}
+
+void Shader::set(Uniform<glm::vec4> uniform, const glm::vec4 &value) const
+{
+	glUniform4fv(uniform.location, 1, &value[0]);
+}
+
+void Shader::set(Uniform<glm::mat2> uniform, const glm::mat2 &mat) const
+{
+	glUniformMatrix2fv(uniform.location, 1, GL_FALSE, &mat[0][0]);
+}
+
+void Shader::set(Uniform<glm::mat3> uniform, const glm::mat3 &mat) const
+{
+	glUniformMatrix3fv(uniform.location, 1, GL_FALSE, &mat[0][0]);
+}
+
+void Shader::set(Uniform<glm::mat4> uniform, const glm::mat4 &mat) const
+{
+	glUniformMatrix4fv(uniform.location, 1, GL_FALSE, &mat[0][0]);
+}
+
+GLint Shader::getLocation(UniformHash name) const
+{
+	if (uniforms.empty())
+		return -1;
+
+	size_t mask = uniforms.size() - 1;
+	for (size_t slot = name.value & mask; ; slot = (slot + 1) & mask)
+	{
+		if (uniforms[slot].location == -1)
+			return -1;
+		if (uniforms[slot].hash == name.value)
+			return uniforms[slot].location;
+	}
+}
+
+void Shader::bindUniformBlock(const char *name, GLuint binding) const
+{
+	GLuint index = glGetUniformBlockIndex(programID, name);
+	if (index != GL_INVALID_INDEX)
+		glUniformBlockBinding(programID, index, binding);
+}
+
+void Shader::reflectUniforms()
+{
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(programID, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(programID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+	// arrays of plain types report only their first element, every element gets a slot
+	std::vector<std::pair<std::string, GLint>> active;
+	std::vector<GLchar> buffer(maxLength + 1);
+	for (GLint i = 0; i < count; i++)
+	{
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(programID, i, maxLength + 1, NULL, &size, &type, &buffer[0]);
+		std::string name(&buffer[0]);
+
+		if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+			std::string base = name.substr(0, name.size() - 3);
+			active.push_back(std::make_pair(base, glGetUniformLocation(programID, name.c_str())));
+			for (GLint element = 0; element < size; element++)
+			{
+				std::string elementName = base + "[" + std::to_string(element) + "]";
+				active.push_back(std::make_pair(elementName, glGetUniformLocation(programID, elementName.c_str())));
+			}
+		}
+		else {
+			active.push_back(std::make_pair(name, glGetUniformLocation(programID, name.c_str())));
+		}
+	}
+
+	size_t capacity = 16;
+	while (capacity < active.size() * 2)
+		capacity *= 2;
+
+	UniformSlot empty = { 0, -1 };
+	uniforms.assign(capacity, empty);
+
+	std::vector<std::string> names(capacity);
+	for (auto &uniform : active)
+		addUniform(uniform.first, uniform.second, names);
+}
+
+void Shader::addUniform(const std::string &name, GLint location, std::vector<std::string> &names)
+{
+	// uniforms inside blocks have no location
+	if (location == -1)
+		return;
+
+	uint32_t hash = hashUniformName(name.c_str());
+	size_t mask = uniforms.size() - 1;
+	size_t slot = hash & mask;
+
+	while (uniforms[slot].location != -1)
+	{
+		if (uniforms[slot].hash == hash) {
+			if (names[slot] != name)
+				std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION " << names[slot] << " and " << name << std::endl;
+			return;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	uniforms[slot].hash = hash;
+	uniforms[slot].location = location;
+	names[slot] = name;
 }
 
 void Shader::checkCompileErrors(unsigned int shader, std::string type)
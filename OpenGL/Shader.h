@@ -5,11 +5,36 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/matrix_inverse.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cstdint>
 #include <string>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+// 32-bit FNV-1a of a uniform name, usable at compile time
+constexpr uint32_t hashUniformName(const char *name, uint32_t hash = 2166136261u) {
+	return *name ? hashUniformName(name + 1, (hash ^ (uint32_t)(unsigned char)*name) * 16777619u) : hash;
+}
+
+struct UniformHash {
+	uint32_t value;
+	constexpr explicit UniformHash(uint32_t value) : value(value) {}
+};
+
+// "viewPos"_u hashes the name while compiling
+constexpr UniformHash operator"" _u(const char *name, size_t) {
+	return UniformHash(hashUniformName(name));
+}
+
+// Uniform location resolved once, set through the matching Shader::set overload
+template <typename T>
+struct Uniform {
+	GLint location;
+	Uniform() : location(-1) {}
+	explicit Uniform(GLint location) : location(location) {}
+};
+
 class Shader
 {
 public:
@@ -24,20 +49,63 @@ public:
 
 	Shader  &Use();
 
-	void setBool(const std::string &name, bool value) const;
-	void setInt(const std::string &name, int value) const;
-	void setFloat(const std::string &name, float value) const;
-	void setVec2(const std::string &name, const glm::vec2 &value) const;
-	void setVec2(const std::string &name, float x, float y) const;
-	void setVec3(const std::string &name, const glm::vec3 &value) const;
-	void setVec3(const std::string &name, float x, float y, float z) const;
-	void setVec4(const std::string &name, const glm::vec4 &value) const;
-	void setVec4(const std::string &name, float x, float y, float z, float w);
-	void setMat2(const std::string &name, const glm::mat2 &mat) const;
-	void setMat3(const std::string &name, const glm::mat3 &mat) const;
-	void setMat4(const std::string &name, const glm::mat4 &mat) const;
+	// Every active uniform is reflected at link time, so the setters only hash the name and look it up
+	void setBool(const char *name, bool value) const;
+	void setInt(const char *name, int value) const;
+	void setFloat(const char *name, float value) const;
+	void setVec2(const char *name, const glm::vec2 &value) const;
+	void setVec2(const char *name, float x, float y) const;
+	void setVec3(const char *name, const glm::vec3 &value) const;
+	void setVec3(const char *name, float x, float y, float z) const;
+	void setVec4(const char *name, const glm::vec4 &value) const;
+	void setVec4(const char *name, float x, float y, float z, float w) const;
+	void setMat2(const char *name, const glm::mat2 &mat) const;
+	void setMat3(const char *name, const glm::mat3 &mat) const;
+	void setMat4(const char *name, const glm::mat4 &mat) const;
+
+	// Same with the name hashed while compiling, e.g. setMat4("viewMatrix"_u, view)
+	void setBool(UniformHash name, bool value) const;
+	void setInt(UniformHash name, int value) const;
+	void setFloat(UniformHash name, float value) const;
+	void setVec2(UniformHash name, const glm::vec2 &value) const;
+	void setVec2(UniformHash name, float x, float y) const;
+	void setVec3(UniformHash name, const glm::vec3 &value) const;
+	void setVec3(UniformHash name, float x, float y, float z) const;
+	void setVec4(UniformHash name, const glm::vec4 &value) const;
+	void setVec4(UniformHash name, float x, float y, float z, float w) const;
+	void setMat2(UniformHash name, const glm::mat2 &mat) const;
+	void setMat3(UniformHash name, const glm::mat3 &mat) const;
+	void setMat4(UniformHash name, const glm::mat4 &mat) const;
+
+	template <typename T>
+	Uniform<T> getUniform(const char *name) const { return Uniform<T>(getLocation(UniformHash(hashUniformName(name)))); }
+
+	void set(Uniform<bool> uniform, bool value) const;
+	void set(Uniform<int> uniform, int value) const;
+	void set(Uniform<float> uniform, float value) const;
+	void set(Uniform<glm::vec2> uniform, const glm::vec2 &value) const;
+	void set(Uniform<glm::vec3> uniform, const glm::vec3 &value) const;
+	void set(Uniform<glm::vec4> uniform, const glm::vec4 &value) const;
+	void set(Uniform<glm::mat2> uniform, const glm::mat2 &mat) const;
+	void set(Uniform<glm::mat3> uniform, const glm::mat3 &mat) const;
+	void set(Uniform<glm::mat4> uniform, const glm::mat4 &mat) const;
+
+	GLint getLocation(UniformHash name) const;
+
+	// Points the named uniform block at a binding index, blocks the program does not use are ignored
+	void bindUniformBlock(const char *name, GLuint binding) const;
 
 private:
 
+	struct UniformSlot {
+		uint32_t hash;
+		GLint location;
+	};
+
+	// open addressing table, a power of two in size and never more than half full
+	std::vector<UniformSlot> uniforms;
+
 	void checkCompileErrors(unsigned int shader, std::string type);
+	void reflectUniforms();
+	void addUniform(const std::string &name, GLint location, std::vector<std::string> &names);
 };
\ No newline at end of file
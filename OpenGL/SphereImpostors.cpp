@@ -0,0 +1,87 @@
+#include "SphereImpostors.h"
+#include "GLState.h"
+
+#include <algorithm>
+#include <cstring>
+
+// the quads have no vertex data, impostor.vert picks the corner from gl_VertexID
+SphereImpostors::SphereImpostors(StreamBuffer *stream) : stream(stream), count(0)
+{
+	glGenVertexArrays(1, &VAO);
+	glGenVertexArrays(1, &seedVAO);
+	glGenVertexArrays(1, &motionVAO);
+}
+
+SphereImpostors::~SphereImpostors()
+{
+	glDeleteVertexArrays(1, &VAO);
+	glDeleteVertexArrays(1, &seedVAO);
+	glDeleteVertexArrays(1, &motionVAO);
+}
+
+void SphereImpostors::add(const glm::vec3 &position, float radius, const glm::vec4 &rotation) {
+
+	size_t stride = getInstanceStride(INSTANCE_POSITION_SCALE_ROTATION);
+	if (instances.size() < (count + 1) * stride)
+		instances.resize(max((count + 1) * stride, instances.size() * 2));
+
+	packInstance(INSTANCE_POSITION_SCALE_ROTATION, &instances[0], count++, position, radius, rotation);
+}
+
+void SphereImpostors::flush(Shader *shader) {
+
+	if (count == 0)
+		return;
+
+	size_t stride = getInstanceStride(INSTANCE_POSITION_SCALE_ROTATION);
+	size_t offset;
+	void *mapped = stream->map(count * stride, stride, offset);
+	if (mapped) {
+		memcpy(mapped, &instances[0], count * stride);
+		stream->unmap();
+		draw(shader, INSTANCE_POSITION_SCALE_ROTATION, offset, count);
+	}
+
+	count = 0;
+}
+
+void SphereImpostors::draw(Shader *shader, InstanceFormat format, size_t offset, size_t instanceCount) {
+
+	if (instanceCount == 0)
+		return;
+
+	useInstanceFormat(shader, format);
+
+	GLState::getGLState().bindVertexArray(VAO);
+	setupInstanceAttributes(stream->getBuffer(), format, offset);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)instanceCount);
+}
+
+void SphereImpostors::drawSeeds(Shader *shader, unsigned int seedVBO, size_t instanceCount) {
+
+	if (instanceCount == 0)
+		return;
+
+	GLState &state = GLState::getGLState();
+	state.bindVertexArray(seedVAO);
+	state.bindBuffer(GL_ARRAY_BUFFER, seedVBO);
+	glEnableVertexAttribArray(7);
+	glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+	glVertexAttribDivisor(7, 1);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)instanceCount);
+}
+
+void SphereImpostors::drawMotion(Shader *shader, size_t offset, size_t previousOffset, size_t instanceCount) {
+
+	if (instanceCount == 0)
+		return;
+
+	useInstanceFormat(shader, INSTANCE_POSITION_SCALE);
+
+	GLState::getGLState().bindVertexArray(motionVAO);
+	setupInstanceAttributes(stream->getBuffer(), INSTANCE_POSITION_SCALE, offset);
+	glEnableVertexAttribArray(5);
+	glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, (GLsizei)getInstanceStride(INSTANCE_POSITION_SCALE), (void*)previousOffset);
+	glVertexAttribDivisor(5, 1);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)instanceCount);
+}
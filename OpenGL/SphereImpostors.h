@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <glad\glad.h>
+#include <glm\glm.hpp>
+
+#include "InstanceFormat.h"
+#include "Shader.h"
+#include "StreamBuffer.h"
+
+using namespace std;
+
+// Spheres drawn as camera facing quads of four vertices. impostor.frag intersects the view ray with the exact
+// sphere and writes its depth and normal, so the silhouette is exact at any distance. The quads are built from
+// the instance attributes alone, position + radius in 3 and the rotation in 4 (see InstanceFormat.h).
+class SphereImpostors
+{
+public:
+
+	SphereImpostors(StreamBuffer *stream);
+	~SphereImpostors();
+
+	void add(const glm::vec3 &position, float radius, const glm::vec4 &rotation = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+	// Streams and draws the spheres added since the last flush. The shader must already be in use.
+	void flush(Shader *shader);
+
+	// Draws instanceCount spheres already streamed offset bytes into the ring, in a format without a matrix
+	void draw(Shader *shader, InstanceFormat format, size_t offset, size_t instanceCount);
+	// Draws stateless particles straight from their static seed buffer (vec4 per instance in 7), see impostor.vert
+	void drawSeeds(Shader *shader, unsigned int seedVBO, size_t instanceCount);
+	// Draws instanceCount spheres streamed as INSTANCE_POSITION_SCALE, with their positions of the last frame
+	// streamed the same way previousOffset bytes into the ring (in 5), for the motion pass
+	void drawMotion(Shader *shader, size_t offset, size_t previousOffset, size_t instanceCount);
+
+private:
+
+	StreamBuffer *stream;
+	unsigned int VAO, seedVAO, motionVAO;
+
+	vector<unsigned char> instances;
+	size_t count;
+};
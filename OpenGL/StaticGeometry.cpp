@@ -0,0 +1,134 @@
+#include "StaticGeometry.h"
+#include "GLState.h"
+
+#include <cfloat>
+
+StaticGeometry::StaticGeometry() : baked(false) {}
+
+StaticGeometry::~StaticGeometry() {
+
+	if (!baked)
+		return;
+
+	for (auto &iter : batches)
+	{
+		glDeleteVertexArrays(1, &iter.second.VAO);
+		GLState::getGLState().deleteBuffer(iter.second.VBO);
+		GLState::getGLState().deleteBuffer(iter.second.EBO);
+	}
+}
+
+void StaticGeometry::add(const string &batch, Model *model, const glm::mat4 &transform) {
+
+	if (baked) {
+		cout << "StaticGeometry: " << batch << " added after baking, ignored" << endl;
+		return;
+	}
+
+	bool first = batches.find(batch) == batches.end();
+	Batch &target = batches[batch];
+	if (first) {
+		target.boundsMin = glm::vec3(FLT_MAX);
+		target.boundsMax = glm::vec3(-FLT_MAX);
+	}
+	glm::mat3 linear = glm::mat3(transform);
+	glm::mat3 normalMatrix = glm::transpose(glm::inverse(linear));
+
+	for (unsigned int i = 0; i < model->meshes.size(); i++)
+	{
+		const Mesh &mesh = model->meshes[i];
+		unsigned int base = (unsigned int)target.vertices.size();
+
+		for (const Vertex &vertex : mesh.vertices)
+		{
+			Vertex moved = vertex;
+			moved.Position = glm::vec3(transform * glm::vec4(vertex.Position, 1.0f));
+			moved.Normal = glm::normalize(normalMatrix * vertex.Normal);
+			moved.Tangent = linear * vertex.Tangent;
+			moved.Bitangent = linear * vertex.Bitangent;
+			target.vertices.push_back(moved);
+
+			target.boundsMin = glm::min(target.boundsMin, moved.Position);
+			target.boundsMax = glm::max(target.boundsMax, moved.Position);
+		}
+
+		for (unsigned int index : mesh.indices)
+			target.indices.push_back(base + index);
+	}
+
+	target.merged++;
+}
+
+void StaticGeometry::bake() {
+
+	for (auto &iter : batches)
+	{
+		Batch &batch = iter.second;
+
+		glGenVertexArrays(1, &batch.VAO);
+		glGenBuffers(1, &batch.VBO);
+		glGenBuffers(1, &batch.EBO);
+
+		GLState &state = GLState::getGLState();
+		state.bindVertexArray(batch.VAO);
+
+		state.bindBuffer(GL_ARRAY_BUFFER, batch.VBO);
+		glBufferData(GL_ARRAY_BUFFER, batch.vertices.size() * sizeof(Vertex), &batch.vertices[0], GL_STATIC_DRAW);
+
+		state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch.EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, batch.indices.size() * sizeof(unsigned int), &batch.indices[0], GL_STATIC_DRAW);
+
+		// same layout as Mesh
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+
+		state.bindVertexArray(0);
+
+		batch.indexCount = (unsigned int)batch.indices.size();
+		vector<Vertex>().swap(batch.vertices);
+		vector<unsigned int>().swap(batch.indices);
+	}
+
+	baked = true;
+}
+
+void StaticGeometry::draw(const string &batch) {
+
+	auto iter = batches.find(batch);
+	if (!baked || iter == batches.end()) {
+		cout << "StaticGeometry: batch " << batch << " not baked" << endl;
+		return;
+	}
+
+	GLState::getGLState().bindVertexArray(iter->second.VAO);
+	glDrawElements(GL_TRIANGLES, iter->second.indexCount, GL_UNSIGNED_INT, 0);
+}
+
+size_t StaticGeometry::getBatchCount() const {
+	return batches.size();
+}
+
+size_t StaticGeometry::getMergedCount(const string &batch) const {
+
+	auto iter = batches.find(batch);
+	return iter == batches.end() ? 0 : iter->second.merged;
+}
+
+bool StaticGeometry::getBounds(const string &batch, glm::vec3 &boundsMin, glm::vec3 &boundsMax) const {
+
+	auto iter = batches.find(batch);
+	if (iter == batches.end())
+		return false;
+
+	boundsMin = iter->second.boundsMin;
+	boundsMax = iter->second.boundsMax;
+	return true;
+}
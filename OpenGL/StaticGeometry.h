@@ -0,0 +1,49 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <glad\glad.h>
+#include <glm\glm.hpp>
+
+#include "Model.h"
+
+using namespace std;
+
+// Geometry that never moves, baked into world space at load. Every batch (a room drawn with one texture and
+// one set of lights) is merged into a single vertex and index buffer and drawn with an identity model matrix.
+class StaticGeometry
+{
+public:
+
+	StaticGeometry();
+	~StaticGeometry();
+
+	// Appends the meshes of the model, moved by transform, to the batch. Only valid before bake().
+	void add(const string &batch, Model *model, const glm::mat4 &transform);
+
+	// Uploads every batch and frees the CPU copies
+	void bake();
+
+	void draw(const string &batch);
+
+	size_t getBatchCount() const;
+	size_t getMergedCount(const string &batch) const;
+
+	// World space box around the batch, false for an unknown batch
+	bool getBounds(const string &batch, glm::vec3 &boundsMin, glm::vec3 &boundsMax) const;
+
+private:
+
+	struct Batch {
+		vector<Vertex> vertices;
+		vector<unsigned int> indices;
+		unsigned int VAO, VBO, EBO;
+		unsigned int indexCount;
+		size_t merged;
+		glm::vec3 boundsMin, boundsMax;
+	};
+
+	map<string, Batch> batches;
+	bool baked;
+};
@@ -0,0 +1,134 @@
+#include "StreamBuffer.h"
+#include "GLState.h"
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+// glad is generated for GL 3.3, glBufferStorage (GL 4.4 / ARB_buffer_storage) is loaded by hand
+typedef void (APIENTRY *BufferStorageProc)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+
+StreamBuffer::StreamBuffer(size_t regionSize) : regionSize(regionSize), region(0), head(0), persistentMemory(nullptr), mapped(false) {
+
+	for (int i = 0; i < REGIONS; i++)
+		fences[i] = 0;
+
+	BufferStorageProc bufferStorage = nullptr;
+	if (glfwExtensionSupported("GL_ARB_buffer_storage"))
+		bufferStorage = (BufferStorageProc)glfwGetProcAddress("glBufferStorage");
+
+	GLState &state = GLState::getGLState();
+
+	// GL_COPY_WRITE_BUFFER leaves the array and uniform bindings of the caller alone
+	glGenBuffers(1, &buffer);
+	state.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+
+	if (bufferStorage) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		bufferStorage(GL_COPY_WRITE_BUFFER, REGIONS * regionSize, NULL, flags);
+		persistentMemory = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, REGIONS * regionSize, flags);
+
+		if (!persistentMemory)
+			cout << "StreamBuffer: persistent mapping failed, falling back to unsynchronized maps" << endl;
+	}
+
+	if (!persistentMemory) {
+		if (bufferStorage) {
+			// immutable storage cannot be respecified, start over with a mutable buffer
+			state.deleteBuffer(buffer);
+			glGenBuffers(1, &buffer);
+			state.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		}
+		glBufferData(GL_COPY_WRITE_BUFFER, REGIONS * regionSize, NULL, GL_STREAM_DRAW);
+	}
+}
+
+StreamBuffer::~StreamBuffer() {
+
+	for (int i = 0; i < REGIONS; i++)
+		if (fences[i])
+			glDeleteSync(fences[i]);
+
+	if (persistentMemory) {
+		GLState::getGLState().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	}
+
+	GLState::getGLState().deleteBuffer(buffer);
+}
+
+void* StreamBuffer::map(size_t size, size_t alignment, size_t &offset) {
+
+	size_t start = (head + alignment - 1) / alignment * alignment;
+	if (start + size > regionSize) {
+		cout << "StreamBuffer: region of " << regionSize << " bytes is full, " << size << " bytes dropped" << endl;
+		return nullptr;
+	}
+
+	head = start + size;
+	offset = region * regionSize + start;
+
+	if (persistentMemory)
+		return persistentMemory + offset;
+
+	GLState::getGLState().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	void *memory = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	mapped = memory != nullptr;
+
+	if (!mapped)
+		cout << "StreamBuffer: glMapBufferRange failed" << endl;
+
+	return memory;
+}
+
+void StreamBuffer::unmap() {
+
+	if (!mapped)
+		return;
+
+	GLState::getGLState().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	mapped = false;
+}
+
+void StreamBuffer::endFrame() {
+
+	if (fences[region])
+		glDeleteSync(fences[region]);
+	fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	region = (region + 1) % REGIONS;
+	head = 0;
+	waitFence(region);
+}
+
+void StreamBuffer::waitFence(int region) {
+
+	if (!fences[region])
+		return;
+
+	GLbitfield flags = 0;
+	while (true)
+	{
+		GLenum result = glClientWaitSync(fences[region], flags, 1000000);
+		if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+			break;
+		flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+	}
+
+	glDeleteSync(fences[region]);
+	fences[region] = 0;
+}
+
+unsigned int StreamBuffer::getBuffer() const {
+	return buffer;
+}
+
+size_t StreamBuffer::getRegionSize() const {
+	return regionSize;
+}
+
+bool StreamBuffer::isPersistent() const {
+	return persistentMemory != nullptr;
+}
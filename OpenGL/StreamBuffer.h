@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <glad\glad.h>
+#include <GLFW\glfw3.h>
+
+using namespace std;
+
+// Ring buffer for the data written every frame (instances, uniforms, ...). It is split in one region per frame
+// in flight and a fence guards every region, so writes are plain memcpys into memory the GPU no longer reads.
+// With ARB_buffer_storage the whole buffer stays persistently mapped, otherwise (plain GL 3.3) every
+// allocation maps its range unsynchronized, which is safe for the same reason.
+class StreamBuffer
+{
+public:
+
+	static const int REGIONS = 3;
+
+	StreamBuffer(size_t regionSize);
+	~StreamBuffer();
+
+	// Reserves size bytes of the current region and returns where to write them, nullptr if the region is full.
+	// offset is where the data starts inside getBuffer(). Every map must be followed by an unmap before drawing.
+	void* map(size_t size, size_t alignment, size_t &offset);
+	void unmap();
+
+	// Fences the region used by this frame and moves to the next one, waiting for the GPU if it still reads it
+	void endFrame();
+
+	unsigned int getBuffer() const;
+	size_t getRegionSize() const;
+	bool isPersistent() const;
+
+private:
+
+	unsigned int buffer;
+	size_t regionSize;
+	int region;
+	size_t head;
+	unsigned char *persistentMemory;
+	bool mapped;
+	GLsync fences[REGIONS];
+
+	void waitFence(int region);
+};
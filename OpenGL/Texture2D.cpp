@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Texture2D.h"
+#include "GLState.h"
 
 Texture2D::Texture2D() {}
 
@@ -20,7 +21,7 @@ Texture2D::Texture2D(const GLchar* texturePath) : Width(0), Height(0), Internal_
 			Image_Format = GL_RGBA;
 
 		Internal_Format = Image_Format;
-		glBindTexture(GL_TEXTURE_2D, TextureID);
+		GLState::getGLState().bindTexture(0, GL_TEXTURE_2D, TextureID);
 		glTexImage2D(GL_TEXTURE_2D, 0, Internal_Format, Width, Height, 0, Image_Format, GL_UNSIGNED_BYTE, data);
 		glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -42,6 +43,5 @@ Texture2D::~Texture2D() {}
 
 void Texture2D::Bind() const
 {
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, TextureID);
+	GLState::getGLState().bindTexture(0, GL_TEXTURE_2D, TextureID);
 }
\ No newline at end of file
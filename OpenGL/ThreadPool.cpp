@@ -0,0 +1,126 @@
+#include "ThreadPool.h"
+
+ThreadPool* ThreadPool::threadPool = nullptr;
+
+ThreadPool::ThreadPool(unsigned int workerCount) : currentJob(nullptr), jobCount(0), jobGrain(1), jobChunks(0), nextChunk(0), finishedChunks(0), activeWorkers(0), generation(0), stopping(false)
+{
+	for (unsigned int i = 0; i < workerCount; i++)
+		workers.push_back(thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		unique_lock<mutex> lock(jobMutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+
+	for (unsigned int i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+ThreadPool& ThreadPool::getThreadPool() {
+
+	if (threadPool == nullptr) {
+		unsigned int cores = thread::hardware_concurrency();
+		threadPool = new ThreadPool(cores > 1 ? cores - 1 : 0);
+	}
+
+	return *threadPool;
+}
+
+void ThreadPool::destroyThreadPool() {
+
+	delete threadPool;
+	threadPool = nullptr;
+}
+
+unsigned int ThreadPool::getThreadCount() {
+	return (unsigned int)workers.size() + 1;
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grain, const function<void(size_t, size_t)> &job) {
+
+	if (count == 0)
+		return;
+	if (grain == 0)
+		grain = 1;
+
+	size_t chunks = (count + grain - 1) / grain;
+	if (workers.empty() || chunks == 1) {
+		job(0, count);
+		return;
+	}
+
+	// the pool runs one job at a time, the fluid thread and the render thread both submit
+	lock_guard<mutex> submit(submitMutex);
+
+	{
+		unique_lock<mutex> lock(jobMutex);
+		currentJob = &job;
+		jobCount = count;
+		jobGrain = grain;
+		jobChunks = chunks;
+		finishedChunks = 0;
+		nextChunk = 0;
+		generation++;
+	}
+	wakeCondition.notify_all();
+
+	size_t done = runChunks();
+
+	unique_lock<mutex> lock(jobMutex);
+	finishedChunks += done;
+
+	// workers that woke up for this job must be out of runChunks before the job can go out of scope
+	doneCondition.wait(lock, [this] { return finishedChunks == jobChunks && activeWorkers == 0; });
+	currentJob = nullptr;
+}
+
+size_t ThreadPool::runChunks() {
+
+	size_t done = 0;
+
+	for (;;)
+	{
+		size_t chunk = nextChunk++;
+		if (chunk >= jobChunks)
+			break;
+
+		size_t begin = chunk * jobGrain;
+		size_t end = begin + jobGrain < jobCount ? begin + jobGrain : jobCount;
+		(*currentJob)(begin, end);
+		done++;
+	}
+
+	return done;
+}
+
+void ThreadPool::workerLoop() {
+
+	unsigned int seen = 0;
+
+	for (;;)
+	{
+		{
+			unique_lock<mutex> lock(jobMutex);
+			wakeCondition.wait(lock, [this, seen] { return stopping || (generation != seen && currentJob != nullptr); });
+
+			if (stopping)
+				return;
+
+			seen = generation;
+			activeWorkers++;
+		}
+
+		size_t done = runChunks();
+
+		{
+			unique_lock<mutex> lock(jobMutex);
+			finishedChunks += done;
+			activeWorkers--;
+		}
+		doneCondition.notify_all();
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+using namespace std;
+
+// Persistent worker threads for data-parallel loops. The calling thread takes part in every job,
+// so a pool with no workers simply runs the loop inline.
+class ThreadPool
+{
+public:
+
+	static ThreadPool& getThreadPool();
+	static void destroyThreadPool();
+
+	ThreadPool(unsigned int workerCount);
+	~ThreadPool();
+
+	unsigned int getThreadCount();
+
+	// Runs job(begin, end) over [0, count) in chunks of grain elements and returns when all chunks are done.
+	// Jobs from different threads run one after the other.
+	void parallelFor(size_t count, size_t grain, const function<void(size_t, size_t)> &job);
+
+private:
+
+	static ThreadPool *threadPool;
+
+	vector<thread> workers;
+
+	mutex submitMutex;
+	mutex jobMutex;
+	condition_variable wakeCondition;
+	condition_variable doneCondition;
+
+	const function<void(size_t, size_t)> *currentJob;
+	size_t jobCount, jobGrain, jobChunks;
+	atomic<size_t> nextChunk;
+	size_t finishedChunks;
+	unsigned int activeWorkers;
+	unsigned int generation;
+	bool stopping;
+
+	void workerLoop();
+	size_t runChunks();
+};
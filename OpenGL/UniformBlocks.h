@@ -0,0 +1,18 @@
+#pragma once
+
+#include <glm\glm.hpp>
+
+// std140 mirrors of the uniform blocks declared by the shaders, every vec3 is padded to a vec4
+
+enum UniformBlockBinding {
+	FRAME_BLOCK = 0		// FrameData
+};
+
+struct FrameBlock {
+	glm::mat4 projectionMatrix;
+	glm::mat4 viewMatrix;
+	glm::vec4 cameraPosition;
+	float time;			// seconds since start
+	float particleTime;	// the same, wrapping around every RenderSystem::TIME_PERIOD, for the stateless particles
+	float padding[2];
+};
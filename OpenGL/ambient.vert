@@ -0,0 +1,61 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 7) in vec4 aSeed;
+
+out vec2 TexCoords;
+
+layout (std140) uniform FrameData {
+    mat4 projectionMatrix;
+    mat4 viewMatrix;
+    vec4 cameraPosition;
+    float time;
+    float particleTime;
+};
+
+uniform vec3 boundsMin;
+uniform vec3 boundsSize;
+uniform vec3 velocity;
+uniform vec3 velocityJitter;
+uniform vec3 rotationAxis;
+uniform vec2 scaleRange;
+uniform float timePeriod;
+
+// the motion pass marks the particles by drawing them again over their own depth, see reactive.frag
+invariant gl_Position;
+
+vec3 random3(float seed)
+{
+    return fract(sin(vec3(seed, seed + 1.0, seed + 2.0) * 78.233) * 43758.5453);
+}
+
+mat3 rotation(vec3 axis, float angle)
+{
+    float s = sin(angle);
+    float c = cos(angle);
+    float t = 1.0 - c;
+
+    return mat3(t * axis.x * axis.x + c,          t * axis.x * axis.y + s * axis.z, t * axis.x * axis.z - s * axis.y,
+                t * axis.x * axis.y - s * axis.z, t * axis.y * axis.y + c,          t * axis.y * axis.z + s * axis.x,
+                t * axis.x * axis.z + s * axis.y, t * axis.y * axis.z - s * axis.x, t * axis.z * axis.z + c);
+}
+
+// aSeed.xyz is where the particle was at time zero inside the bounds (0-1), aSeed.w a random number.
+// The particle flies in a straight line and wraps around the bounds, nothing is stored between frames. Its
+// velocity is rounded to whole crossings of the bounds per time period, particleTime wraps around at its end.
+void main()
+{
+    TexCoords = aTexCoords;
+
+    vec3 random = fract(aSeed.w * vec3(97.0, 389.0, 1031.0));
+    vec3 particleVelocity = velocity + velocityJitter * (random * 2.0 - 1.0);
+    vec3 crossings = round(particleVelocity * timePeriod / boundsSize);
+    vec3 position = boundsMin + fract(aSeed.xyz + crossings * (particleTime / timePeriod)) * boundsSize;
+
+    float scale = mix(scaleRange.x, scaleRange.y, aSeed.w);
+    mat3 orientation = rotation(rotationAxis, random3(aSeed.w + 3.0).x * 6.2831853);
+
+    gl_Position = projectionMatrix * viewMatrix * vec4(position + orientation * (aPos * scale), 1.0f);
+}
@@ -0,0 +1,34 @@
+#version 330 core
+
+layout (location = 7) in vec4 aSeed;
+
+layout (std140) uniform FrameData {
+    mat4 projectionMatrix;
+    mat4 viewMatrix;
+    vec4 cameraPosition;
+    float time;
+    float particleTime;
+};
+
+uniform vec3 boundsMin;
+uniform vec3 boundsSize;
+uniform vec3 velocity;
+uniform vec3 velocityJitter;
+uniform vec2 scaleRange;
+uniform float timePeriod;
+uniform float pointSize;
+
+// the motion pass marks the particles by drawing them again over their own depth, see reactive.frag
+invariant gl_Position;
+
+// The particles of ambient.vert drawn as one point each
+void main()
+{
+    vec3 random = fract(aSeed.w * vec3(97.0, 389.0, 1031.0));
+    vec3 particleVelocity = velocity + velocityJitter * (random * 2.0 - 1.0);
+    vec3 crossings = round(particleVelocity * timePeriod / boundsSize);
+    vec3 position = boundsMin + fract(aSeed.xyz + crossings * (particleTime / timePeriod)) * boundsSize;
+
+    gl_Position = projectionMatrix * viewMatrix * vec4(position, 1.0f);
+    gl_PointSize = max(1.0, pointSize * mix(scaleRange.x, scaleRange.y, aSeed.w) / gl_Position.w);
+}
@@ -0,0 +1,23 @@
+#version 330 core
+
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// the level above, twice the size of the one drawn
+uniform sampler2D image;
+
+// Dual filter downsample: every tap sits between four texels of the level above, so the five bilinear taps
+// average a 4x4 block with the center counted four times
+void main()
+{
+    vec2 texel = 1.0 / textureSize(image, 0);
+
+    vec3 result = texture(image, TexCoords).rgb * 4.0;
+    result += texture(image, TexCoords + vec2(-texel.x, -texel.y)).rgb;
+    result += texture(image, TexCoords + vec2( texel.x, -texel.y)).rgb;
+    result += texture(image, TexCoords + vec2(-texel.x,  texel.y)).rgb;
+    result += texture(image, TexCoords + vec2( texel.x,  texel.y)).rgb;
+
+    FragColor = vec4(result / 8.0, 1.0);
+}
@@ -0,0 +1,25 @@
+#version 330 core
+
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// the level below, half the size of the one drawn
+uniform sampler2D image;
+
+// Dual filter upsample: a tent of eight bilinear taps, the four diagonal ones weighted twice
+void main()
+{
+    vec2 texel = 1.0 / textureSize(image, 0);
+
+    vec3 result = texture(image, TexCoords + vec2(-texel.x, 0.0)).rgb;
+    result += texture(image, TexCoords + vec2( texel.x, 0.0)).rgb;
+    result += texture(image, TexCoords + vec2(0.0, -texel.y)).rgb;
+    result += texture(image, TexCoords + vec2(0.0,  texel.y)).rgb;
+    result += texture(image, TexCoords + vec2(-texel.x, -texel.y) * 0.5).rgb * 2.0;
+    result += texture(image, TexCoords + vec2( texel.x, -texel.y) * 0.5).rgb * 2.0;
+    result += texture(image, TexCoords + vec2(-texel.x,  texel.y) * 0.5).rgb * 2.0;
+    result += texture(image, TexCoords + vec2( texel.x,  texel.y) * 0.5).rgb * 2.0;
+
+    FragColor = vec4(result / 12.0, 1.0);
+}
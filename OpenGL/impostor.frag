@@ -0,0 +1,162 @@
+#version 330 core
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 BrightColor;
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+    sampler2D emission;
+
+    float shininess;
+};
+
+// ClusterLight in LightClusters.h
+struct PointLight {
+    vec4 position; // range in w
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+    vec4 attenuation; // constant, linear, quadratic
+    vec4 boundsMin;
+    vec4 boundsMax;
+};
+
+in vec3 QuadPos;
+flat in vec4 Sphere;
+flat in vec4 Rotation;
+flat in vec3 PreviousCenter;
+
+layout (std140) uniform FrameData {
+    mat4 projectionMatrix;
+    mat4 viewMatrix;
+    vec4 cameraPosition;
+    float time;
+};
+
+// the clustered lights, see LightShader.frag
+uniform usamplerBuffer clusterLights;
+uniform usamplerBuffer lightIndices;
+uniform samplerBuffer lightData;
+uniform vec3 clusterGrid;
+uniform vec2 clusterScale;
+uniform vec2 clusterDepth;
+
+uniform Material material;
+uniform sampler2D diffuseTexture;
+uniform float pixelsPerUnit;
+
+// lit spheres are shaded like LightShader.frag, the others mix their texture with color like wind.frag
+uniform bool lit;
+uniform vec4 color;
+uniform float mixRatio;
+
+// the motion pass writes the sphere's screen motion instead of its colour, at the very same depth, see motion.frag.
+// Reactive spheres are only marked, taa.frag then takes them from the current frame alone.
+uniform bool motion;
+uniform bool reactive;
+uniform mat4 previousViewProjection;
+
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec2 texCoords);
+int ClusterIndex(vec3 fragPos);
+PointLight FetchLight(int index);
+
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main() {
+
+    vec3 rayDir = normalize(QuadPos - cameraPosition.xyz);
+    vec3 fromCenter = cameraPosition.xyz - Sphere.xyz;
+
+    // nearest root of |fromCenter + t * rayDir| = radius
+    float b = dot(fromCenter, rayDir);
+    float h = b * b - dot(fromCenter, fromCenter) + Sphere.w * Sphere.w;
+
+    vec3 normal;
+    if (h >= 0.0)
+        normal = (fromCenter + rayDir * (-b - sqrt(h))) / Sphere.w;
+    else if (Sphere.w * pixelsPerUnit < 0.5 * length(fromCenter))
+        normal = normalize(fromCenter);
+    else
+        discard;
+
+    vec3 FragPos = Sphere.xyz + normal * Sphere.w;
+    vec4 clipPos = projectionMatrix * viewMatrix * vec4(FragPos, 1.0);
+    gl_FragDepth = clipPos.z / clipPos.w * 0.5 + 0.5;
+
+    if (motion) {
+        // the sphere only moved, the point hit now was at the same place on it last frame
+        vec4 previousClip = previousViewProjection * vec4(FragPos - Sphere.xyz + PreviousCenter, 1.0);
+        vec4 stillClip = previousViewProjection * vec4(FragPos, 1.0);
+        FragColor = reactive ? vec4(0.0, 0.0, 1.0, 1.0) : vec4((previousClip.xy / previousClip.w - stillClip.xy / stillClip.w) * 0.5, 0.0, 1.0);
+        BrightColor = vec4(0.0);
+        return;
+    }
+
+    // uv sphere mapping in the sphere's own frame, u is taken from whichever side keeps its seam out of the
+    // pixel quad so the mip level stays right across it
+    vec3 local = rotate(vec4(-Rotation.xyz, Rotation.w), normal);
+    float u = atan(local.z, local.x) * 0.15915494 + 0.5;
+    float seamless = fract(u + 0.5) - 0.5;
+    vec2 TexCoords = vec2(fwidth(u) <= fwidth(seamless) ? u : seamless, acos(clamp(local.y, -1.0, 1.0)) * 0.31830989);
+
+    if (!lit) {
+        FragColor = mix(texture(diffuseTexture, TexCoords), color, mixRatio);
+        BrightColor = vec4(0.0);
+        return;
+    }
+
+    vec3 viewDir = normalize(cameraPosition.xyz - FragPos);
+    vec3 result = vec3(0.0);
+    uvec2 lights = texelFetch(clusterLights, ClusterIndex(FragPos)).xy;
+    for (uint i = 0u; i < lights.y; i++)
+    {
+        PointLight light = FetchLight(int(texelFetch(lightIndices, int(lights.x + i)).r));
+        if (all(greaterThanEqual(FragPos, light.boundsMin.xyz)) && all(lessThanEqual(FragPos, light.boundsMax.xyz)))
+            result += CalcPointLight(light, normal, FragPos, viewDir, TexCoords);
+    }
+
+    float brightness = dot(result, vec3(0.2126, 0.7152, 0.0722));
+    if (brightness > 1.0)
+        BrightColor = vec4(result, 1.0);
+    else
+        BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
+    FragColor = vec4(result, 1.0);
+}
+
+// LightShader.frag's point light with the texture coordinates passed in, and its cluster lookup
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec2 texCoords) {
+
+    vec3 lightDir = normalize(light.position.xyz - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    float distance = length(light.position.xyz - fragPos);
+    float attenuation = 1.0 / (light.attenuation.x + light.attenuation.y * distance + light.attenuation.z * (distance * distance));
+    attenuation *= clamp(1.0 - pow(distance / light.position.w, 4.0), 0.0, 1.0);
+
+    vec3 texel = texture(diffuseTexture, texCoords).rgb * attenuation * attenuation;
+    vec3 ambient  = light.ambient.rgb  * vec3(texture(material.diffuse, texCoords)) * texel;
+    vec3 diffuse  = light.diffuse.rgb  * diff * vec3(texture(material.diffuse, texCoords)) * texel;
+    vec3 specular = light.specular.rgb * spec * vec3(texture(material.specular, texCoords)) * texel;
+
+    return (ambient + diffuse + specular);
+}
+
+int ClusterIndex(vec3 fragPos) {
+
+    float depth = -(viewMatrix * vec4(fragPos, 1.0)).z;
+    ivec3 cluster = ivec3(ivec2(gl_FragCoord.xy * clusterScale), int(log(depth) * clusterDepth.x + clusterDepth.y));
+    cluster = clamp(cluster, ivec3(0), ivec3(clusterGrid) - 1);
+
+    return (cluster.z * int(clusterGrid.y) + cluster.y) * int(clusterGrid.x) + cluster.x;
+}
+
+PointLight FetchLight(int index) {
+
+    int texel = index * 7;
+    return PointLight(texelFetch(lightData, texel), texelFetch(lightData, texel + 1), texelFetch(lightData, texel + 2), texelFetch(lightData, texel + 3),
+        texelFetch(lightData, texel + 4), texelFetch(lightData, texel + 5), texelFetch(lightData, texel + 6));
+}
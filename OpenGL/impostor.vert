@@ -0,0 +1,77 @@
+#version 330 core
+
+// position + radius in 3 and an optional rotation quaternion in 4 (see InstanceFormat.h), no vertex data
+layout (location = 3) in vec4 aInstance0;
+layout (location = 4) in vec4 aInstance1;
+// the motion pass: where the sphere was last frame, position in xyz
+layout (location = 5) in vec4 aPrevious;
+// or the seed of a stateless particle, see ambient.vert
+layout (location = 7) in vec4 aSeed;
+
+layout (std140) uniform FrameData {
+    mat4 projectionMatrix;
+    mat4 viewMatrix;
+    vec4 cameraPosition;
+    float time;
+    float particleTime;
+};
+uniform float pixelsPerUnit;
+// radius of the mesh the instance scale was meant for
+uniform float radiusScale;
+
+uniform bool stateless;
+uniform vec3 boundsMin;
+uniform vec3 boundsSize;
+uniform vec3 velocity;
+uniform vec3 velocityJitter;
+uniform vec2 scaleRange;
+uniform float timePeriod;
+
+out vec3 QuadPos;
+flat out vec4 Sphere;
+flat out vec4 Rotation;
+flat out vec3 PreviousCenter;
+
+void main()
+{
+    // triangle strip corners (-1,-1) (1,-1) (-1,1) (1,1)
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+
+    vec3 center;
+    float radius;
+    if (stateless) {
+        vec3 random = fract(aSeed.w * vec3(97.0, 389.0, 1031.0));
+        vec3 particleVelocity = velocity + velocityJitter * (random * 2.0 - 1.0);
+        vec3 crossings = round(particleVelocity * timePeriod / boundsSize);
+        center = boundsMin + fract(aSeed.xyz + crossings * (particleTime / timePeriod)) * boundsSize;
+        radius = mix(scaleRange.x, scaleRange.y, aSeed.w) * radiusScale;
+        Rotation = vec4(0.0, 0.0, 0.0, 1.0);
+    }
+    else {
+        center = aInstance0.xyz;
+        radius = aInstance0.w * radiusScale;
+        Rotation = normalize(aInstance1);
+    }
+    Sphere = vec4(center, radius);
+    PreviousCenter = aPrevious.xyz;
+
+    vec3 toCamera = cameraPosition.xyz - center;
+    float distance = length(toCamera);
+    if (distance <= radius) {
+        // the camera is inside, nothing of the sphere faces it
+        gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    vec3 w = toCamera / distance;
+    vec3 u = normalize(cross(abs(w.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0), w));
+    vec3 v = cross(w, u);
+
+    // the quad goes through the center, where the cone tangent to the sphere is wider than the radius.
+    // Spheres below a pixel keep a pixel wide quad, impostor.frag then shades the whole of it.
+    float size = radius * distance / sqrt(distance * distance - radius * radius);
+    size = max(size, 0.5 * distance / pixelsPerUnit);
+
+    QuadPos = center + (u * corner.x + v * corner.y) * size;
+    gl_Position = projectionMatrix * viewMatrix * vec4(QuadPos, 1.0);
+}
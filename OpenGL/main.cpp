@@ -1,6 +1,7 @@
 #include <iostream>
 #include "GameManager.h"
 #include "Camera.h";
+#include "Benchmark.h"
 #include <btBulletDynamicsCommon.h>
 
 bool firstMouse = true;
@@ -13,7 +14,10 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 
-int main() {
+int main(int argc, char **argv) {
+
+	if (argc > 1 && string(argv[1]) == "--benchmark")
+		return runBenchmarks(argc - 2, argv + 2);
 
 	camera = &Camera::getCamera();
 	gameManager = &GameManager::getGameManager();
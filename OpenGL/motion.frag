@@ -0,0 +1,14 @@
+#version 330 core
+
+layout (location = 0) out vec4 Motion;
+
+in vec4 PreviousClip;
+in vec4 StillClip;
+
+// Screen motion of a body on top of the camera's own, in texture coordinates. The rest of the scene is still
+// and keeps the cleared 0, taa.frag reprojects it from the depth alone. Blue is the reactive mark, 0 here.
+void main()
+{
+    vec2 motion = (PreviousClip.xy / PreviousClip.w - StillClip.xy / StillClip.w) * 0.5;
+    Motion = vec4(motion, 0.0, 1.0);
+}
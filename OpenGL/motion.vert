@@ -0,0 +1,53 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPositionVertex;
+
+// the instances exactly as LightShader.vert reads them, and last frame's model matrix of each in 7-10
+layout (location = 3) in vec4 aInstance0;
+layout (location = 4) in vec4 aInstance1;
+layout (location = 5) in vec4 aInstance2;
+layout (location = 6) in vec4 aInstance3;
+layout (location = 7) in mat4 aPreviousModel;
+
+layout (std140) uniform FrameData {
+    mat4 projectionMatrix;
+    mat4 viewMatrix;
+    vec4 cameraPosition;
+    float time;
+};
+
+uniform mat4 modelMatrix;
+uniform mat4 previousModelMatrix;
+uniform mat4 previousViewProjection;
+uniform bool instanced;
+uniform bool instanceMatrix;
+
+// where the vertex was last frame, and where its point of this frame would have been had the body not moved
+out vec4 PreviousClip;
+out vec4 StillClip;
+
+// the position is computed as in LightShader.vert, so the bodies pass the depth test against themselves
+invariant gl_Position;
+
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main()
+{
+    vec3 FragPos;
+    if (instanced && !instanceMatrix) {
+        vec4 rotation = normalize(aInstance1);
+        FragPos = aInstance0.xyz + rotate(rotation, aPositionVertex * aInstance0.w);
+    }
+    else {
+        mat4 model = instanced ? mat4(aInstance0, aInstance1, aInstance2, aInstance3) : modelMatrix;
+        FragPos = vec3(model * vec4(aPositionVertex, 1.0));
+    }
+
+    PreviousClip = previousViewProjection * (instanced ? aPreviousModel : previousModelMatrix) * vec4(aPositionVertex, 1.0);
+    StillClip = previousViewProjection * vec4(FragPos, 1.0);
+
+    gl_Position = projectionMatrix * viewMatrix * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,12 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform vec4 color;
+uniform float mixRatio;
+uniform sampler2D texture_diffuse1;
+
+// a point is too small to show the texture, its smallest mip level (the average colour) stands in for it
+void main()
+{
+    FragColor = mix(textureLod(texture_diffuse1, vec2(0.5), 16.0), color, mixRatio);
+}
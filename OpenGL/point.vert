@@ -0,0 +1,34 @@
+#version 330 core
+
+// one point per instance, in the same formats as wind.vert (see InstanceFormat.h)
+layout (location = 3) in vec4 aInstance0;
+layout (location = 6) in vec4 aInstance3;
+
+layout (std140) uniform FrameData {
+    mat4 projectionMatrix;
+    mat4 viewMatrix;
+    vec4 cameraPosition;
+    float time;
+};
+uniform bool instanceMatrix;
+uniform float pointSize;
+
+// the motion pass marks the particles by drawing them again over their own depth, see reactive.frag
+invariant gl_Position;
+
+void main()
+{
+    vec3 worldPos;
+    float scale;
+    if (instanceMatrix) {
+        worldPos = aInstance3.xyz;
+        scale = length(aInstance0.xyz);
+    }
+    else {
+        worldPos = aInstance0.xyz;
+        scale = aInstance0.w;
+    }
+
+    gl_Position = projectionMatrix * viewMatrix * vec4(worldPos, 1.0f);
+    gl_PointSize = max(1.0, pointSize * scale / gl_Position.w);
+}
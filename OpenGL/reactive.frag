@@ -0,0 +1,8 @@
+#version 330 core
+layout (location = 0) out vec4 Motion;
+
+// The particles in the motion pass: no motion, only the reactive mark in blue, see taa.frag
+void main()
+{
+    Motion = vec4(0.0, 0.0, 1.0, 1.0);
+}
@@ -0,0 +1,130 @@
+#version 330 core
+
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// the jittered scene and its depth and body motion, all at the scene resolution. Motion is in rg, the reactive
+// mark of the particles in b.
+uniform sampler2D scene;
+uniform sampler2D depth;
+uniform sampler2D motion;
+// last frame's output, at the window resolution
+uniform sampler2D history;
+
+// how far the projection was moved this frame, in texture coordinates
+uniform vec2 jitter;
+// from the jittered clip space of this frame to the clip space of the last one
+uniform mat4 reprojection;
+uniform bool historyValid;
+
+// blending in a reversibly tone mapped space keeps the bright pixels from flickering
+vec3 compress(vec3 color)
+{
+    return color / (1.0 + max(color.r, max(color.g, color.b)));
+}
+
+vec3 uncompress(vec3 color)
+{
+    return color / max(1.0 - max(color.r, max(color.g, color.b)), 1.0 / 65504.0);
+}
+
+vec3 toYCoCg(vec3 color)
+{
+    return vec3(dot(color, vec3(0.25, 0.5, 0.25)), dot(color, vec3(0.5, 0.0, -0.5)), dot(color, vec3(-0.25, 0.5, -0.25)));
+}
+
+vec3 toRGB(vec3 color)
+{
+    return vec3(color.x + color.y - color.z, color.x + color.z, color.x - color.y - color.z);
+}
+
+// Catmull-Rom filtered history in five bilinear taps, a plain bilinear history blurs a little more every frame
+vec3 sampleHistory(vec2 uv)
+{
+    vec2 size = textureSize(history, 0);
+    vec2 position = uv * size;
+    vec2 texel1 = floor(position - 0.5) + 0.5;
+    vec2 f = position - texel1;
+
+    vec2 w0 = f * (-0.5 + f * (1.0 - 0.5 * f));
+    vec2 w1 = 1.0 + f * f * (-2.5 + 1.5 * f);
+    vec2 w2 = f * (0.5 + f * (2.0 - 1.5 * f));
+    vec2 w3 = f * f * (-0.5 + 0.5 * f);
+
+    vec2 w12 = w1 + w2;
+    vec2 texel0 = (texel1 - 1.0) / size;
+    vec2 texel3 = (texel1 + 2.0) / size;
+    vec2 texel12 = (texel1 + w2 / w12) / size;
+
+    vec3 result = texture(history, vec2(texel12.x, texel0.y)).rgb * w12.x * w0.y;
+    result += texture(history, vec2(texel0.x, texel12.y)).rgb * w0.x * w12.y;
+    result += texture(history, texel12).rgb * w12.x * w12.y;
+    result += texture(history, vec2(texel3.x, texel12.y)).rgb * w3.x * w12.y;
+    result += texture(history, vec2(texel12.x, texel3.y)).rgb * w12.x * w3.y;
+
+    float weight = w12.x * w0.y + w0.x * w12.y + w12.x * w12.y + w3.x * w12.y + w12.x * w3.y;
+    return max(result / weight, vec3(0.0));
+}
+
+void main()
+{
+    vec2 sceneSize = textureSize(scene, 0);
+    vec2 sceneTexel = 1.0 / sceneSize;
+
+    // where this pixel landed in the jittered scene, and the scene pixel nearest to it
+    vec2 sampleUV = TexCoords + jitter;
+    vec2 nearest = (floor(sampleUV * sceneSize) + 0.5) * sceneTexel;
+
+    // the 3x3 neighbourhood gives the colours the history may take and the closest depth, so edges move with
+    // the object in front
+    vec3 moment1 = vec3(0.0), moment2 = vec3(0.0);
+    float closestDepth = 1.0;
+    vec2 closestUV = nearest;
+    for (int y = -1; y <= 1; y++)
+    {
+        for (int x = -1; x <= 1; x++)
+        {
+            vec2 uv = nearest + vec2(x, y) * sceneTexel;
+            vec3 color = toYCoCg(compress(texture(scene, uv).rgb));
+            moment1 += color;
+            moment2 += color * color;
+
+            float d = texture(depth, uv).r;
+            if (d < closestDepth) {
+                closestDepth = d;
+                closestUV = uv;
+            }
+        }
+    }
+
+    vec3 current = toYCoCg(compress(texture(scene, sampleUV).rgb));
+
+    vec4 previous = reprojection * vec4(vec3(closestUV, closestDepth) * 2.0 - 1.0, 1.0);
+    vec2 velocity = previous.xy / previous.w * 0.5 + 0.5 - (closestUV - jitter) + texture(motion, closestUV).xy;
+    vec2 historyUV = TexCoords + velocity;
+
+    if (!historyValid || any(lessThan(historyUV, vec2(0.0))) || any(greaterThan(historyUV, vec2(1.0)))) {
+        FragColor = vec4(uncompress(toRGB(current)), 1.0);
+        return;
+    }
+
+    // variance clipping: the history is pulled toward the neighbourhood mean until it fits its spread
+    vec3 mean = moment1 / 9.0;
+    vec3 sigma = sqrt(max(moment2 / 9.0 - mean * mean, 0.0)) * 1.25;
+    vec3 previousColor = toYCoCg(compress(sampleHistory(historyUV)));
+    vec3 offset = previousColor - mean;
+    vec3 units = abs(offset / max(sigma, vec3(0.0001)));
+    float excess = max(units.x, max(units.y, units.z));
+    if (excess > 1.0)
+        previousColor = mean + offset / excess;
+
+    // a scene sample right on the pixel counts more than one interpolated from far away
+    vec2 fromCenter = (sampleUV - nearest) * sceneSize;
+    float weight = 0.04 + 0.12 * exp(-2.29 * dot(fromCenter, fromCenter));
+
+    // the particles have no motion to follow, their pixels are taken from the current frame so they leave no trail
+    weight = mix(weight, 1.0, texture(motion, nearest).b);
+
+    FragColor = vec4(uncompress(toRGB(mix(previousColor, current, weight))), 1.0);
+}
@@ -3,16 +3,40 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
-layout (location = 3) in mat4 aInstanceMatrix;
+
+// either a mat4 in 3-6, or position + scale in 3 and an optional rotation quaternion in 4 (see InstanceFormat.h)
+layout (location = 3) in vec4 aInstance0;
+layout (location = 4) in vec4 aInstance1;
+layout (location = 5) in vec4 aInstance2;
+layout (location = 6) in vec4 aInstance3;
 
 out vec2 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+layout (std140) uniform FrameData {
+    mat4 projectionMatrix;
+    mat4 viewMatrix;
+    vec4 cameraPosition;
+    float time;
+};
+uniform bool instanceMatrix;
+
+// the motion pass marks the particles by drawing them again over their own depth, see reactive.frag
+invariant gl_Position;
+
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
 
 void main()
 {
     TexCoords = aTexCoords;
 
-    gl_Position = projection * view * aInstanceMatrix * vec4(aPos, 1.0f); 
-}
\ No newline at end of file
+    vec3 worldPos;
+    if (instanceMatrix)
+        worldPos = (mat4(aInstance0, aInstance1, aInstance2, aInstance3) * vec4(aPos, 1.0f)).xyz;
+    else
+        worldPos = aInstance0.xyz + rotate(normalize(aInstance1), aPos * aInstance0.w);
+
+    gl_Position = projectionMatrix * viewMatrix * vec4(worldPos, 1.0f);
+}